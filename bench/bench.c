@@ -0,0 +1,178 @@
+#include "bench.h"
+
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// the bench target links with -Wl,--wrap=malloc etc., so the calls of the program and lib to these end up here:
+
+static size_t nallocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    nallocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    nallocs++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    nallocs++;
+    return __real_realloc(ptr, size);
+}
+
+volatile size_t bench_sink;
+
+struct BenchSample {
+    size_t niterations;
+    uint64_t ns;
+    uint64_t cycles;
+    size_t nallocs;
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t read_cycles(const struct BenchSuite *suite)
+{
+    uint64_t cycles = 0;
+    if (suite->cycles_fd >= 0 && read(suite->cycles_fd, &cycles, sizeof(cycles)) == sizeof(cycles)) {
+        return cycles;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void bench_suite_init(struct BenchSuite *suite)
+{
+    *suite = (struct BenchSuite){
+        .repetitions = BENCH_DEFAULT_REPETITIONS,
+        .min_time_ms = BENCH_DEFAULT_MIN_TIME_MS,
+    };
+
+    // cycles spent by the process in user space. not permitted in some containers and virtual machines, where TSC
+    // ticks, which do not follow the clock of the cpu, are counted instead:
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CPU_CYCLES,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    suite->cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+void bench_suite_destroy(struct BenchSuite *suite)
+{
+    if (suite->cycles_fd >= 0) {
+        close(suite->cycles_fd);
+    }
+    suite->cycles_fd = -1;
+}
+
+void bench_report_begin(const struct BenchSuite *suite)
+{
+#if defined(__SANITIZE_ADDRESS__)
+    fprintf(stderr, "warning: built with sanitizers, configure with -DCMAKE_BUILD_TYPE=Release for real numbers\n");
+#endif
+    if (!suite->json) {
+        printf("%-40s %12s %10s %10s %10s\n",
+               "benchmark",
+               "iterations",
+               "ns/op",
+               suite->cycles_fd >= 0 ? "cycles/op" : "tsc/op",
+               "allocs/op");
+    }
+}
+
+static struct BenchSample measure(const struct BenchSuite *suite, const bench_func_t func, void *ctx, const size_t n)
+{
+    const size_t nallocs_before = nallocs;
+    const uint64_t cycles_before = read_cycles(suite);
+    const uint64_t ns_before = now_ns();
+    func(ctx, n);
+    const uint64_t ns_after = now_ns();
+    const uint64_t cycles_after = read_cycles(suite);
+    return (struct BenchSample){
+        .niterations = n,
+        .ns = ns_after - ns_before,
+        .cycles = cycles_after - cycles_before,
+        .nallocs = nallocs - nallocs_before,
+    };
+}
+
+static int compare_samples(const void *lhs, const void *rhs)
+{
+    const struct BenchSample *a = lhs;
+    const struct BenchSample *b = rhs;
+    return (a->ns > b->ns) - (a->ns < b->ns);
+}
+
+void bench_run(const struct BenchSuite *suite, const char *name, const bench_func_t func, void *ctx)
+{
+    if (suite->filter && !strstr(name, suite->filter)) {
+        return;
+    }
+
+    // grow the number of iterations until a measurement takes min_time_ms. this warms up the caches too:
+    const uint64_t min_time_ns = (uint64_t)suite->min_time_ms * 1000000u;
+    size_t n = 1;
+    for (;;) {
+        const struct BenchSample sample = measure(suite, func, ctx, n);
+        if (sample.ns >= min_time_ns || n >= ((size_t)1 << 40)) {
+            break;
+        }
+        const double scale = sample.ns > 0 ? 1.2 * (double)min_time_ns / (double)sample.ns : 100.0;
+        n = (size_t)((double)n * (scale < 2.0 ? 2.0 : scale > 100.0 ? 100.0 : scale));
+    }
+
+    struct BenchSample samples[64];
+    const size_t nsamples = suite->repetitions < 64 ? (suite->repetitions > 0 ? suite->repetitions : 1) : 64;
+    for (size_t i = 0; i < nsamples; i++) {
+        samples[i] = measure(suite, func, ctx, n);
+    }
+    qsort(samples, nsamples, sizeof(*samples), compare_samples);
+    const struct BenchSample median = samples[nsamples / 2];
+
+    const double ns_per_op = (double)median.ns / (double)n;
+    const double cycles_per_op = (double)median.cycles / (double)n;
+    const double allocs_per_op = (double)median.nallocs / (double)n;
+    if (suite->json) {
+        printf("{\"name\":\"%s\",\"iterations\":%zu,\"ns_per_op\":%.3f,\"cycles_per_op\":%.3f,\"cycles_source\":\"%s\","
+               "\"allocs_per_op\":%.3f}\n",
+               name,
+               n,
+               ns_per_op,
+               cycles_per_op,
+               suite->cycles_fd >= 0 ? "cpu" : "tsc",
+               allocs_per_op);
+    }
+    else {
+        printf("%-40s %12zu %10.2f %10.1f %10.2f\n", name, n, ns_per_op, cycles_per_op, allocs_per_op);
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BENCH_DEFAULT_REPETITIONS (5)
+#define BENCH_DEFAULT_MIN_TIME_MS (50)
+
+/**
+ * Operation benchmarked, run niterations times in a row.
+ */
+typedef void (*bench_func_t)(void *ctx, const size_t niterations);
+
+/**
+ * Options of a run of the benchmarks.
+ */
+struct BenchSuite {
+    bool json;          ///< whether to print a JSON object per benchmark, rather than a table
+    const char *filter; ///< substring of the names of the benchmarks to run, or NULL for all
+    size_t repetitions; ///< number of times each benchmark is measured, of which the median is reported
+    size_t min_time_ms; ///< time each measurement takes at least, to which the number of iterations is grown
+    int cycles_fd;      ///< perf event counting the cpu cycles of the process, or -1 to count TSC ticks instead
+};
+
+/**
+ * Sink for results of operations, so they are not optimized away.
+ */
+extern volatile size_t bench_sink;
+
+/**
+ * Initiate the options of a run, and open the cycle counter.
+ */
+void bench_suite_init(struct BenchSuite *suite);
+
+/**
+ * Close the cycle counter.
+ */
+void bench_suite_destroy(struct BenchSuite *suite);
+
+/**
+ * Print the header of the report, if any.
+ */
+void bench_report_begin(const struct BenchSuite *suite);
+
+/**
+ * Measure an operation, and report its time, cycles and allocations per iteration, unless it is filtered out. The
+ * allocations are the calls to malloc(), calloc() and realloc() by the program and lib, which the bench target wraps
+ * with the linker.
+ */
+void bench_run(const struct BenchSuite *suite, const char *name, const bench_func_t func, void *ctx);
+
+/**
+ * Benchmarks of each part of lib.
+ */
+void bench_message(const struct BenchSuite *suite);
+void bench_types(const struct BenchSuite *suite);
+void bench_lookup(const struct BenchSuite *suite);
@@ -0,0 +1,190 @@
+#include "bench.h"
+
+#include "mime.h"
+#include "router.h"
+#include "types/strtable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// the fhashtable of data-structures-c hashed with fnvhash_32, which strtable replaced, for comparison:
+#include <data-structures-c/fhashtable/fnvhash.h>
+
+#define NAME               fnvtable
+#define KEY_TYPE           struct strview
+#define VALUE_TYPE         struct strview
+#define KEY_IS_EQUAL(a, b) (strview_equals((a), (b)))
+#define HASH_FUNCTION(key) (fnvhash_32((uint8_t *)(key).buf, (size_t)(key).length))
+#define TYPE_DEFINITIONS
+#define FUNCTION_DEFINITIONS
+#include <data-structures-c/fhashtable/fhashtable_template.h>
+
+#define KEY_LENGTH (64)
+
+static const uint32_t TABLE_SIZES[] = {8, 1024};
+
+struct TableContext {
+    uint32_t nkeys;          ///< number of keys, a power of two
+    strview_t *keys;         ///< keys looked up, in the tables or not
+    strtable_t *table;       ///< table with the keys of the hits
+    struct fnvtable *old;    ///< the same as fhashtable
+    char (*hit_buf)[KEY_LENGTH];
+    char (*miss_buf)[KEY_LENGTH];
+    strview_t *hits;
+    strview_t *misses;
+};
+
+static void run_strtable_get_value(void *ctx, const size_t niterations)
+{
+    const struct TableContext *table = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        bench_sink += strtable_get_value(table->table, table->keys[i & (table->nkeys - 1)], STRVIEW_EMPTY).length;
+    }
+}
+
+static void run_fhashtable_get_value(void *ctx, const size_t niterations)
+{
+    const struct TableContext *table = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        bench_sink += fnvtable_get_value(table->old, table->keys[i & (table->nkeys - 1)], STRVIEW_EMPTY).length;
+    }
+}
+
+// keys shaped like url paths, e.g. "/images/file-00000123.jpg". misses differ from hits in their last characters
+// only, so they are not rejected by length alone:
+static strview_t *make_keys(const uint32_t n, const char *suffix, char (**out_buf)[KEY_LENGTH])
+{
+    char(*buf)[KEY_LENGTH] = malloc(n * sizeof(*buf));
+    strview_t *keys = malloc(n * sizeof(*keys));
+    if (!buf || !keys) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const int length = snprintf(buf[i], KEY_LENGTH, "/images/file-%08u.%s", i, suffix);
+        keys[i] = strview_from_sized((const uint8_t *)buf[i], (size_t)length);
+    }
+    *out_buf = buf;
+    return keys;
+}
+
+static void bench_tables(const struct BenchSuite *suite, const uint32_t n)
+{
+    struct TableContext table = {.nkeys = n};
+    table.hits = make_keys(n, "jpg", &table.hit_buf);
+    table.misses = make_keys(n, "jpx", &table.miss_buf);
+    table.table = strtable_create(n);
+    table.old = fnvtable_create(n * 2);
+    if (!table.table || !table.old) {
+        perror("strtable_create");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        strtable_update(table.table, table.hits[i], table.hits[i]);
+        fnvtable_update(table.old, table.hits[i], table.hits[i]);
+    }
+
+    char name[64];
+    table.keys = table.hits;
+    snprintf(name, sizeof(name), "strtable_get_value/%u/hit", n);
+    bench_run(suite, name, run_strtable_get_value, &table);
+    snprintf(name, sizeof(name), "fhashtable_fnv_get_value/%u/hit", n);
+    bench_run(suite, name, run_fhashtable_get_value, &table);
+
+    table.keys = table.misses;
+    snprintf(name, sizeof(name), "strtable_get_value/%u/miss", n);
+    bench_run(suite, name, run_strtable_get_value, &table);
+    snprintf(name, sizeof(name), "fhashtable_fnv_get_value/%u/miss", n);
+    bench_run(suite, name, run_fhashtable_get_value, &table);
+
+    strtable_destroy(table.table);
+    fnvtable_destroy(table.old);
+    free(table.hits);
+    free(table.misses);
+    free(table.hit_buf);
+    free(table.miss_buf);
+}
+
+static const strview_t FILE_PATHS[] = {
+    STRVIEW("/srv/www/index.html"),
+    STRVIEW("/srv/www/css/main.css"),
+    STRVIEW("/srv/www/js/main.js"),
+    STRVIEW("/srv/www/images/cat.JPEG"),
+    STRVIEW("/srv/www/favicon.ico"),
+    STRVIEW("/srv/www/README"),
+    STRVIEW("/srv/www/fonts/inter.woff2"),
+    STRVIEW("/srv/www/archive.unknown"),
+};
+
+#define NFILE_PATHS (sizeof(FILE_PATHS) / sizeof(*FILE_PATHS))
+
+static void run_mime_table_lookup(void *ctx, const size_t niterations)
+{
+    const struct MimeTable *table = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        bench_sink += mime_table_lookup(table, FILE_PATHS[i % NFILE_PATHS]).length;
+    }
+}
+
+static const strview_t URL_PATHS[] = {
+    STRVIEW("/"),
+    STRVIEW("/index.html"),
+    STRVIEW("/css/main.css"),
+    STRVIEW("/images/cats/cat.jpg"),
+    STRVIEW("/api/users/1234/posts"),
+    STRVIEW("/not/found"),
+};
+
+#define NURL_PATHS (sizeof(URL_PATHS) / sizeof(*URL_PATHS))
+
+static void run_router_match(void *ctx, const size_t niterations)
+{
+    const struct Router *router = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        struct RouteMatch match;
+        bench_sink += router_match(router, HTTP_METHOD_GET, URL_PATHS[i % NURL_PATHS], &match) + match.nparams;
+    }
+}
+
+void bench_lookup(const struct BenchSuite *suite)
+{
+    for (size_t i = 0; i < sizeof(TABLE_SIZES) / sizeof(*TABLE_SIZES); i++) {
+        bench_tables(suite, TABLE_SIZES[i]);
+    }
+
+    struct MimeTable mime_types;
+    Error_t e = mime_table_init(&mime_types, MIME_TYPES_PATH);
+    if (e.tag != ERROR_NONE) {
+        char error_strbuf[256];
+        fprintf(stderr, "%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
+        exit(EXIT_FAILURE);
+    }
+    bench_run(suite, "mime_table_lookup", run_mime_table_lookup, &mime_types);
+    mime_table_destroy(&mime_types);
+
+    static const strview_t patterns[] = {
+        STRVIEW("/"),
+        STRVIEW("/index.html"),
+        STRVIEW("/css/*path"),
+        STRVIEW("/js/*path"),
+        STRVIEW("/images/*path"),
+        STRVIEW("/api/users/:id"),
+        STRVIEW("/api/users/:id/posts"),
+        STRVIEW("/api/posts/:id"),
+    };
+    struct Router router;
+    e = router_init(&router);
+    for (size_t i = 0; i < sizeof(patterns) / sizeof(*patterns) && e.tag == ERROR_NONE; i++) {
+        e = router_add(&router, HTTP_METHOD_GET, patterns[i], (void *)&patterns[i]);
+    }
+    if (e.tag == ERROR_NONE) {
+        e = router_compile(&router);
+    }
+    if (e.tag != ERROR_NONE) {
+        char error_strbuf[256];
+        fprintf(stderr, "%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
+        exit(EXIT_FAILURE);
+    }
+    bench_run(suite, "router_match", run_router_match, &router);
+    router_destroy(&router);
+}
@@ -0,0 +1,147 @@
+#include "bench.h"
+
+#include "connection_tcp.h"
+#include "message.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RECVLINE_BATCH_SIZE (16 << 10)
+
+static const strview_t REQUEST_LINE = STRVIEW("GET /images/cat.jpg?size=large HTTP/1.1\r\n");
+
+static const strview_t HEADERS[] = {
+    STRVIEW("Host: localhost:8080\r\n"),
+    STRVIEW("User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"),
+    STRVIEW("Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"),
+    STRVIEW("Accept-Encoding: gzip, deflate, br, zstd\r\n"),
+    STRVIEW("Connection: keep-alive\r\n"),
+    STRVIEW("If-Modified-Since: Tue, 15 Oct 2024 08:12:31 GMT\r\n"),
+};
+
+#define NHEADERS (sizeof(HEADERS) / sizeof(*HEADERS))
+
+static void run_tokenize_request_line(void *ctx, const size_t niterations)
+{
+    (void)ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        struct RequestLine request_line;
+        const Error_t e = tokenize_request_line(REQUEST_LINE, &request_line);
+        bench_sink += (size_t)e.tag + request_line.url.length;
+    }
+}
+
+static void run_tokenize_header(void *ctx, const size_t niterations)
+{
+    (void)ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        struct HTTPHeader header;
+        const Error_t e = tokenize_header(HEADERS[i % NHEADERS], &header);
+        bench_sink += (size_t)e.tag + header.field_content.length;
+    }
+}
+
+struct AssembleContext {
+    strtable_t *headers;
+    strdyn_t out_buf;
+};
+
+static void run_assemble_header(void *ctx, const size_t niterations)
+{
+    struct AssembleContext *assemble = ctx;
+    const struct StatusLine status = {
+        .http_version = STRVIEW("1.1"),
+        .status_code = STRVIEW("200"),
+        .status_desc = STRVIEW("OK"),
+    };
+    for (size_t i = 0; i < niterations; i++) {
+        const Error_t e = assemble_header(status, assemble->headers, &assemble->out_buf);
+        bench_sink += (size_t)e.tag + strdyn_length(assemble->out_buf);
+    }
+}
+
+struct RecvlineContext {
+    char lines[RECVLINE_BATCH_SIZE]; ///< header lines, filling the batch
+    size_t lines_length;             ///< length of the lines
+    char msgbuf[RECVLINE_BATCH_SIZE];
+    struct BufferedReader reader;
+    int fds[2]; ///< socketpair, written to at fds[1] and read from at fds[0], or -1 when fed from memory
+};
+
+static void run_bytes_recvline(void *ctx, const size_t niterations)
+{
+    struct RecvlineContext *recvline = ctx;
+    struct BufferedReader *reader = &recvline->reader;
+    char line[256];
+    for (size_t i = 0; i < niterations; i++) {
+        if (reader->nleft == 0) {
+            if (recvline->fds[1] >= 0) {
+                bench_sink += (size_t)write(recvline->fds[1], recvline->lines, recvline->lines_length);
+            }
+            else {
+                memcpy(reader->msgbuf, recvline->lines, recvline->lines_length);
+                reader->curr = reader->msgbuf;
+                reader->nleft = recvline->lines_length;
+            }
+        }
+        size_t length = 0;
+        const Error_t e = bytes_recvline(reader, sizeof(line), line, &length);
+        bench_sink += (size_t)e.tag + length;
+    }
+}
+
+static void recvline_init(struct RecvlineContext *recvline, const bool socketpair_fed)
+{
+    recvline->lines_length = 0;
+    for (size_t i = 0; recvline->lines_length + HEADERS[i % NHEADERS].length <= sizeof(recvline->lines); i++) {
+        memcpy(&recvline->lines[recvline->lines_length], HEADERS[i % NHEADERS].buf, HEADERS[i % NHEADERS].length);
+        recvline->lines_length += HEADERS[i % NHEADERS].length;
+    }
+    recvline->fds[0] = recvline->fds[1] = -1;
+    if (socketpair_fed && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, recvline->fds) < 0) {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+    buffered_reader_init(&recvline->reader, recvline->fds[0], sizeof(recvline->msgbuf), recvline->msgbuf);
+}
+
+static void recvline_destroy(struct RecvlineContext *recvline)
+{
+    for (size_t i = 0; i < 2; i++) {
+        if (recvline->fds[i] >= 0) {
+            close(recvline->fds[i]);
+        }
+    }
+}
+
+void bench_message(const struct BenchSuite *suite)
+{
+    bench_run(suite, "tokenize_request_line", run_tokenize_request_line, NULL);
+    bench_run(suite, "tokenize_header", run_tokenize_header, NULL);
+
+    struct AssembleContext assemble = {.headers = strtable_create(8)};
+    if (!assemble.headers) {
+        perror("strtable_create");
+        exit(EXIT_FAILURE);
+    }
+    strtable_update(assemble.headers, STRVIEW_FROM("Content-Type"), STRVIEW_FROM("text/html"));
+    strtable_update(assemble.headers, STRVIEW_FROM("Content-Length"), STRVIEW_FROM("12345"));
+    strtable_update(assemble.headers, STRVIEW_FROM("Last-Modified"), STRVIEW_FROM("Tue, 15 Oct 2024 08:12:31 GMT"));
+    strtable_update(assemble.headers, STRVIEW_FROM("ETag"), STRVIEW_FROM("\"670e23cf-3039\""));
+    strtable_update(assemble.headers, STRVIEW_FROM("Connection"), STRVIEW_FROM("keep-alive"));
+    bench_run(suite, "assemble_header", run_assemble_header, &assemble);
+    strdyn_free(assemble.out_buf);
+    strtable_destroy(assemble.headers);
+
+    static struct RecvlineContext recvline;
+    recvline_init(&recvline, false);
+    bench_run(suite, "bytes_recvline/memory", run_bytes_recvline, &recvline);
+    recvline_destroy(&recvline);
+
+    // includes writing the lines to the socket, a batch every RECVLINE_BATCH_SIZE bytes:
+    recvline_init(&recvline, true);
+    bench_run(suite, "bytes_recvline/socketpair", run_bytes_recvline, &recvline);
+    recvline_destroy(&recvline);
+}
@@ -0,0 +1,60 @@
+#include "bench.h"
+
+#include "types/strdyn.h"
+#include "types/strview.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const strview_t HEADER_BLOCK =
+    STRVIEW("GET /images/cat.jpg HTTP/1.1\r\n"
+            "Host: localhost:8080\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+            "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+            "Accept-Language: en-US,en;q=0.5\r\n"
+            "Connection: keep-alive\r\n"
+            "If-Modified-Since: Tue, 15 Oct 2024 08:12:31 GMT\r\n"
+            "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+            "\r\n");
+
+struct FindContext {
+    strview_t haystack;
+    strview_t needle;
+};
+
+static void run_strview_find_first(void *ctx, const size_t niterations)
+{
+    const struct FindContext *find = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        strview_t out = STRVIEW_EMPTY;
+        bench_sink += strview_find_first(find->haystack, find->needle, &out) + out.length;
+    }
+}
+
+static void run_strdyn_append_fmt(void *ctx, const size_t niterations)
+{
+    strdyn_t *s = ctx;
+    for (size_t i = 0; i < niterations; i++) {
+        if ((i & 63) == 0) {
+            strdyn_clear(*s);
+        }
+        const Error_t e = strdyn_append_fmt(s, "%s: %zu\r\n", "Content-Length", i);
+        bench_sink += (size_t)e.tag;
+    }
+}
+
+void bench_types(const struct BenchSuite *suite)
+{
+    struct FindContext find = {.haystack = HEADER_BLOCK, .needle = STRVIEW("Accept-Encoding")};
+    bench_run(suite, "strview_find_first/hit", run_strview_find_first, &find);
+    find.needle = STRVIEW_FROM("Content-Length");
+    bench_run(suite, "strview_find_first/miss", run_strview_find_first, &find);
+
+    strdyn_t s = NULL;
+    if (strdyn_empty(&s).tag != ERROR_NONE) {
+        perror("strdyn_empty");
+        exit(EXIT_FAILURE);
+    }
+    bench_run(suite, "strdyn_append_fmt", run_strdyn_append_fmt, &s);
+    strdyn_free(s);
+}
@@ -0,0 +1,47 @@
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// microbenchmarks of the hot paths of lib. configure with -DCMAKE_BUILD_TYPE=Release for numbers without the
+// sanitizers, and compare the --json output of two builds to catch regressions.
+
+static void print_usage(const char *program_name)
+{
+    printf("usage: %s [--json] [--repetitions <n>] [--min-time-ms <ms>] [<filter>]\n", program_name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct BenchSuite suite;
+    bench_suite_init(&suite);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            suite.json = true;
+        }
+        else if (strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc) {
+            suite.repetitions = strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc) {
+            suite.min_time_ms = strtoul(argv[++i], NULL, 10);
+        }
+        else if (argv[i][0] != '-' && !suite.filter) {
+            suite.filter = argv[i];
+        }
+        else {
+            print_usage(argv[0]);
+            bench_suite_destroy(&suite);
+            return EXIT_FAILURE;
+        }
+    }
+
+    bench_report_begin(&suite);
+    bench_message(&suite);
+    bench_types(&suite);
+    bench_lookup(&suite);
+
+    bench_suite_destroy(&suite);
+    return EXIT_SUCCESS;
+}
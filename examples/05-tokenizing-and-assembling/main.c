@@ -1,4 +1,6 @@
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,16 +8,223 @@
 
 #include "connection.h"
 #include "connection_tcp.h"
+#include "gzip_stream.h"
 #include "message.h"
+#include "types/arena.h"
+
+/**
+ * Find a header among the header lines of a request, without copying it.
+ */
+bool find_header(const strview_t header_lines, const strview_t field_name, strview_t *out_content)
+{
+    strview_t rest = header_lines;
+    strview_t line_end = STRVIEW_EMPTY;
+    while (strview_find_crlf(rest, &line_end) && line_end.buf != rest.buf) {
+        const strview_t line = strview_take(rest, (size_t)(line_end.buf - rest.buf) + 2);
+        rest = strview_drop(rest, line.length);
+
+        struct HTTPHeader header = {0};
+        if (tokenize_header(line, &header).tag == ERROR_NONE
+            && strview_equals_ignore_case(header.field_name, field_name)) {
+            *out_content = header.field_content;
+            return true;
+        }
+    }
+    return false;
+}
+
+// payloads are recieved and counted, but not kept, up to this size:
+#define MAX_PAYLOAD_SIZE (16 << 20)
+
+enum PayloadFraming {
+    PAYLOAD_NONE = 0, ///< no payload
+    PAYLOAD_LENGTH,   ///< payload of Content-Length bytes
+    PAYLOAD_CHUNKED,  ///< payload in chunked transfer coding
+};
+
+/**
+ * Find how the payload of a request ends from its header lines. Returns the status to reject the request with, or
+ * HTTP_STATUS_OK.
+ */
+enum HTTPStatus find_payload_framing(
+    const strview_t protocol_version,
+    const strview_t header_lines,
+    enum PayloadFraming *out_framing,
+    uint64_t *out_length)
+{
+    *out_framing = PAYLOAD_NONE;
+    *out_length = 0;
+
+    strview_t transfer_encoding = STRVIEW_EMPTY;
+    strview_t content_length = STRVIEW_EMPTY;
+    const bool has_transfer_encoding = find_header(header_lines, STRVIEW_FROM("Transfer-Encoding"), &transfer_encoding);
+    const bool has_content_length = find_header(header_lines, STRVIEW_FROM("Content-Length"), &content_length);
+
+    if (has_transfer_encoding) {
+        if (has_content_length || !strview_equals(protocol_version, STRVIEW_FROM("1.1"))) {
+            return HTTP_STATUS_BAD_REQUEST;
+        }
+        if (!strview_equals_ignore_case(strview_trim(transfer_encoding), STRVIEW_FROM("chunked"))) {
+            return HTTP_STATUS_NOT_IMPLEMENTED;
+        }
+        *out_framing = PAYLOAD_CHUNKED;
+        return HTTP_STATUS_OK;
+    }
+    if (has_content_length) {
+        content_length = strview_trim(content_length);
+        if (content_length.length == 0 || content_length.length > 19) {
+            return HTTP_STATUS_BAD_REQUEST;
+        }
+        for (size_t i = 0; i < content_length.length; i++) {
+            if (content_length.buf[i] < '0' || content_length.buf[i] > '9') {
+                return HTTP_STATUS_BAD_REQUEST;
+            }
+            *out_length = *out_length * 10 + (uint64_t)(content_length.buf[i] - '0');
+        }
+        if (*out_length > MAX_PAYLOAD_SIZE) {
+            return HTTP_STATUS_PAYLOAD_TOO_LARGE;
+        }
+        *out_framing = *out_length > 0 ? PAYLOAD_LENGTH : PAYLOAD_NONE;
+    }
+    return HTTP_STATUS_OK;
+}
+
+/**
+ * Write bytes to the end of a file, retrying short writes until done.
+ */
+Error_t write_all(const int file_fd, const size_t nbytes, const char *buf)
+{
+    size_t nwritten = 0;
+    while (nwritten < nbytes) {
+        const ssize_t retval = write(file_fd, &buf[nwritten], nbytes - nwritten);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return error_format_location(ERROR_INFO("write_all"), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        nwritten += (size_t)retval;
+    }
+    return NO_ERRORS;
+}
+
+/**
+ * Recieve the payload of a request piece by piece, so payloads of any size are recieved in constant memory. The
+ * payload is stored in a file if file_fd is not -1. Returns the number of bytes recieved.
+ */
+Error_t recv_payload(
+    struct BufferedReader *reader,
+    const enum PayloadFraming framing,
+    const uint64_t length,
+    const int file_fd,
+    uint64_t *out_nbytes)
+{
+    Error_t e = NO_ERRORS;
+    *out_nbytes = 0;
+
+    if (framing == PAYLOAD_LENGTH && file_fd != -1) {
+        // moved from the socket to the file without passing through this process:
+        size_t nwritten = 0;
+        e = bytes_splice_to_file(reader, file_fd, 0, (size_t)length, &nwritten);
+        *out_nbytes = nwritten;
+    }
+    else if (framing == PAYLOAD_LENGTH) {
+        char chunk_buf[4096];
+        while (*out_nbytes < length) {
+            const uint64_t nleft = length - *out_nbytes;
+            size_t nread = 0;
+            e = bytes_recvn(reader, nleft < sizeof(chunk_buf) ? (size_t)nleft : sizeof(chunk_buf), chunk_buf, &nread);
+            if (e.tag != ERROR_NONE) return e;
+            if (nread == 0) {
+                e.tag = ERROR_CUSTOM;
+                e.custom_msg = "connection closed before the end of the payload";
+                return error_format_location(ERROR_INFO("recv_payload"), e);
+            }
+            *out_nbytes += nread;
+        }
+    }
+    else if (framing == PAYLOAD_CHUNKED) {
+        struct HTTPChunkedDecoder decoder;
+        http_chunked_decoder_init(&decoder);
+        bool done = false;
+        while (!done) {
+            strview_t data = STRVIEW_EMPTY;
+            e = bytes_recv_chunked(reader, &decoder, &data, &done);
+            if (e.tag != ERROR_NONE) return e;
+            if (file_fd != -1) {
+                e = write_all(file_fd, data.length, (const char *)data.buf);
+                if (e.tag != ERROR_NONE) return e;
+            }
+            *out_nbytes += data.length;
+            if (*out_nbytes > MAX_PAYLOAD_SIZE) {
+                e.tag = ERROR_CUSTOM;
+                e.custom_msg = "payload too large";
+                return error_format_location(ERROR_INFO("recv_payload"), e);
+            }
+        }
+    }
+    return e;
+}
+
+/**
+ * Send a response without a body, e.g. to reject a request.
+ */
+Error_t send_status(const int conn_fd, const enum HTTPStatus status)
+{
+    static const strview_t HEADER_END = STRVIEW("Content-Length: 0\r\nConnection: close\r\n\r\n");
+    const strview_t status_line = http_status_line(status);
+
+    const Error_t e = bytes_sendall(conn_fd, status_line.length, (const char *)status_line.buf);
+    if (e.tag != ERROR_NONE) return e;
+    return bytes_sendall(conn_fd, HEADER_END.length, (const char *)HEADER_END.buf);
+}
+
+#ifdef HAVE_ZLIB
+Error_t send_to_connection(void *arg, const size_t nbytes, const char *buf)
+{
+    return bytes_sendall(*(const int *)arg, nbytes, buf);
+}
+#endif
+
+/**
+ * Pass the bytes of the body built so far on to the compressor, if compressing, so the body is sent as it is built.
+ */
+Error_t flush_body(void *gzip_stream, strdyn_t body)
+{
+#ifdef HAVE_ZLIB
+    if (gzip_stream) {
+        const Error_t e = gzip_stream_write(gzip_stream, strdyn_length(body), body);
+        strdyn_clear(body);
+        return e;
+    }
+#endif
+    (void)(gzip_stream);
+    (void)(body);
+    return NO_ERRORS;
+}
+
+/**
+ * Compress the rest of the body, and end it.
+ */
+Error_t finish_body(void *gzip_stream, strdyn_t body)
+{
+    Error_t e = flush_body(gzip_stream, body);
+    if (e.tag != ERROR_NONE) return e;
+#ifdef HAVE_ZLIB
+    e = gzip_stream_finish(gzip_stream);
+#endif
+    return e;
+}
 
 int main(int argc, char *argv[])
 {
     if (argc < 2) {
         const char *program_name = (argc == 1) ? argv[0] : "<program>";
-        fprintf(stderr, "usage: %s <port>\n", program_name);
+        fprintf(stderr, "usage: %s <port> [payload file]\n", program_name);
         return EXIT_FAILURE;
     }
     const char *port = (argc > 1) ? argv[1] : 0;
+    const char *payload_path = (argc > 2) ? argv[2] : 0; // the last payload recieved is stored here if set
 
     int return_status = EXIT_SUCCESS;
     char error_strbuf[512] = {0};
@@ -23,22 +232,26 @@ int main(int argc, char *argv[])
     int conn_fd = -1;
     strdyn_t response_header = NULL;
     char msgbuf[4096] = {0};
-    char linebuf[1024] = {0};
-    size_t line_len = 0;
+    strview_t request = STRVIEW_EMPTY;
+    strview_t line = STRVIEW_EMPTY;
+    strview_t line_end = STRVIEW_EMPTY;
     struct BufferedReader reader = {0};
     struct RequestLine request_line = {0};
     strdyn_t body = NULL;
     strdyn_t content_length_str = NULL;
     strtable_t *headers = NULL;
+    struct Arena arena; // the strings of a connection, freed all at once as it closes
+    void *gzip_stream = NULL; // the body is compressed on the fly if set
+#ifdef HAVE_ZLIB
+    struct GzipStream gzip_stream_ = {0};
+    char gzip_buf[4096];
+#endif
 
     Error_t e = NO_ERRORS;
 
-    headers = strtable_create(2);
+    arena_init(&arena, ARENA_DEFAULT_BLOCK_SIZE);
+    headers = strtable_create(8);
     if (!headers) goto on_error;
-    e = strdyn_empty(&body);
-    if (e.tag != ERROR_NONE) goto on_error;
-    e = strdyn_empty(&content_length_str);
-    if (e.tag != ERROR_NONE) goto on_error;
 
     e = open_tcp_server(port, &server_fd);
     if (e.tag != ERROR_NONE) goto on_error;
@@ -47,13 +260,78 @@ int main(int argc, char *argv[])
         e = open_tcp_client_connection(server_fd, &conn_fd);
         if (e.tag != ERROR_NONE) goto on_error;
 
+        // after the first connection, the arena has the memory of the strings already:
+        e = strdyn_empty_in(&arena, &body);
+        if (e.tag != ERROR_NONE) goto on_error;
+        e = strdyn_empty_in(&arena, &content_length_str);
+        if (e.tag != ERROR_NONE) goto on_error;
+        e = strdyn_empty_in(&arena, &response_header);
+        if (e.tag != ERROR_NONE) goto on_error;
+
         buffered_reader_init(&reader, conn_fd, sizeof(msgbuf), msgbuf);
-        e = bytes_recvline(&reader, sizeof(linebuf), linebuf, &line_len);
+        e = bytes_recv_header_block(&reader, &request);
         if (e.tag != ERROR_NONE) goto on_error;
 
-        e = tokenize_request_line(strview_from_sized((uint8_t *)linebuf, line_len), &request_line);
+        // the request is viewed in the buffer of the reader, no copies are made:
+        line = STRVIEW_EMPTY;
+        if (strview_find_crlf(request, &line_end)) {
+            line = strview_take(request, (size_t)(line_end.buf - request.buf) + 2);
+            request = strview_drop(request, line.length);
+        }
+
+        e = tokenize_request_line(line, &request_line);
         if (e.tag != ERROR_NONE) goto on_error; // should ideally send a error response to user here
 
+        // the payload is recieved after the header lines are reported, as it may overwrite them in the reader:
+        enum PayloadFraming payload_framing = PAYLOAD_NONE;
+        uint64_t payload_length = 0;
+        const enum HTTPStatus payload_status =
+            find_payload_framing(request_line.protocol_version, request, &payload_framing, &payload_length);
+        if (payload_status != HTTP_STATUS_OK) {
+            e = send_status(conn_fd, payload_status);
+            if (e.tag != ERROR_NONE) goto on_error;
+            goto close_connection;
+        }
+
+        // 1.1 clients may wait for 100 Continue before sending the payload:
+        strview_t expect = STRVIEW_EMPTY;
+        if (payload_framing != PAYLOAD_NONE && strview_equals(request_line.protocol_version, STRVIEW_FROM("1.1"))
+            && find_header(request, STRVIEW_FROM("Expect"), &expect)
+            && strview_equals_ignore_case(strview_trim(expect), STRVIEW_FROM("100-continue"))) {
+            e = bytes_sendall(conn_fd, HTTP_CONTINUE_RESPONSE.length, (const char *)HTTP_CONTINUE_RESPONSE.buf);
+            if (e.tag != ERROR_NONE) goto on_error;
+        }
+
+#ifdef HAVE_ZLIB
+        // compress the body if the client accepts gzip. the length of the compressed body is not known up front, so
+        // it is sent in chunks, which needs HTTP/1.1:
+        strview_t accept_encoding = STRVIEW_EMPTY;
+        find_header(request, STRVIEW_FROM("Accept-Encoding"), &accept_encoding);
+        if (strview_equals(request_line.protocol_version, STRVIEW_FROM("1.1"))
+            && http_negotiate_coding(accept_encoding, 1u << HTTP_CODING_GZIP) == HTTP_CODING_GZIP) {
+            strtable_update(headers, STRVIEW_FROM("Content-Type"), STRVIEW_FROM("text/plain"));
+            strtable_update(headers, STRVIEW_FROM("Content-Encoding"), STRVIEW_FROM("gzip"));
+            strtable_update(headers, STRVIEW_FROM("Transfer-Encoding"), STRVIEW_FROM("chunked"));
+            strtable_update(headers, STRVIEW_FROM("Vary"), STRVIEW_FROM("Accept-Encoding"));
+            strtable_update(headers, STRVIEW_FROM("Connection"), STRVIEW_FROM("close"));
+
+            struct StatusLine status = {
+                .http_version = STRVIEW("1.1"),
+                .status_code = STRVIEW("200"),
+                .status_desc = STRVIEW("OK"),
+            };
+            e = assemble_header(status, headers, &response_header);
+            if (e.tag != ERROR_NONE) goto on_error;
+            e = bytes_sendall(conn_fd, strdyn_length(response_header), response_header);
+            if (e.tag != ERROR_NONE) goto on_error;
+
+            e = gzip_stream_init(
+                &gzip_stream_, Z_DEFAULT_COMPRESSION, send_to_connection, &conn_fd, sizeof(gzip_buf), gzip_buf);
+            if (e.tag != ERROR_NONE) goto on_error;
+            gzip_stream = &gzip_stream_;
+        }
+#endif
+
         e = strdyn_append(&body, "request structure:\n");
         if (e.tag != ERROR_NONE) goto on_error;
         e = strdyn_append(&body, " - request line:\n");
@@ -75,17 +353,18 @@ int main(int argc, char *argv[])
             request_line.protocol_version.buf);
         if (e.tag != ERROR_NONE) goto on_error;
         // clang-format on
+        e = flush_body(gzip_stream, body);
+        if (e.tag != ERROR_NONE) goto on_error;
 
         do {
-            e = bytes_recvline(&reader, sizeof(linebuf), linebuf, &line_len);
-            if (e.tag != ERROR_NONE) goto on_error;
-
-            if (line_len == 0 || strncmp(linebuf, "\r\n", line_len) == 0) {
+            if (!strview_find_crlf(request, &line_end) || line_end.buf == request.buf) {
                 break;
             }
+            line = strview_take(request, (size_t)(line_end.buf - request.buf) + 2);
+            request = strview_drop(request, line.length);
 
             struct HTTPHeader header = {0};
-            e = tokenize_header(strview_from_sized((uint8_t *)linebuf, line_len), &header);
+            e = tokenize_header(line, &header);
             if (e.tag != ERROR_NONE) goto on_error;
 
             e = strdyn_append_fmt(
@@ -94,33 +373,65 @@ int main(int argc, char *argv[])
             e = strdyn_append_fmt(
                 &body, "  - value: %.*s\n", (int)header.field_content.length, header.field_content.buf);
             if (e.tag != ERROR_NONE) goto on_error;
-        } while (true); // expecting no payload and no errors
+            e = flush_body(gzip_stream, body);
+            if (e.tag != ERROR_NONE) goto on_error;
+        } while (true); // expecting no errors
 
-        e = strdyn_append(&body, "\n");
+        uint64_t payload_nbytes = 0;
+        if (payload_path && payload_framing != PAYLOAD_NONE) {
+            const int payload_fd = open(payload_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (payload_fd < 0) {
+                e = error_format_location(ERROR_INFO("main"), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+                goto on_error;
+            }
+            e = recv_payload(&reader, payload_framing, payload_length, payload_fd, &payload_nbytes);
+            close(payload_fd);
+        }
+        else {
+            e = recv_payload(&reader, payload_framing, payload_length, -1, &payload_nbytes);
+        }
         if (e.tag != ERROR_NONE) goto on_error;
-        e = strdyn_append_fmt(&content_length_str, "%zu", strdyn_length(body));
+        e = strdyn_append_fmt(&body, " - payload: %llu bytes\n", (unsigned long long)payload_nbytes);
         if (e.tag != ERROR_NONE) goto on_error;
 
-        strtable_update(headers, STRVIEW_FROM("Content-Type"), STRVIEW_FROM("text/plain"));
-        strtable_update(headers, STRVIEW_FROM("Content-Length"), strview_from_cstr(content_length_str));
-
-        struct StatusLine status = {
-            .http_version = STRVIEW("1.0"),
-            .status_code = STRVIEW("200"),
-            .status_desc = STRVIEW("OK"),
-        };
-        e = assemble_header(status, headers, &response_header);
+        e = strdyn_append(&body, "\n");
         if (e.tag != ERROR_NONE) goto on_error;
 
-        e = bytes_sendall(conn_fd, strdyn_length(response_header), response_header);
-        if (e.tag != ERROR_NONE) goto on_error;
+        if (gzip_stream) {
+            e = finish_body(gzip_stream, body);
+            if (e.tag != ERROR_NONE) goto on_error;
+        }
+        else {
+            e = strdyn_append_fmt(&content_length_str, "%zu", strdyn_length(body));
+            if (e.tag != ERROR_NONE) goto on_error;
 
-        e = bytes_sendall(conn_fd, strdyn_length(body), body);
-        if (e.tag != ERROR_NONE) goto on_error;
+            strtable_update(headers, STRVIEW_FROM("Content-Type"), STRVIEW_FROM("text/plain"));
+            strtable_update(headers, STRVIEW_FROM("Content-Length"), strview_from_cstr(content_length_str));
 
-        strdyn_clear(response_header);
-        strdyn_clear(body);
-        strdyn_clear(content_length_str);
+            struct StatusLine status = {
+                .http_version = STRVIEW("1.0"),
+                .status_code = STRVIEW("200"),
+                .status_desc = STRVIEW("OK"),
+            };
+            e = assemble_header(status, headers, &response_header);
+            if (e.tag != ERROR_NONE) goto on_error;
+
+            e = bytes_sendall(conn_fd, strdyn_length(response_header), response_header);
+            if (e.tag != ERROR_NONE) goto on_error;
+
+            e = bytes_sendall(conn_fd, strdyn_length(body), body);
+            if (e.tag != ERROR_NONE) goto on_error;
+        }
+
+    close_connection:
+#ifdef HAVE_ZLIB
+        if (gzip_stream) {
+            gzip_stream_destroy(gzip_stream);
+            gzip_stream = NULL;
+        }
+#endif
+        arena_reset(&arena);
+        response_header = body = content_length_str = NULL;
         strtable_clear(headers);
         buffered_reader_flush(&reader);
 
@@ -130,10 +441,13 @@ int main(int argc, char *argv[])
     };
 
 on_error:
-    strdyn_free(body);
-    strdyn_free(content_length_str);
+#ifdef HAVE_ZLIB
+    if (gzip_stream) {
+        gzip_stream_destroy(gzip_stream);
+    }
+#endif
     strtable_destroy(headers);
-    strdyn_free(response_header);
+    arena_destroy(&arena);
 
     if (e.tag != ERROR_NONE) {
         printf("%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
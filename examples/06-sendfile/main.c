@@ -1,13 +1,18 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "connection.h"
 #include "connection_tcp.h"
+#include "event_loop.h"
 #include "message.h"
+#include "mime.h"
+#include "router.h"
 
 struct Route {
     strview_t url_path;
@@ -18,7 +23,7 @@ struct RouteWithMetadata {
     struct Route route;
     strdyn_t abs_path;
     strview_t content_type;
-    strdyn_t content_length_str;
+    size_t content_length;
 };
 
 static const struct Route routes[] = {
@@ -40,86 +45,66 @@ static const struct Route routes[] = {
     },
 };
 
-static const char RESPONSE_403_BAD_REQUEST[] = "HTTP/1.0 403 Bad Request\r\n"
+static const char RESPONSE_403_BAD_REQUEST[] = "HTTP/1.1 403 Bad Request\r\n"
                                                "Content-Type: text/plain\r\n"
                                                "Content-Length: 15\r\n"
+                                               "Connection: close\r\n"
                                                "\r\n"
                                                "403 Bad Request";
 
-Error_t send_file_entity(const int conn_fd, const char *content_type, const char *content_length, const char *filepath)
+/**
+ * Send a file, or only its header when send_body is false, e.g. for HEAD requests.
+ */
+Error_t send_file_entity(
+    struct Connection *conn,
+    const bool keep_alive,
+    const bool send_body,
+    const char *content_type,
+    const size_t content_length,
+    const char *filepath)
 {
-    int file_handle = open(filepath, O_RDONLY);
-    if (file_handle < 0) {
+    int file_handle = -1;
+    if (send_body && (file_handle = open(filepath, O_RDONLY)) < 0) {
         return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
     }
 
-    strtable_t *headers = strtable_create(2);
-    strtable_update(headers, STRVIEW_FROM("Content-Type"), strview_from_cstr(content_type));
-    strtable_update(headers, STRVIEW_FROM("Content-Length"), strview_from_cstr(content_length));
+    char header_buf[512];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, HTTP_STATUS_OK);
+    response_writer_header(&writer, STRVIEW_FROM("Content-Type"), strview_from_cstr(content_type));
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), content_length);
+    response_writer_header(
+        &writer, STRVIEW_FROM("Connection"), keep_alive ? STRVIEW_FROM("keep-alive") : STRVIEW_FROM("close"));
 
-    const struct StatusLine status = {
-        .http_version = STRVIEW("1.0"),
-        .status_code = STRVIEW("200"),
-        .status_desc = STRVIEW("OK"),
-    };
-
-    strdyn_t out_buf = NULL;
     Error_t e = NO_ERRORS;
 
-    e = assemble_header(status, headers, &out_buf);
+    e = response_writer_finish(&writer);
     if (e.tag != ERROR_NONE) goto cleanup1;
 
-    e = bytes_sendall(conn_fd, strdyn_length(out_buf), out_buf);
-    if (e.tag != ERROR_NONE) goto cleanup1;
+    e = connection_queue_bytes(conn, writer.length, header_buf);
+    if (e.tag != ERROR_NONE || !send_body) goto cleanup1;
 
-    e = bytes_sendfile(conn_fd, file_handle, 100 * (int)1e+6); // last parameter: max file size
+    e = connection_queue_file(conn, file_handle, 0, content_length);
     if (e.tag != ERROR_NONE) goto cleanup1;
+    file_handle = -1; // owned by the connection now
 
 cleanup1:
     if (file_handle >= 0) {
         close(file_handle);
     }
-    if (out_buf != NULL) {
-        strdyn_free(out_buf);
-    }
-    if (headers != NULL) {
-        strtable_destroy(headers);
-    }
     return e;
 }
 
-#include <data-structures-c/fhashtable/fnvhash.h>
-
-#define NAME               routes_htable
-#define KEY_TYPE           strview_t
-#define VALUE_TYPE         struct RouteWithMetadata
-#define KEY_IS_EQUAL(a, b) (strview_equals((a), (b)))
-#define HASH_FUNCTION(key) (fnvhash_32((uint8_t *)(key).buf, (size_t)(key).length))
-#define TYPE_DEFINITIONS
-#define FUNCTION_DEFINITIONS
-#define FUNCTION_LINKAGE static inline
-#include <data-structures-c/fhashtable/fhashtable_template.h>
+#define NROUTES (sizeof(routes) / sizeof(*routes))
 
 struct ClientHandler {
-    struct routes_htable *routes;
+    struct Router router;
+    struct RouteWithMetadata metadata[NROUTES];
+    struct MimeTable mime_types;
 };
 
-strview_t deduce_content_type(const strview_t filepath)
-{
-    strview_t extension = STRVIEW_EMPTY;
-    if (!strview_find_lastc(filepath, '.', &extension)) {
-        return STRVIEW_FROM("application/octet-stream");
-    }
-    if (strview_equals(extension, STRVIEW_FROM(".html"))) {
-        return STRVIEW_FROM("text/html");
-    }
-    if (strview_equals(extension, STRVIEW_FROM(".jpg")) || strview_equals(extension, STRVIEW_FROM(".jpeg"))) {
-        return STRVIEW_FROM("image/jpeg");
-    }
-    return STRVIEW_FROM("application/octet-stream");
-}
-
-Error_t open_file_and_get_file_size(const char *filepath, strdyn_t *out_file_size_str)
+Error_t open_file_and_get_file_size(const char *filepath, size_t *out_file_size)
 {
     FILE *fp = fopen(filepath, "r");
     if (fp == NULL) {
@@ -134,17 +119,7 @@ Error_t open_file_and_get_file_size(const char *filepath, strdyn_t *out_file_siz
         fclose(fp);
         return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
     }
-    Error_t e;
-    e = strdyn_empty(out_file_size_str);
-    if (e.tag != ERROR_NONE) {
-        fclose(fp);
-        return e;
-    }
-    e = strdyn_append_fmt(out_file_size_str, "%zu", size);
-    if (e.tag != ERROR_NONE) {
-        fclose(fp);
-        return e;
-    }
+    *out_file_size = (size_t)size;
     if (fclose(fp) == -1) {
         return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
     }
@@ -153,114 +128,82 @@ Error_t open_file_and_get_file_size(const char *filepath, strdyn_t *out_file_siz
 
 Error_t init_client_handler(struct ClientHandler *handler, const char *rootpath)
 {
-    handler->routes = routes_htable_create(sizeof(routes) / sizeof(*routes));
-    if (!handler->routes) {
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
-    }
-    Error_t e = NO_ERRORS;
+    Error_t e = mime_table_init(&handler->mime_types, MIME_TYPES_PATH);
+    if (e.tag != ERROR_NONE) return e;
+
+    e = router_init(&handler->router);
+    if (e.tag != ERROR_NONE) return e;
 
-    for (size_t i = 0; i < sizeof(routes) / sizeof(*routes); i++) {
-        const struct Route r = routes[i];
-        struct RouteWithMetadata rm;
-        rm.route = r;
+    for (size_t i = 0; i < NROUTES; i++) {
+        struct RouteWithMetadata *rm = &handler->metadata[i];
+        rm->route = routes[i];
 
-        rm.abs_path = NULL;
-        e = strdyn_empty(&rm.abs_path);
+        e = strdyn_empty(&rm->abs_path);
         if (e.tag != ERROR_NONE) break;
-        e = strdyn_append_fmt(&rm.abs_path, "%s", rootpath);
+        e = strdyn_append_fmt(&rm->abs_path, "%s", rootpath);
         if (e.tag != ERROR_NONE) break;
-        e = strdyn_append_fmt(&rm.abs_path, "%s", rm.route.local_path.buf);
+        e = strdyn_append_fmt(&rm->abs_path, "%s", rm->route.local_path.buf);
         if (e.tag != ERROR_NONE) break;
 
-        const strview_t v = strview_from_sized((const uint8_t *)rm.abs_path, strdyn_length(rm.abs_path));
-        rm.content_type = deduce_content_type(v);
+        const strview_t v = strview_from_sized((const uint8_t *)rm->abs_path, strdyn_length(rm->abs_path));
+        rm->content_type = mime_table_lookup(&handler->mime_types, v);
 
-        e = open_file_and_get_file_size(rm.abs_path, &rm.content_length_str);
+        e = open_file_and_get_file_size(rm->abs_path, &rm->content_length);
         if (e.tag != ERROR_NONE) break;
 
-        if (!routes_htable_is_full(handler->routes)) {
-            routes_htable_update(handler->routes, r.url_path, rm);
-        }
-        else {
-            return error_format_location(
-                ERROR_INFO(__func__), (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "routes table is full!"});
-        }
+        e = router_add(&handler->router, HTTP_METHOD_GET, rm->route.url_path, rm);
+        if (e.tag != ERROR_NONE) break;
     }
-    return e;
+    if (e.tag != ERROR_NONE) return e;
+
+    return router_compile(&handler->router);
 }
 
 void destroy_client_handler(struct ClientHandler *handler)
 {
-    if (handler->routes) {
-        strview_t key;
-        struct RouteWithMetadata value;
-        size_t idx;
-        FHASHTABLE_FOR_EACH(handler->routes, idx, key, value)
-        {
-            (void)(key);
-            strdyn_free(value.content_length_str);
-        }
+    router_destroy(&handler->router);
+    for (size_t i = 0; i < NROUTES; i++) {
+        strdyn_free(handler->metadata[i].abs_path);
     }
-    routes_htable_destroy(handler->routes);
+    mime_table_destroy(&handler->mime_types);
 }
 
-Error_t handle_client(const int conn_fd, struct ClientHandler *handler)
+Error_t handle_client(void *arg, struct Connection *conn)
 {
-    char request_buf[4096] = {0};
-    struct BufferedReader reader;
-    buffered_reader_init(&reader, conn_fd, sizeof(request_buf), request_buf);
+    struct ClientHandler *handler = arg;
 
     Error_t e = NO_ERRORS;
-    char request_line_buf[1024] = {0};
-    size_t request_line_len = 0;
-
-    e = bytes_recvline(&reader, sizeof(request_line_buf), request_line_buf, &request_line_len);
-    if (e.tag != ERROR_NONE) goto on_error;
-
-    struct RequestLine request_line = {0};
-    e = tokenize_request_line(strview_from_sized((uint8_t *)request_line_buf, request_line_len), &request_line);
+    struct HTTPRequest request;
+    bool complete = false;
+    e = http_request_parse(&conn->parser, buffered_reader_view(&conn->reader), &request, &complete);
     if (e.tag != ERROR_NONE) goto on_error;
+    if (!complete) {
+        // wait for the rest of the header block.
+        return NO_ERRORS;
+    }
+    buffered_reader_consume(&conn->reader, request.length); // the views stay valid until the next recieve
 
     // printf("request line:\n");
-    // printf(" method: %.*s\n", (int)request_line.method.size, request_line.method.buf);
-    // printf(" url: %.*s\n", (int)request_line.url.size, request_line.url.buf);
-    // printf(" protocol name: %.*s\n", (int)request_line.protocol_name.size, request_line.protocol_name.buf);
-    // printf(" protocol version: %.*s\n", (int)request_line.protocol_version.size, request_line.protocol_version.buf);
-    //
-    // {
-    //     strview key;
-    //     struct Route value;
-    //     size_t idx;
-    //     (void)(key);
-    //     FHASHTABLE_FOR_EACH(handler->routes, idx, key, value)
-    //     {
-    //         printf("route :\n");
-    //         printf(" - %.*s", (int)key.size, key.buf);
-    //         printf(" -> %s (%s bytes) of type %s\n", value.filepath, value.content_length, value.content_type.buf);
-    //     }
-    // }
-
-    // do no validation / processing of the headers:
-    struct HTTPHeader header = {0};
-    do {
-        char linebuf[1024] = {0};
-        size_t line_len = 0;
-        e = bytes_recvline(&reader, sizeof(linebuf), linebuf, &line_len);
-        if (e.tag != ERROR_NONE) goto on_error;
-
-        if (line_len == 0 || strncmp(linebuf, "\r\n", line_len) == 0) {
-            break;
-        }
-
-        e = tokenize_header(strview_from_sized((uint8_t *)linebuf, line_len), &header);
-        if (e.tag != ERROR_NONE) goto on_error;
-    } while (true);
+    // printf(" method: %.*s\n", (int)request.method_name.length, request.method_name.buf);
+    // printf(" url: %.*s\n", (int)request.url.length, request.url.buf);
+    // printf(" protocol version: %.*s\n", (int)request.protocol_version.length, request.protocol_version.buf);
+
+    strview_t connection_header = STRVIEW_EMPTY;
+    http_request_get_header(&request, HTTP_HEADER_CONNECTION, &connection_header);
+    const bool keep_alive =
+        connection_count_request(conn, http_keep_alive(request.protocol_version, connection_header));
 
     // no special processing:
-    struct RouteWithMetadata *route = routes_htable_get_value_mut(handler->routes, request_line.url);
-    if (route) {
+    struct RouteMatch match;
+    if (router_match(&handler->router, request.method, request.path, &match)) {
+        const struct RouteWithMetadata *route = match.value;
         return send_file_entity(
-            conn_fd, (const char *)route->content_type.buf, route->content_length_str, route->abs_path);
+            conn,
+            keep_alive,
+            request.method != HTTP_METHOD_HEAD,
+            (const char *)route->content_type.buf,
+            route->content_length,
+            route->abs_path);
     }
     else {
         e.tag = ERROR_CUSTOM;
@@ -269,10 +212,19 @@ Error_t handle_client(const int conn_fd, struct ClientHandler *handler)
     }
 
 on_error:
-    bytes_sendall(conn_fd, sizeof(RESPONSE_403_BAD_REQUEST) - 1, RESPONSE_403_BAD_REQUEST); // ignore any errors
+    conn->close_after_write = true;
+    connection_queue_borrowed_bytes(
+        conn, sizeof(RESPONSE_403_BAD_REQUEST) - 1, RESPONSE_403_BAD_REQUEST); // ignore any errors
     return e;
 }
 
+void report_error(void *arg, const Error_t error)
+{
+    (void)(arg);
+    char error_strbuf[512] = {0};
+    printf("%s\n", error_stringify(error, sizeof(error_strbuf), error_strbuf));
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 3) {
@@ -283,10 +235,12 @@ int main(int argc, char *argv[])
     const char *port = (argc > 1) ? argv[1] : 0;
     const char *rootpath = (argc > 2) ? argv[2] : 0;
 
+    // peers closing their connection early should not kill the server:
+    signal(SIGPIPE, SIG_IGN);
+
     char error_strbuf[512] = {0};
 
     int server_fd = -1;
-    int conn_fd = -1;
 
     struct ClientHandler client_handler = {0};
     const Error_t client_handler_error = init_client_handler(&client_handler, rootpath);
@@ -295,33 +249,29 @@ int main(int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    const Error_t server_open_error = open_tcp_server(port, &server_fd);
+    const Error_t server_open_error = open_tcp_server_with_backlog(SOMAXCONN, port, &server_fd);
     if (server_open_error.tag != ERROR_NONE) {
         destroy_client_handler(&client_handler);
         printf("%s\n", error_stringify(server_open_error, sizeof(error_strbuf), error_strbuf));
         return EXIT_FAILURE;
     }
 
-    while (true) {
-        const Error_t client_open_error = open_tcp_client_connection(server_fd, &conn_fd);
-        if (client_open_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(client_open_error, sizeof(error_strbuf), error_strbuf));
-            continue;
-        }
-
-        const Error_t handle_client_error = handle_client(conn_fd, &client_handler);
-        if (handle_client_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(handle_client_error, sizeof(error_strbuf), error_strbuf));
-            close_socket(conn_fd);
-            conn_fd = -1;
-            continue;
-        }
-
-        const Error_t client_close_error = close_socket(conn_fd);
-        if (client_close_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(client_close_error, sizeof(error_strbuf), error_strbuf));
-        }
+    struct EventLoop loop;
+    const struct EventLoopHandler loop_handler = {
+        .arg = &client_handler,
+        .on_data = handle_client,
+        .on_error = report_error,
+    };
+    Error_t e = event_loop_init(&loop, server_fd, EVENT_LOOP_DEFAULT_CONFIG, loop_handler);
+    if (e.tag == ERROR_NONE) {
+        e = event_loop_run(&loop);
+        event_loop_destroy(&loop);
+    }
+    if (e.tag != ERROR_NONE) {
+        printf("%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
     }
+
+    close_socket(server_fd);
     destroy_client_handler(&client_handler);
-    return EXIT_SUCCESS;
+    return e.tag == ERROR_NONE ? EXIT_SUCCESS : EXIT_FAILURE;
 }
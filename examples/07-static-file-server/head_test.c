@@ -0,0 +1,80 @@
+// checks that a HEAD request pipelined before a GET request is answered without a body, so the response to the GET
+// request is framed right. run against a server serving this directory:
+//
+//     ./07-static-file-server 8080 . &
+//     ./head_test localhost 8080
+
+#include "connection_tcp.h"
+#include "message.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const char REQUESTS[] = "HEAD /index.html HTTP/1.1\r\n"
+                               "Host: localhost\r\n"
+                               "\r\n"
+                               "GET /favicon.ico HTTP/1.1\r\n"
+                               "Host: localhost\r\n"
+                               "Connection: close\r\n"
+                               "\r\n";
+
+static size_t content_length_of(const strview_t header_block)
+{
+    strview_t field = STRVIEW_EMPTY;
+    const bool found = strview_find_first(header_block, STRVIEW_FROM("Content-Length: "), &field);
+    assert(found);
+    if (!found) {
+        return 0;
+    }
+    return strtoul((const char *)field.buf + sizeof("Content-Length: ") - 1, NULL, 10);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        printf("usage: %s <hostname> <port>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int fd = -1;
+    Error_t e = open_tcp_client(argv[1], argv[2], &fd);
+    if (e.tag != ERROR_NONE) {
+        char error_strbuf[512];
+        printf("%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
+        return EXIT_FAILURE;
+    }
+    const ssize_t nsent = send(fd, REQUESTS, sizeof(REQUESTS) - 1, 0);
+    assert(nsent == (ssize_t)(sizeof(REQUESTS) - 1));
+
+    // the server closes the connection after the GET request:
+    static uint8_t buf[1 << 20];
+    size_t length = 0;
+    ssize_t n;
+    while ((n = recv(fd, &buf[length], sizeof(buf) - length, 0)) > 0) {
+        length += (size_t)n;
+    }
+    close(fd);
+
+    strview_t rest = strview_from_sized(buf, length);
+    strview_t end = STRVIEW_EMPTY;
+
+    // the response to HEAD keeps the Content-Length of the file, but has no body:
+    bool has_header_end = strview_find_header_end(rest, &end);
+    assert(has_header_end);
+    const strview_t head_response = strview_take(rest, length - end.length + 4);
+    assert(strview_equals(strview_take(head_response, 12), STRVIEW_FROM("HTTP/1.1 200")));
+    assert(content_length_of(head_response) > 0);
+    rest = strview_drop(end, 4);
+
+    // so the response to GET follows right after, with all of its body:
+    assert(strview_equals(strview_take(rest, 12), STRVIEW_FROM("HTTP/1.1 200")));
+    has_header_end = strview_find_header_end(rest, &end);
+    assert(has_header_end);
+    const size_t get_header_length = rest.length - end.length + 4;
+    assert(rest.length == get_header_length + content_length_of(strview_take(rest, get_header_length)));
+
+    printf("OK\n");
+    return EXIT_SUCCESS;
+}
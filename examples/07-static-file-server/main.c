@@ -3,25 +3,67 @@
 
 #include <connection.h>
 #include <connection_tcp.h>
+#include <event_loop.h>
+#include <file_cache.h>
 #include <linux/limits.h>
+#include <mime.h>
+#include <router.h>
 #include <types/strdyn.h>
-#include <types/strtable.h>
 #include <types/strview.h>
+#include <worker_pool.h>
 
 #include <errno.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
+// request bodies are not used by the server, and are discarded as they are recieved, up to this size:
+#define MAX_REQUEST_BODY_SIZE (1 << 20)
+
+// how often the workers report their connections and recieve buffers, with the "stats" option:
+#define STATS_INTERVAL_SEC (10)
+
+/**
+ * Files served, under the root path. Wildcard routes serve the files of a directory.
+ */
+struct FileRoute {
+    strview_t pattern;    ///< url path pattern of the route
+    strview_t local_path; ///< file, or directory the wildcard is looked up in, relative to the root path
+};
+
+static const struct FileRoute FILE_ROUTES[] = {
+    {.pattern = STRVIEW("/"), .local_path = STRVIEW("/index.html")},
+    {.pattern = STRVIEW("/index.html"), .local_path = STRVIEW("/index.html")},
+    {.pattern = STRVIEW("/favicon.ico"), .local_path = STRVIEW("/favicon.ico")},
+    {.pattern = STRVIEW("/html/*path"), .local_path = STRVIEW("/html/")},
+    {.pattern = STRVIEW("/css/*path"), .local_path = STRVIEW("/css/")},
+    {.pattern = STRVIEW("/js/*path"), .local_path = STRVIEW("/js/")},
+    {.pattern = STRVIEW("/images/*path"), .local_path = STRVIEW("/images/")},
+};
+
 struct ClientHandler {
     char rootpath_[PATH_MAX];
     strview_t rootpath;
 
-    strtable_t *mime_table;
-    strview_t default_mime_type;
+    struct Router router; ///< routes of FILE_ROUTES, for GET and HEAD requests
+
+    struct MimeTable mime_types; ///< media types of MIME_TYPES_PATH, or of the bundled copy
+
+    bool report_stats; ///< whether the workers report their stats every STATS_INTERVAL_SEC
+};
+
+struct WorkerHandler {
+    struct ClientHandler *client_handler; ///< shared by the workers, only read from
+    struct FileCache file_cache;          ///< files opened by the worker
+    size_t worker_idx;                    ///< index of the worker
+    struct EventLoop *loop;               ///< event loop of the worker, once started
+    int stats_timer_fd;                   ///< timer reporting the stats of the worker, or -1
 };
 
 bool file_exists(const char *filename)
@@ -31,116 +73,338 @@ bool file_exists(const char *filename)
     return (stat(filename, &buffer) == 0);
 }
 
-Error_t open_file_and_get_file_size(const char *filepath, strdyn_t *out_file_size_str)
+Error_t send_file_response(
+    struct Connection *conn,
+    const bool keep_alive,
+    const bool send_body,
+    const enum HTTPStatus status,
+    const strview_t content_type,
+    const char *filepath)
 {
-    FILE *fp = fopen(filepath, "r");
-    if (fp == NULL) {
+    int file_handle = open(filepath, O_RDONLY);
+    if (file_handle < 0) {
         return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
     }
-    if (fseek(fp, 0L, SEEK_END) != 0) {
-        fclose(fp);
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    struct stat statbuf;
+    if (fstat(file_handle, &statbuf) == -1) {
+        const Error_t e = (Error_t){.tag = ERROR_ERRNO, .errno_num = errno};
+        close(file_handle);
+        return error_format_location(ERROR_INFO(__func__), e);
     }
-    const ssize_t size = ftell(fp);
-    if (size == -1) {
-        fclose(fp);
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    const size_t content_length = (size_t)statbuf.st_size;
+
+    char header_buf[512];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, status);
+    response_writer_header(&writer, STRVIEW_FROM("Content-Type"), content_type);
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), content_length);
+    response_writer_header(
+        &writer, STRVIEW_FROM("Connection"), keep_alive ? STRVIEW_FROM("keep-alive") : STRVIEW_FROM("close"));
+
+    Error_t e = NO_ERRORS;
+
+    e = response_writer_finish(&writer);
+    if (e.tag != ERROR_NONE) goto cleanup1;
+
+    e = connection_queue_bytes(conn, writer.length, header_buf);
+    if (e.tag != ERROR_NONE) goto cleanup1;
+
+    if (!send_body) goto cleanup1;
+
+    e = connection_queue_file(conn, file_handle, 0, content_length);
+    if (e.tag != ERROR_NONE) goto cleanup1;
+    file_handle = -1; // owned by the connection now
+
+cleanup1:
+    if (file_handle >= 0) {
+        close(file_handle);
     }
-    Error_t e;
-    e = strdyn_empty(out_file_size_str);
-    if (e.tag != ERROR_NONE) {
-        fclose(fp);
-        return e;
+    return e;
+}
+
+// end of the pre-rendered headers of the file cache:
+static const strview_t KEEP_ALIVE_END = STRVIEW("Connection: keep-alive\r\n\r\n");
+static const strview_t CLOSE_END = STRVIEW("Connection: close\r\n\r\n");
+
+/**
+ * Queue part of the file of a cache entry. The file stays open, or in memory, in the cache, so the entry is kept alive
+ * until the part is sent.
+ */
+Error_t
+queue_entry_part(struct Connection *conn, struct FileCacheEntry *entry, const uint64_t offset, const size_t nbytes)
+{
+    Error_t e = NO_ERRORS;
+
+    file_cache_entry_acquire(entry);
+    if (entry->body) {
+        // sent along with the header in one system call.
+        e = connection_queue_shared_bytes(conn, nbytes, &entry->body[offset], file_cache_entry_release, entry);
     }
-    e = strdyn_append_fmt(out_file_size_str, "%zu", size);
-    if (e.tag != ERROR_NONE) {
-        fclose(fp);
-        return e;
+    else {
+        e = connection_queue_borrowed_file(
+            conn, entry->file_fd, (off_t)offset, nbytes, file_cache_entry_release, entry);
     }
-    if (fclose(fp) == -1) {
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    if (e.tag != ERROR_NONE) {
+        file_cache_entry_release(entry);
     }
-    return NO_ERRORS;
+    return e;
 }
 
+/**
+ * Send the file of a cache entry, or only its header when send_body is false, e.g. for HEAD requests.
+ */
 Error_t
-send_file_response(const int conn_fd, const char *content_type, const char *content_length, const char *filepath)
+send_cached_file(struct Connection *conn, const bool keep_alive, const bool send_body, struct FileCacheEntry *entry)
 {
-    int file_handle = open(filepath, O_RDONLY);
-    if (file_handle < 0) {
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
-    }
+    const strview_t header_end = keep_alive ? KEEP_ALIVE_END : CLOSE_END;
 
-    strtable_t *headers = strtable_create(2);
-    strtable_update(headers, STRVIEW_FROM("Content-Type"), strview_from_cstr(content_type));
-    strtable_update(headers, STRVIEW_FROM("Content-Length"), strview_from_cstr(content_length));
+    Error_t e = NO_ERRORS;
 
-    const struct StatusLine status = {
-        .http_version = STRVIEW("1.0"),
-        .status_code = STRVIEW("200"),
-        .status_desc = STRVIEW("OK"),
-    };
+    // both parts of the header are copied into the same segment:
+    e = connection_queue_bytes(conn, entry->header_len, entry->header);
+    if (e.tag != ERROR_NONE) return e;
+    e = connection_queue_bytes(conn, header_end.length, (const char *)header_end.buf);
+    if (e.tag != ERROR_NONE || !send_body) return e;
 
-    strdyn_t out_buf = NULL;
-    Error_t e = NO_ERRORS;
+    return queue_entry_part(conn, entry, 0, entry->size);
+}
 
-    e = assemble_header(status, headers, &out_buf);
-    if (e.tag != ERROR_NONE) goto cleanup1;
+Error_t send_range_not_satisfiable(struct Connection *conn, const bool keep_alive, struct FileCacheEntry *entry)
+{
+    char header_buf[256];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, HTTP_STATUS_RANGE_NOT_SATISFIABLE);
+    response_writer_content_range(&writer, NULL, entry->size);
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), 0);
+    response_writer_header(
+        &writer, STRVIEW_FROM("Connection"), keep_alive ? STRVIEW_FROM("keep-alive") : STRVIEW_FROM("close"));
+
+    const Error_t e = response_writer_finish(&writer);
+    if (e.tag != ERROR_NONE) return e;
+    return connection_queue_bytes(conn, writer.length, header_buf);
+}
 
-    e = bytes_sendall(conn_fd, strdyn_length(out_buf), out_buf);
-    if (e.tag != ERROR_NONE) goto cleanup1;
+/**
+ * Send a response without a body, closing the connection, e.g. when the end of the request is unknown.
+ */
+Error_t send_status_and_close(struct Connection *conn, const enum HTTPStatus status)
+{
+    char header_buf[128];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, status);
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), 0);
+    response_writer_header(&writer, STRVIEW_FROM("Connection"), STRVIEW_FROM("close"));
+
+    const Error_t e = response_writer_finish(&writer);
+    if (e.tag != ERROR_NONE) return e;
+    conn->close_after_write = true;
+    return connection_queue_bytes(conn, writer.length, header_buf);
+}
 
-    e = bytes_sendfile(conn_fd, file_handle, 100 * (int)1e+6); // last parameter: max file size
-    if (e.tag != ERROR_NONE) goto cleanup1;
+/**
+ * Answer a request with a method the routes of its path do not take. Only GET (and HEAD) routes are served.
+ */
+Error_t send_method_not_allowed(struct Connection *conn, const bool keep_alive)
+{
+    char header_buf[128];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, HTTP_STATUS_METHOD_NOT_ALLOWED);
+    response_writer_header(&writer, STRVIEW_FROM("Allow"), STRVIEW_FROM("GET, HEAD"));
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), 0);
+    response_writer_header(
+        &writer, STRVIEW_FROM("Connection"), keep_alive ? STRVIEW_FROM("keep-alive") : STRVIEW_FROM("close"));
+
+    const Error_t e = response_writer_finish(&writer);
+    if (e.tag != ERROR_NONE) return e;
+    return connection_queue_bytes(conn, writer.length, header_buf);
+}
 
-cleanup1:
-    if (file_handle >= 0) {
-        close(file_handle);
+// separates the parts of multipart/byteranges bodies. the parts also carry their length in their Content-Range, but
+// the boundary should not occur in the files served.
+#define BYTERANGES_BOUNDARY "7f3c9a1d5e0b6428"
+
+/**
+ * Send ranges of the file of a cache entry with 206 Partial Content. A single range is sent as the body, straight
+ * from the file. Several ranges are sent as a multipart/byteranges body, whose part headers are queued around the
+ * file parts, so they are sent together with as few system calls as possible. Only the header is sent when send_body
+ * is false.
+ */
+Error_t send_cached_ranges(
+    struct Connection *conn,
+    const bool keep_alive,
+    const bool send_body,
+    struct FileCacheEntry *entry,
+    const size_t nranges,
+    const struct HTTPByteRange *ranges)
+{
+    static const strview_t DELIMITER = STRVIEW("\r\n--" BYTERANGES_BOUNDARY "\r\n");
+    static const strview_t CLOSE_DELIMITER = STRVIEW("\r\n--" BYTERANGES_BOUNDARY "--\r\n");
+
+    Error_t e = NO_ERRORS;
+
+    // the part headers, each ending where the next begins:
+    char parts_buf[HTTP_MAX_RANGES * 160];
+    size_t part_ends[HTTP_MAX_RANGES];
+    struct ResponseWriter parts;
+    response_writer_init(&parts, sizeof(parts_buf), parts_buf);
+
+    uint64_t content_length = 0;
+    for (size_t i = 0; i < nranges; i++) {
+        content_length += ranges[i].last - ranges[i].first + 1;
+        if (nranges > 1) {
+            response_writer_bytes(&parts, DELIMITER);
+            response_writer_header(&parts, STRVIEW_FROM("Content-Type"), entry->content_type);
+            response_writer_content_range(&parts, &ranges[i], entry->size);
+            response_writer_bytes(&parts, STRVIEW_FROM("\r\n"));
+            part_ends[i] = parts.length;
+        }
     }
-    if (out_buf != NULL) {
-        strdyn_free(out_buf);
+    if (nranges > 1) {
+        response_writer_bytes(&parts, CLOSE_DELIMITER);
+        if (parts.overflowed) {
+            return error_format_location(
+                ERROR_INFO(__func__),
+                (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "multipart headers do not fit in the buffer"});
+        }
+        content_length += parts.length;
+    }
+
+    char header_buf[512];
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(header_buf), header_buf);
+    response_writer_status(&writer, HTTP_STATUS_PARTIAL_CONTENT);
+    if (nranges > 1) {
+        response_writer_header(
+            &writer,
+            STRVIEW_FROM("Content-Type"),
+            STRVIEW_FROM("multipart/byteranges; boundary=" BYTERANGES_BOUNDARY));
+    }
+    else {
+        response_writer_header(&writer, STRVIEW_FROM("Content-Type"), entry->content_type);
+        response_writer_content_range(&writer, &ranges[0], entry->size);
+    }
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), content_length);
+    response_writer_header(&writer, STRVIEW_FROM("ETag"), entry->etag);
+    response_writer_header(
+        &writer, STRVIEW_FROM("Connection"), keep_alive ? STRVIEW_FROM("keep-alive") : STRVIEW_FROM("close"));
+
+    e = response_writer_finish(&writer);
+    if (e.tag != ERROR_NONE) return e;
+    e = connection_queue_bytes(conn, writer.length, header_buf);
+    if (e.tag != ERROR_NONE || !send_body) return e;
+
+    size_t part_begin = 0;
+    for (size_t i = 0; i < nranges; i++) {
+        if (nranges > 1) {
+            e = connection_queue_bytes(conn, part_ends[i] - part_begin, &parts_buf[part_begin]);
+            if (e.tag != ERROR_NONE) return e;
+            part_begin = part_ends[i];
+        }
+        e = queue_entry_part(conn, entry, ranges[i].first, (size_t)(ranges[i].last - ranges[i].first + 1));
+        if (e.tag != ERROR_NONE) return e;
     }
-    if (headers != NULL) {
-        strtable_destroy(headers);
+    if (nranges > 1) {
+        e = connection_queue_bytes(conn, parts.length - part_begin, &parts_buf[part_begin]);
     }
     return e;
 }
 
-Error_t init_mime_table(struct ClientHandler *handler)
+Error_t send_not_modified(struct Connection *conn, const bool keep_alive, struct FileCacheEntry *entry)
 {
-    handler->mime_table = strtable_create(16);
-    if (!handler->mime_table) {
-        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    const strview_t header_end = keep_alive ? KEEP_ALIVE_END : CLOSE_END;
+
+    const Error_t e = connection_queue_bytes(conn, entry->not_modified_header_len, entry->not_modified_header);
+    if (e.tag != ERROR_NONE) return e;
+    return connection_queue_bytes(conn, header_end.length, (const char *)header_end.buf);
+}
+
+/**
+ * Check whether the client has the current file of a cache entry already, going by the validators of its request.
+ */
+bool entry_not_modified(const struct HTTPRequest *request, const struct FileCacheEntry *entry)
+{
+    if (request->method != HTTP_METHOD_GET && request->method != HTTP_METHOD_HEAD) {
+        return false;
     }
-    handler->default_mime_type = STRVIEW_FROM("application/octet-stream");
-    strtable_update(handler->mime_table, STRVIEW_FROM(".html"), STRVIEW_FROM("text/html"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".css"), STRVIEW_FROM("text/css"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".js"), STRVIEW_FROM("text/javascript"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".txt"), STRVIEW_FROM("text/plain"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".jpg"), STRVIEW_FROM("image/jpeg"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".jpeg"), STRVIEW_FROM("image/jpg"));
-    strtable_update(handler->mime_table, STRVIEW_FROM(".ico"), STRVIEW_FROM("image/vnd.microsoft.icon"));
-    return NO_ERRORS;
+    // If-None-Match is more precise, so If-Modified-Since is ignored along with it:
+    strview_t validator = STRVIEW_EMPTY;
+    if (http_request_get_header(request, HTTP_HEADER_IF_NONE_MATCH, &validator)) {
+        return http_etag_list_matches(validator, entry->etag);
+    }
+    time_t since = 0;
+    return http_request_get_header(request, HTTP_HEADER_IF_MODIFIED_SINCE, &validator)
+        && http_parse_date(validator, &since) && entry->mtime.tv_sec <= since;
 }
 
-const char *get_mime_type(struct ClientHandler *handler, const char *filepath)
+/**
+ * Answer a request for the file of a cache entry, with 304 Not Modified if the client has it already, or with the
+ * parts asked for by its Range header, if any.
+ */
+Error_t send_cached_entity(
+    struct Connection *conn, const bool keep_alive, const struct HTTPRequest *request, struct FileCacheEntry *entry)
 {
-    strview_t extension = STRVIEW_EMPTY;
-    if (!strview_find_lastc(strview_from_cstr(filepath), '.', &extension)) {
-        return (const char *)handler->default_mime_type.buf;
+    // responses to HEAD requests are those to GET requests without their body:
+    const bool send_body = request->method != HTTP_METHOD_HEAD;
+
+    // revalidations are answered from the metadata of the entry, without touching the file:
+    if (entry_not_modified(request, entry)) {
+        return send_not_modified(conn, keep_alive, entry);
+    }
+
+    strview_t range_header = STRVIEW_EMPTY;
+    if (request->method != HTTP_METHOD_GET || !http_request_get_header(request, HTTP_HEADER_RANGE, &range_header)) {
+        return send_cached_file(conn, keep_alive, send_body, entry);
     }
-    return (const char *)strtable_get_value(handler->mime_table, extension, handler->default_mime_type).buf;
+
+    // ranges of a file changed since the client got its first part would not fit together:
+    strview_t if_range_header = STRVIEW_EMPTY;
+    if (http_request_get_header(request, HTTP_HEADER_IF_RANGE, &if_range_header)
+        && !http_if_range_matches(if_range_header, entry->etag, entry->last_modified)) {
+        return send_cached_file(conn, keep_alive, send_body, entry);
+    }
+
+    struct HTTPByteRange ranges[HTTP_MAX_RANGES];
+    size_t nranges = 0;
+    switch (http_parse_range(range_header, entry->size, HTTP_MAX_RANGES, ranges, &nranges)) {
+    case HTTP_RANGE_IGNORED:
+        return send_cached_file(conn, keep_alive, send_body, entry);
+    case HTTP_RANGE_SATISFIABLE:
+        return send_cached_ranges(conn, keep_alive, send_body, entry, nranges, ranges);
+    case HTTP_RANGE_NOT_SATISFIABLE:
+        return send_range_not_satisfiable(conn, keep_alive, entry);
+    }
+    return send_cached_file(conn, keep_alive, send_body, entry);
+}
+
+strview_t get_mime_type(struct ClientHandler *handler, const char *filepath)
+{
+    return mime_table_lookup(&handler->mime_types, strview_from_cstr(filepath));
 }
 
 Error_t init_client_handler(struct ClientHandler *handler, const char *rootpath)
 {
     handler->rootpath = strview_from_cstr(realpath(rootpath, handler->rootpath_));
-    return init_mime_table(handler);
+
+    Error_t e = router_init(&handler->router);
+    if (e.tag != ERROR_NONE) return e;
+    for (size_t i = 0; i < sizeof(FILE_ROUTES) / sizeof(*FILE_ROUTES); i++) {
+        e = router_add(&handler->router, HTTP_METHOD_GET, FILE_ROUTES[i].pattern, (void *)&FILE_ROUTES[i]);
+        if (e.tag != ERROR_NONE) return e;
+    }
+    e = router_compile(&handler->router);
+    if (e.tag != ERROR_NONE) return e;
+
+    return mime_table_init(&handler->mime_types, MIME_TYPES_PATH);
 }
 
 void destroy_client_handler(struct ClientHandler *handler)
 {
-    strtable_destroy(handler->mime_table);
+    router_destroy(&handler->router);
+    mime_table_destroy(&handler->mime_types);
 }
 
 bool route_starts_with(const strview_t rootpath, const strview_t suffix, const strview_t route)
@@ -152,124 +416,272 @@ bool route_starts_with(const strview_t rootpath, const strview_t suffix, const s
         && memcmp(&route.buf[rootpath.length], suffix.buf, suffix.length) == 0;
 }
 
-static const char RESPONSE_404_NOT_FOUND[] = "HTTP/1.0 404 Not Found\r\n"
+#define RESPONSE_404_BODY "404 Bad Request"
+
+static const char RESPONSE_404_NOT_FOUND[] = "HTTP/1.1 404 Not Found\r\n"
                                              "Content-Type: text/plain\r\n"
                                              "Content-Length: 15\r\n"
-                                             "\r\n"
-                                             "404 Bad Request";
-
-Error_t handle_client(const int conn_fd, struct ClientHandler *handler)
+                                             "Connection: close\r\n"
+                                             "\r\n" RESPONSE_404_BODY;
+
+/**
+ * Map the route matched by a url path to a file under the root path.
+ */
+bool resolve_filepath(
+    struct ClientHandler *handler, const struct RouteMatch *match, const size_t buf_size, char *out_buf)
 {
-    char request_buf[4096] = {0};
-    struct BufferedReader reader;
-    buffered_reader_init(&reader, conn_fd, sizeof(request_buf), request_buf);
-
-    Error_t e = NO_ERRORS;
-    char request_line_buf[1024] = {0};
-    size_t request_line_len = 0;
+    const struct FileRoute *route = match->value;
+    if (match->nparams == 0) {
+        snprintf(out_buf, buf_size, "%s%s", handler->rootpath.buf, route->local_path.buf);
+        return file_exists(out_buf);
+    }
 
-    e = bytes_recvline(&reader, sizeof(request_line_buf), request_line_buf, &request_line_len);
-    if (e.tag != ERROR_NONE) goto on_error;
+    // the rest of the path may climb out of the directory of the route with "..":
+    const strview_t rest = match->params[0].value;
+    char path_buf[PATH_MAX] = {0};
+    snprintf(
+        path_buf,
+        sizeof(path_buf),
+        "%s%s%.*s",
+        handler->rootpath.buf,
+        route->local_path.buf,
+        (int)rest.length,
+        rest.buf);
+    const strview_t real_path_view = strview_from_cstr(realpath(path_buf, out_buf));
 
-    struct RequestLine request_line = {0};
-    e = tokenize_request_line(strview_from_sized((uint8_t *)request_line_buf, request_line_len), &request_line);
-    if (e.tag != ERROR_NONE) goto on_error;
+    return route_starts_with(handler->rootpath, route->local_path, real_path_view) && file_exists(out_buf);
+}
 
-    // just ignore the headers:
-    struct HTTPHeader header = {0};
-    do {
-        char linebuf[1024] = {0};
-        size_t line_len = 0;
-        e = bytes_recvline(&reader, sizeof(linebuf), linebuf, &line_len);
-        if (e.tag != ERROR_NONE) goto on_error;
+/**
+ * Pick the precompressed sidecar of a cache entry the client accepts best, or the entry itself.
+ */
+struct FileCacheEntry *
+negotiate_variant(struct FileCache *cache, const struct HTTPRequest *request, struct FileCacheEntry *entry)
+{
+    if (entry->codings == 0) {
+        return entry;
+    }
+    strview_t accept_encoding = STRVIEW_EMPTY;
+    http_request_get_header(request, HTTP_HEADER_ACCEPT_ENCODING, &accept_encoding);
+    const enum HTTPContentCoding coding = http_negotiate_coding(accept_encoding, entry->codings);
+    if (coding == HTTP_CODING_IDENTITY) {
+        return entry;
+    }
 
-        if (line_len == 0 || strncmp(linebuf, "\r\n", line_len) == 0) {
-            break;
-        }
+    struct FileCacheEntry *variant = file_cache_get(cache, entry->url_path, coding);
+    if (variant) {
+        return variant;
+    }
+    const Error_t e = file_cache_insert(cache, entry->url_path, coding, entry->filepath, entry->content_type, &variant);
+    if (e.tag != ERROR_NONE) {
+        // the sidecar is gone. stop looking for it until the file is cached again.
+        entry->codings &= ~(1u << coding);
+        return entry;
+    }
+    return variant;
+}
 
-        e = tokenize_header(strview_from_sized((uint8_t *)linebuf, line_len), &header);
-        if (e.tag != ERROR_NONE) goto on_error;
-    } while (true);
+Error_t handle_client(void *arg, struct Connection *conn)
+{
+    struct WorkerHandler *worker = arg;
+    struct ClientHandler *handler = worker->client_handler;
 
+    Error_t e = NO_ERRORS;
     char path_buf[PATH_MAX] = {0};
 
-    if ((strview_equals(STRVIEW_FROM("/"), request_line.url) || //
-         strview_equals(STRVIEW_FROM("/index.html"), request_line.url))
-        && (snprintf(path_buf, sizeof(path_buf), "%s/index.html", handler->rootpath.buf), file_exists(path_buf))) {
-        strdyn_t file_size_str;
-        open_file_and_get_file_size(path_buf, &file_size_str);
-        Error_t e1 = send_file_response(conn_fd, get_mime_type(handler, path_buf), file_size_str, path_buf);
-        strdyn_free(file_size_str);
-        return e1;
+    struct HTTPRequest request;
+    bool complete = false;
+    bool send_body = true; // false for HEAD requests
+    e = http_request_parse(&conn->parser, buffered_reader_view(&conn->reader), &request, &complete);
+    if (e.tag != ERROR_NONE) goto on_error;
+    if (!complete) {
+        // wait for the rest of the header block.
+        return NO_ERRORS;
     }
+    buffered_reader_consume(&conn->reader, request.length); // the views stay valid until the next recieve
+    send_body = request.method != HTTP_METHOD_HEAD;
 
-    if (strview_equals(STRVIEW_FROM("/favicon.ico"), request_line.url)
-        && (printf("true"),
-            snprintf(path_buf, sizeof(path_buf), "%s/favicon.ico", handler->rootpath.buf),
-            file_exists(path_buf))) {
-        strdyn_t file_size_str;
-        open_file_and_get_file_size(path_buf, &file_size_str);
-        Error_t e1 = send_file_response(conn_fd, get_mime_type(handler, path_buf), file_size_str, path_buf);
-        strdyn_free(file_size_str);
-        return e1;
+    e = connection_begin_body(conn, &request, MAX_REQUEST_BODY_SIZE);
+    if (e.tag != ERROR_NONE) {
+        const Error_t e1 = send_status_and_close(conn, conn->body.error_status);
+        return e1.tag != ERROR_NONE ? e1 : e;
     }
 
-    snprintf(
-        path_buf,
-        sizeof(path_buf),
-        "%s%.*s",
-        handler->rootpath.buf,
-        (int)request_line.url.length,
-        request_line.url.buf);
-    char real_path_buf[PATH_MAX] = {0};
-    const strview_t real_path_view = strview_from_cstr(realpath(path_buf, real_path_buf));
-
-    if ((route_starts_with(handler->rootpath, STRVIEW_FROM("/html/"), real_path_view) || //
-         route_starts_with(handler->rootpath, STRVIEW_FROM("/css/"), real_path_view) ||  //
-         route_starts_with(handler->rootpath, STRVIEW_FROM("/js/"), real_path_view) ||   //
-         route_starts_with(handler->rootpath, STRVIEW_FROM("/images/"), real_path_view))
-        && file_exists(real_path_buf)) {
-        strdyn_t file_size_str;
-        open_file_and_get_file_size(path_buf, &file_size_str);
-        Error_t e1 = send_file_response(conn_fd, get_mime_type(handler, real_path_buf), file_size_str, real_path_buf);
-        strdyn_free(file_size_str);
-        return e1;
+    strview_t connection_header = STRVIEW_EMPTY;
+    http_request_get_header(&request, HTTP_HEADER_CONNECTION, &connection_header);
+    const bool keep_alive =
+        connection_count_request(conn, http_keep_alive(request.protocol_version, connection_header));
+
+    struct RouteMatch match;
+    if (!router_match(&handler->router, request.method, request.path, &match)) {
+        if (match.allowed_methods != 0) {
+            return send_method_not_allowed(conn, keep_alive);
+        }
+        e.tag = ERROR_CUSTOM;
+        e.custom_msg = "no matching routes! sending 404";
+        e = error_format_location(ERROR_INFO("handle_client"), e);
+        goto on_error;
+    }
+
+    // files served before are answered without touching the file system:
+    struct FileCacheEntry *entry = file_cache_get(&worker->file_cache, request.path, HTTP_CODING_IDENTITY);
+    if (!entry && resolve_filepath(handler, &match, sizeof(path_buf), path_buf)) {
+        e = file_cache_insert(
+            &worker->file_cache,
+            request.path,
+            HTTP_CODING_IDENTITY,
+            path_buf,
+            get_mime_type(handler, path_buf),
+            &entry);
+        if (e.tag != ERROR_NONE) goto on_error;
+    }
+    if (entry) {
+        // caching a sidecar may evict the entry. keep it alive until the response is queued:
+        file_cache_entry_acquire(entry);
+        e = send_cached_entity(conn, keep_alive, &request, negotiate_variant(&worker->file_cache, &request, entry));
+        file_cache_entry_release(entry);
+        return e;
     }
 
     e.tag = ERROR_CUSTOM;
-    e.custom_msg = "no matching routes! sending 404";
+    e.custom_msg = "no matching file! sending 404";
     e = error_format_location(ERROR_INFO("handle_client"), e);
 
 on_error:
+    conn->close_after_write = true;
     // don't report any errors. just send 404, possibly a custom 404 if it exists:
     if (snprintf(path_buf, sizeof(path_buf), "%s/html/404.html", (const char *)handler->rootpath.buf),
         file_exists(path_buf)) {
-        strdyn_t file_size_str;
-        open_file_and_get_file_size(path_buf, &file_size_str);
-        Error_t e1 = send_file_response(conn_fd, get_mime_type(handler, path_buf), file_size_str, path_buf);
-        strdyn_free(file_size_str);
+        const Error_t e1 = send_file_response(
+            conn, false, send_body, HTTP_STATUS_NOT_FOUND, get_mime_type(handler, path_buf), path_buf);
         if (e1.tag != ERROR_NONE) e = e1;
     }
     else {
-        bytes_sendall(conn_fd, sizeof(RESPONSE_404_NOT_FOUND) - 1, RESPONSE_404_NOT_FOUND);
+        const size_t body_length = send_body ? 0 : sizeof(RESPONSE_404_BODY) - 1;
+        connection_queue_borrowed_bytes(
+            conn, sizeof(RESPONSE_404_NOT_FOUND) - 1 - body_length, RESPONSE_404_NOT_FOUND);
     }
     return e;
 }
 
+void report_error(void *arg, const Error_t error)
+{
+    (void)(arg);
+    char error_strbuf[512] = {0};
+    printf("%s\n", error_stringify(error, sizeof(error_strbuf), error_strbuf));
+}
+
+void on_file_changes(void *arg)
+{
+    file_cache_process_events(arg);
+}
+
+void on_stats_timer(void *arg)
+{
+    struct WorkerHandler *worker = arg;
+    uint64_t nexpirations = 0;
+    while (read(worker->stats_timer_fd, &nexpirations, sizeof(nexpirations)) > 0) {
+    }
+
+    size_t nbytes_used = 0;
+    size_t nbytes_total = 0;
+    buffer_pool_occupancy(&worker->loop->buffers, &nbytes_used, &nbytes_total);
+    char stats_buf[256] = {0};
+    printf(
+        "worker %zu: %zu connections, recieve buffers %zu / %zu KiB in use (%s)\n",
+        worker->worker_idx,
+        worker->loop->nconnections,
+        nbytes_used >> 10,
+        nbytes_total >> 10,
+        buffer_pool_format_stats(&worker->loop->buffers, sizeof(stats_buf), stats_buf));
+    fflush(stdout);
+}
+
+Error_t start_worker(void *arg, struct EventLoop *loop)
+{
+    struct WorkerHandler *worker = arg;
+    worker->loop = loop;
+    Error_t e = event_loop_watch_fd(loop, worker->file_cache.inotify_fd, on_file_changes, &worker->file_cache);
+    if (e.tag != ERROR_NONE || !worker->client_handler->report_stats) {
+        return e;
+    }
+
+    worker->stats_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    const struct itimerspec interval = {
+        .it_interval = {.tv_sec = STATS_INTERVAL_SEC},
+        .it_value = {.tv_sec = STATS_INTERVAL_SEC},
+    };
+    if (worker->stats_timer_fd == -1 || timerfd_settime(worker->stats_timer_fd, 0, &interval, NULL) == -1) {
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return event_loop_watch_fd(loop, worker->stats_timer_fd, on_stats_timer, worker);
+}
+
+Error_t init_worker_handler(void *arg, const size_t worker_idx, struct EventLoopHandler *out_handler)
+{
+    struct WorkerHandler *worker = calloc(1, sizeof(*worker));
+    if (!worker) {
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    // the client handler is only read from, so the workers can share it. the file cache is per worker.
+    worker->client_handler = arg;
+    worker->worker_idx = worker_idx;
+    worker->stats_timer_fd = -1;
+    const Error_t e = file_cache_init(&worker->file_cache, FILE_CACHE_DEFAULT_CONFIG);
+    if (e.tag != ERROR_NONE) {
+        free(worker);
+        return e;
+    }
+    *out_handler = (struct EventLoopHandler){
+        .arg = worker,
+        .on_start = start_worker,
+        .on_data = handle_client,
+        .on_error = report_error,
+    };
+    return NO_ERRORS;
+}
+
+void destroy_worker_handler(void *arg, const size_t worker_idx, struct EventLoopHandler *handler)
+{
+    (void)(arg);
+    (void)(worker_idx);
+    struct WorkerHandler *worker = handler->arg;
+    if (worker->stats_timer_fd >= 0) {
+        close(worker->stats_timer_fd);
+    }
+    file_cache_destroy(&worker->file_cache);
+    free(worker);
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 3) {
         const char *program_name = (argc == 1) ? argv[0] : "<program>";
-        fprintf(stderr, "usage: %s <port> <root-path>\n", program_name);
+        fprintf(stderr, "usage: %s <port> <root-path> [<nworkers> [pin] [uring] [stats]]\n", program_name);
         return EXIT_FAILURE;
     }
     const char *port = (argc > 1) ? argv[1] : 0;
     const char *rootpath = (argc > 2) ? argv[2] : 0;
+    const size_t nworkers = (argc > 3) ? strtoul(argv[3], NULL, 10) : 0; // 0: one worker per cpu
+    bool pin_to_cpus = false;
+    bool report_stats = false;
+    struct EventLoopConfig loop_config = EVENT_LOOP_DEFAULT_CONFIG;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "pin") == 0) {
+            pin_to_cpus = true;
+        }
+        else if (strcmp(argv[i], "uring") == 0) {
+            loop_config.backend = EVENT_LOOP_BACKEND_IO_URING;
+        }
+        else if (strcmp(argv[i], "stats") == 0) {
+            report_stats = true;
+        }
+    }
 
-    char error_strbuf[512] = {0};
+    // peers closing their connection early should not kill the server:
+    signal(SIGPIPE, SIG_IGN);
 
-    int server_fd = -1;
-    int conn_fd = -1;
+    char error_strbuf[512] = {0};
 
     struct ClientHandler client_handler = {0};
     const Error_t client_handler_error = init_client_handler(&client_handler, rootpath);
@@ -277,34 +689,23 @@ int main(int argc, char *argv[])
         printf("%s\n", error_stringify(client_handler_error, sizeof(error_strbuf), error_strbuf));
         return EXIT_FAILURE;
     }
-
-    const Error_t server_open_error = open_tcp_server(port, &server_fd);
-    if (server_open_error.tag != ERROR_NONE) {
-        destroy_client_handler(&client_handler);
-        printf("%s\n", error_stringify(server_open_error, sizeof(error_strbuf), error_strbuf));
-        return EXIT_FAILURE;
+    client_handler.report_stats = report_stats;
+
+    const struct WorkerPoolConfig pool_config = {
+        .port = port,
+        .backlog_size = SOMAXCONN,
+        .nworkers = nworkers,
+        .pin_to_cpus = pin_to_cpus,
+        .loop_config = loop_config,
+        .handler_arg = &client_handler,
+        .init_handler = init_worker_handler,
+        .destroy_handler = destroy_worker_handler,
+    };
+    const Error_t e = worker_pool_run(&pool_config);
+    if (e.tag != ERROR_NONE) {
+        printf("%s\n", error_stringify(e, sizeof(error_strbuf), error_strbuf));
     }
 
-    while (true) {
-        const Error_t client_open_error = open_tcp_client_connection(server_fd, &conn_fd);
-        if (client_open_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(client_open_error, sizeof(error_strbuf), error_strbuf));
-            continue;
-        }
-
-        const Error_t handle_client_error = handle_client(conn_fd, &client_handler);
-        if (handle_client_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(handle_client_error, sizeof(error_strbuf), error_strbuf));
-            close_socket(conn_fd);
-            conn_fd = -1;
-            continue;
-        }
-
-        const Error_t client_close_error = close_socket(conn_fd);
-        if (client_close_error.tag != ERROR_NONE) {
-            printf("%s\n", error_stringify(client_close_error, sizeof(error_strbuf), error_strbuf));
-        }
-    }
     destroy_client_handler(&client_handler);
-    return EXIT_SUCCESS;
+    return e.tag == ERROR_NONE ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,132 @@
+#include "buffer_pool.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// a slab is carved into as many buffers of a class as fit, all put on the free list of the class at once. buffers on
+// the free list link to each other through their first bytes, so the pool needs no memory besides the slabs.
+
+struct BufferPoolFree {
+    struct BufferPoolFree *next;
+};
+
+struct BufferPoolSlab {
+    struct BufferPoolSlab *next;
+    alignas(max_align_t) char data[];
+};
+
+void buffer_pool_init(struct BufferPool *pool)
+{
+    *pool = (struct BufferPool){0};
+    for (size_t i = 0; i < BUFFER_POOL_NCLASSES; i++) {
+        pool->classes[i].buffer_size = BUFFER_POOL_CLASS_SIZES[i];
+    }
+}
+
+void buffer_pool_destroy(struct BufferPool *pool)
+{
+    struct BufferPoolSlab *slab = pool->slabs;
+    while (slab) {
+        struct BufferPoolSlab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    buffer_pool_init(pool);
+}
+
+static bool pool_add_slab(struct BufferPool *pool, struct BufferPoolClass *class)
+{
+    const size_t nbuffers = class->buffer_size < BUFFER_POOL_SLAB_SIZE ? BUFFER_POOL_SLAB_SIZE / class->buffer_size : 1;
+    struct BufferPoolSlab *slab = malloc(sizeof(*slab) + nbuffers * class->buffer_size);
+    if (!slab) {
+        return false;
+    }
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    class->nslabs++;
+
+    for (size_t i = nbuffers; i > 0; i--) {
+        struct BufferPoolFree *buffer = (struct BufferPoolFree *)&slab->data[(i - 1) * class->buffer_size];
+        buffer->next = class->free_list;
+        class->free_list = buffer;
+    }
+    class->nfree += nbuffers;
+    return true;
+}
+
+char *buffer_pool_acquire(struct BufferPool *pool, const size_t min_size, size_t *out_size)
+{
+    struct BufferPoolClass *class = NULL;
+    for (size_t i = 0; i < BUFFER_POOL_NCLASSES && !class; i++) {
+        if (pool->classes[i].buffer_size >= min_size) {
+            class = &pool->classes[i];
+        }
+    }
+    if (!class) {
+        errno = ERANGE;
+        return NULL;
+    }
+    if (!class->free_list && !pool_add_slab(pool, class)) {
+        return NULL;
+    }
+
+    struct BufferPoolFree *buffer = class->free_list;
+    class->free_list = buffer->next;
+    class->nfree--;
+    class->nused++;
+    class->nacquires++;
+    if (class->nused > class->peak_nused) {
+        class->peak_nused = class->nused;
+    }
+    *out_size = class->buffer_size;
+    return (char *)buffer;
+}
+
+void buffer_pool_release(struct BufferPool *pool, char *buf, const size_t size)
+{
+    for (size_t i = 0; i < BUFFER_POOL_NCLASSES; i++) {
+        struct BufferPoolClass *class = &pool->classes[i];
+        if (class->buffer_size == size) {
+            struct BufferPoolFree *buffer = (struct BufferPoolFree *)buf;
+            buffer->next = class->free_list;
+            class->free_list = buffer;
+            class->nfree++;
+            class->nused--;
+            return;
+        }
+    }
+}
+
+void buffer_pool_occupancy(const struct BufferPool *pool, size_t *out_nbytes_used, size_t *out_nbytes_total)
+{
+    *out_nbytes_used = *out_nbytes_total = 0;
+    for (size_t i = 0; i < BUFFER_POOL_NCLASSES; i++) {
+        const struct BufferPoolClass *class = &pool->classes[i];
+        *out_nbytes_used += class->nused * class->buffer_size;
+        *out_nbytes_total += (class->nused + class->nfree) * class->buffer_size;
+    }
+}
+
+char *buffer_pool_format_stats(const struct BufferPool *pool, const size_t buf_size, char *out_buf)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < BUFFER_POOL_NCLASSES && length < buf_size; i++) {
+        const struct BufferPoolClass *class = &pool->classes[i];
+        const int n = snprintf(
+            &out_buf[length],
+            buf_size - length,
+            "%s%zuK: %zu used (peak %zu), %zu free, %zu acquired",
+            i == 0 ? "" : " | ",
+            class->buffer_size >> 10,
+            class->nused,
+            class->peak_nused,
+            class->nfree,
+            class->nacquires);
+        if (n < 0) {
+            break;
+        }
+        length += (size_t)n;
+    }
+    return out_buf;
+}
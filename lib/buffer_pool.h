@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define BUFFER_POOL_NCLASSES  (3)
+#define BUFFER_POOL_SLAB_SIZE ((size_t)64 << 10)
+
+/**
+ * Sizes of the buffers of each class, smallest first. The largest fits the largest header block
+ * (HTTP_REQUEST_MAX_HEADER_BLOCK).
+ */
+static const size_t BUFFER_POOL_CLASS_SIZES[BUFFER_POOL_NCLASSES] = {
+    (size_t)4 << 10,
+    (size_t)16 << 10,
+    (size_t)64 << 10,
+};
+
+struct BufferPoolFree;
+struct BufferPoolSlab;
+
+/**
+ * Buffers of one size, and how many of them are in use.
+ */
+struct BufferPoolClass {
+    size_t buffer_size;               ///< size of the buffers
+    struct BufferPoolFree *free_list; ///< buffers not in use
+    size_t nfree;                     ///< number of buffers not in use
+    size_t nused;                     ///< number of buffers in use
+    size_t peak_nused;                ///< largest number of buffers in use at once
+    size_t nslabs;                    ///< number of slabs carved into buffers of this class
+    size_t nacquires;                 ///< number of buffers handed out
+};
+
+/**
+ * Pool of buffers in a few size classes, e.g. for recieving on connections. Buffers are carved out of slabs, which are
+ * kept until the pool is destroyed, so handing out and giving back buffers costs no system calls once the pool has
+ * grown to its working size. Not thread-safe: give every worker its own pool.
+ */
+struct BufferPool {
+    struct BufferPoolClass classes[BUFFER_POOL_NCLASSES]; ///< buffers of each size, smallest first
+    struct BufferPoolSlab *slabs;                         ///< memory of the buffers
+};
+
+/**
+ * Initiate an empty pool.
+ */
+void buffer_pool_init(struct BufferPool *pool);
+
+/**
+ * Free the slabs of the pool. Buffers still in use are freed too.
+ */
+void buffer_pool_destroy(struct BufferPool *pool);
+
+/**
+ * Get a buffer of the smallest class of at least min_size bytes, or NULL if out of memory (with errno set) or no class
+ * is that large (ERANGE). out_size is set to the size of the buffer.
+ */
+char *buffer_pool_acquire(struct BufferPool *pool, const size_t min_size, size_t *out_size);
+
+/**
+ * Give back a buffer got from buffer_pool_acquire(), with its size.
+ */
+void buffer_pool_release(struct BufferPool *pool, char *buf, const size_t size);
+
+/**
+ * Get the number of bytes of the buffers in use, and of all buffers carved out of slabs.
+ */
+void buffer_pool_occupancy(const struct BufferPool *pool, size_t *out_nbytes_used, size_t *out_nbytes_total);
+
+/**
+ * Format the occupancy of every class on a single line, e.g. for logging. Returns out_buf.
+ */
+char *buffer_pool_format_stats(const struct BufferPool *pool, const size_t buf_size, char *out_buf);
@@ -1,6 +1,7 @@
 #include "connection.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -50,6 +51,18 @@ Error_t bind_socket_(const ErrorInfo_t ei, const int fd, const struct addrinfo *
     return NO_ERRORS;
 }
 
+Error_t bind_socket_reuseport_(const ErrorInfo_t ei, const int fd, const struct addrinfo *addrinfo)
+{
+    RETURN_IF_NULL(ei, addrinfo);
+
+    const int optval = 1;
+    const socklen_t optlen = sizeof(optval);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, optlen) == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return bind_socket_(ei, fd, addrinfo);
+}
+
 Error_t listen_socket_(const ErrorInfo_t ei, const int fd, const int backlog)
 {
     if (listen(fd, backlog) == -1) {
@@ -57,3 +70,15 @@ Error_t listen_socket_(const ErrorInfo_t ei, const int fd, const int backlog)
     }
     return NO_ERRORS;
 }
+
+Error_t set_socket_nonblocking_(const ErrorInfo_t ei, const int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return NO_ERRORS;
+}
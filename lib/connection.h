@@ -25,13 +25,26 @@ Error_t connect_socket_(const ErrorInfo_t ei, const int fd, const struct addrinf
  */
 Error_t bind_socket_(const ErrorInfo_t ei, const int fd, const struct addrinfo *addrinfo);
 
+/**
+ * Try binding (a server) to a port (a part of addrinfo), allowing other sockets to bind to the same port. The kernel
+ * load-balances incoming connections between the sockets.
+ */
+Error_t bind_socket_reuseport_(const ErrorInfo_t ei, const int fd, const struct addrinfo *addrinfo);
+
 /**
  * Set up port to listen with max incoming connections requests of backlog_size.
  */
 Error_t listen_socket_(const ErrorInfo_t ei, const int fd, const int backlog);
 
-#define open_socket(...)    open_socket_(ERROR_INFO("open_socket"), __VA_ARGS__)
-#define close_socket(...)   close_socket_(ERROR_INFO("close_socket"), __VA_ARGS__)
-#define connect_socket(...) connect_socket_(ERROR_INFO("connect_socket"), __VA_ARGS__)
-#define bind_socket(...)    bind_socket_(ERROR_INFO("bind_socket"), __VA_ARGS__)
-#define listen_socket(...)  listen_socket_(ERROR_INFO("listen_socket"), __VA_ARGS__)
+/**
+ * Make operations on a socket return immediately instead of blocking.
+ */
+Error_t set_socket_nonblocking_(const ErrorInfo_t ei, const int fd);
+
+#define open_socket(...)            open_socket_(ERROR_INFO("open_socket"), __VA_ARGS__)
+#define close_socket(...)           close_socket_(ERROR_INFO("close_socket"), __VA_ARGS__)
+#define connect_socket(...)         connect_socket_(ERROR_INFO("connect_socket"), __VA_ARGS__)
+#define bind_socket(...)            bind_socket_(ERROR_INFO("bind_socket"), __VA_ARGS__)
+#define bind_socket_reuseport(...)  bind_socket_reuseport_(ERROR_INFO("bind_socket_reuseport"), __VA_ARGS__)
+#define listen_socket(...)          listen_socket_(ERROR_INFO("listen_socket"), __VA_ARGS__)
+#define set_socket_nonblocking(...) set_socket_nonblocking_(ERROR_INFO("set_socket_nonblocking"), __VA_ARGS__)
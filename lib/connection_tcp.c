@@ -1,9 +1,12 @@
+#define _GNU_SOURCE // accept4
+
 #include "connection_tcp.h"
 #include "address.h"
 #include "connection.h"
 
 #include <errno.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <string.h>
 #include <sys/sendfile.h>
@@ -72,14 +75,19 @@ Error_t open_tcp_client_(const ErrorInfo_t ei, const char *hostname, const char
     }
 }
 
-Error_t open_tcp_server_(const ErrorInfo_t ei, const int backlog_size, const char *port, int *out_server_fd)
+static Error_t open_tcp_server_with_bind_func(
+    const ErrorInfo_t ei,
+    Error_t (*bind_func)(const ErrorInfo_t ei, const int, const struct addrinfo *),
+    const int backlog_size,
+    const char *port,
+    int *out_server_fd)
 {
     RETURN_IF_NULL(ei, out_server_fd);
     *out_server_fd = -1;
 
     struct get_first_successfull_args func_args = {
         .ei = ei,
-        .func = bind_socket_,
+        .func = bind_func,
         .return_error = NO_ERRORS,
         .out_fd = out_server_fd,
     };
@@ -108,6 +116,16 @@ Error_t open_tcp_server_(const ErrorInfo_t ei, const int backlog_size, const cha
     }
 }
 
+Error_t open_tcp_server_(const ErrorInfo_t ei, const int backlog_size, const char *port, int *out_server_fd)
+{
+    return open_tcp_server_with_bind_func(ei, bind_socket_, backlog_size, port, out_server_fd);
+}
+
+Error_t open_tcp_server_reuseport_(const ErrorInfo_t ei, const int backlog_size, const char *port, int *out_server_fd)
+{
+    return open_tcp_server_with_bind_func(ei, bind_socket_reuseport_, backlog_size, port, out_server_fd);
+}
+
 Error_t open_tcp_client_connection_(const ErrorInfo_t ei, const int server_fd, int *out_conn_fd)
 {
     RETURN_IF_NULL(ei, out_conn_fd);
@@ -118,6 +136,23 @@ Error_t open_tcp_client_connection_(const ErrorInfo_t ei, const int server_fd, i
     return NO_ERRORS;
 }
 
+Error_t open_tcp_client_connection_nonblocking_(const ErrorInfo_t ei, const int server_fd, int *out_conn_fd)
+{
+    RETURN_IF_NULL(ei, out_conn_fd);
+
+    while ((*out_conn_fd = accept4(server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) == -1) {
+        if (errno == EINTR) {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // no pending connections.
+            return NO_ERRORS;
+        }
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return NO_ERRORS;
+}
+
 Error_t
 bytes_sendall_(const ErrorInfo_t ei, const int flags, const int conn_fd, const size_t nbytes, const char *inp_buf)
 {
@@ -150,17 +185,70 @@ bytes_sendall_(const ErrorInfo_t ei, const int flags, const int conn_fd, const s
     return NO_ERRORS;
 }
 
-/**
- * Send a file
- */
-Error_t bytes_sendfile_(const ErrorInfo_t ei, const int conn_fd, const int file_fd, size_t max_file_size)
+// largest number of bytes sendfile() transfers in one call.
+#define SENDFILE_MAX_CHUNK ((size_t)0x7ffff000)
+
+Error_t bytes_sendfile_nonblocking_(
+    const ErrorInfo_t ei,
+    const int conn_fd,
+    const int file_fd,
+    off_t *inout_offset,
+    const size_t nbytes,
+    size_t *out_nsent,
+    bool *out_would_block)
 {
-    if (sendfile(conn_fd, file_fd, NULL, max_file_size) == -1) {
-        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    RETURN_IF_NULL(ei, inout_offset);
+    RETURN_IF_NULL(ei, out_nsent);
+    RETURN_IF_NULL(ei, out_would_block);
+
+    *out_nsent = 0;
+    *out_would_block = false;
+
+    while (*out_nsent < nbytes) {
+        const size_t nleft = nbytes - *out_nsent;
+        // sendfile() advances the offset by the number of bytes sent.
+        const ssize_t retval =
+            sendfile(conn_fd, file_fd, inout_offset, nleft < SENDFILE_MAX_CHUNK ? nleft : SENDFILE_MAX_CHUNK);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                *out_would_block = true;
+                return NO_ERRORS;
+            }
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        else if (retval == 0) {
+            return error_format_location(
+                ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "file ended before expected"});
+        }
+        *out_nsent += (size_t)retval;
     }
     return NO_ERRORS;
 }
 
+Error_t bytes_sendfile_(
+    const ErrorInfo_t ei,
+    const int conn_fd,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    size_t *out_nsent)
+{
+    RETURN_IF_NULL(ei, out_nsent);
+
+    off_t curr_offset = offset;
+    bool would_block = false;
+    const Error_t error =
+        bytes_sendfile_nonblocking_(ei, conn_fd, file_fd, &curr_offset, nbytes, out_nsent, &would_block);
+    if (error.tag == ERROR_NONE && would_block) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "socket would block, use bytes_sendfile_nonblocking()"});
+    }
+    return error;
+}
+
 void buffered_reader_init_(
     const int recv_flags, struct BufferedReader *reader, const int conn_fd, const size_t max_msg_len, char *msgbuf)
 {
@@ -174,11 +262,88 @@ void buffered_reader_init_(
     reader->nleft = 0;
 }
 
+void buffered_reader_swap_buffer(struct BufferedReader *reader, const size_t max_msg_len, char *msgbuf)
+{
+    assert(reader->nleft <= max_msg_len);
+
+    if (reader->nleft > 0) {
+        memcpy(msgbuf, reader->curr, reader->nleft);
+    }
+    reader->max_msg_len = max_msg_len;
+    reader->msgbuf = reader->curr = msgbuf;
+}
+
 void buffered_reader_flush(struct BufferedReader *reader)
 {
     reader->nleft = 0;
 }
 
+size_t buffered_reader_append(struct BufferedReader *reader, const size_t nbytes, const char *buf)
+{
+    if (reader->curr != reader->msgbuf) {
+        memmove(reader->msgbuf, reader->curr, reader->nleft);
+        reader->curr = reader->msgbuf;
+    }
+    const size_t nroom = reader->max_msg_len - reader->nleft;
+    const size_t ncopied = nbytes < nroom ? nbytes : nroom;
+    memcpy(&reader->msgbuf[reader->nleft], buf, ncopied);
+    reader->nleft += ncopied;
+    return ncopied;
+}
+
+Error_t buffered_reader_fill_(const ErrorInfo_t ei, struct BufferedReader *reader, size_t *out_nread, bool *out_eof)
+{
+    RETURN_IF_NULL(ei, reader);
+    RETURN_IF_NULL(ei, out_nread);
+    RETURN_IF_NULL(ei, out_eof);
+
+    *out_nread = 0;
+    *out_eof = false;
+
+    // move the bytes not read yet to the front, so the rest of the buffer can be filled.
+    if (reader->curr != reader->msgbuf) {
+        memmove(reader->msgbuf, reader->curr, reader->nleft);
+        reader->curr = reader->msgbuf;
+    }
+
+    while (reader->nleft < reader->max_msg_len) {
+        const ssize_t retval = recv(
+            reader->conn_fd, &reader->msgbuf[reader->nleft], reader->max_msg_len - reader->nleft, reader->recv_flags);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        else if (retval == 0) {
+            *out_eof = true;
+            break;
+        }
+        reader->nleft += (size_t)retval;
+        *out_nread += (size_t)retval;
+    }
+    return NO_ERRORS;
+}
+
+strview_t buffered_reader_view(const struct BufferedReader *reader)
+{
+    return (strview_t){.length = reader->nleft, .buf = (const uint8_t *)reader->curr};
+}
+
+void buffered_reader_consume(struct BufferedReader *reader, const size_t nbytes)
+{
+    assert(nbytes <= reader->nleft);
+
+    reader->curr += nbytes;
+    reader->nleft -= nbytes;
+    if (reader->nleft == 0) {
+        reader->curr = reader->msgbuf;
+    }
+}
+
 static Error_t bytes_recv_unbuffered_(
     const ErrorInfo_t ei,
     const int flags,
@@ -271,6 +436,33 @@ bytes_recvn_(const ErrorInfo_t ei, struct BufferedReader *reader, const size_t n
     return NO_ERRORS;
 }
 
+/**
+ * Recieve more bytes after the bytes not read yet, blocking if the socket is blocking.
+ */
+static Error_t buffered_reader_recv_more(const ErrorInfo_t ei, struct BufferedReader *reader, size_t *out_nread)
+{
+    if (reader->curr != reader->msgbuf) {
+        memmove(reader->msgbuf, reader->curr, reader->nleft);
+        reader->curr = reader->msgbuf;
+    }
+    if (reader->nleft == reader->max_msg_len) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "message does not fit in the buffer!"});
+    }
+    const Error_t error = bytes_recv_unbuffered_(
+        ei,
+        reader->recv_flags,
+        reader->conn_fd,
+        reader->max_msg_len - reader->nleft,
+        &reader->msgbuf[reader->nleft],
+        out_nread);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+    reader->nleft += *out_nread;
+    return NO_ERRORS;
+}
+
 Error_t bytes_recvline_(
     const ErrorInfo_t ei, struct BufferedReader *reader, const size_t max_len, char *out_buf, size_t *out_len)
 {
@@ -278,27 +470,239 @@ Error_t bytes_recvline_(
     RETURN_IF_NULL(ei, out_buf);
     RETURN_IF_NULL(ei, out_len);
 
-    char c = '\0';
-    size_t len = 1;
-    for (; len < max_len; len++) {
+    // copy the buffered bytes up to the newline in one go, rather than one byte at a time.
+    size_t len = 0;
+    bool found_newline = false;
+    while (!found_newline && len + 1 < max_len) {
+        if (reader->nleft == 0) {
+            size_t nread = 0;
+            const Error_t error = buffered_reader_recv_more(ei, reader, &nread);
+            if (error.tag != ERROR_NONE) {
+                return error;
+            }
+            else if (nread == 0) {
+                // EOF
+                break;
+            }
+        }
+        const size_t max_ncopy = MIN(reader->nleft, max_len - 1 - len);
+        const char *newline = memchr(reader->curr, '\n', max_ncopy);
+        const size_t ncopy = newline ? (size_t)(newline - reader->curr) + 1 : max_ncopy;
+
+        memcpy(&out_buf[len], reader->curr, ncopy);
+        buffered_reader_consume(reader, ncopy);
+        len += ncopy;
+        found_newline = newline != NULL;
+    }
+    out_buf[len] = '\0';
+    *out_len = len;
+    return NO_ERRORS;
+}
+
+/**
+ * Recieve bytes until the delimiter found by find_func is buffered, and view the bytes up to and including it.
+ */
+static Error_t bytes_recv_until_view(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    bool (*find_func)(const strview_t s, strview_t *out),
+    const size_t delim_len,
+    strview_t *out_view)
+{
+    RETURN_IF_NULL(ei, reader);
+    RETURN_IF_NULL(ei, out_view);
+
+    // number of bytes already searched, so they are not searched again after recieving more.
+    size_t nsearched = 0;
+    while (true) {
+        const strview_t buffered = buffered_reader_view(reader);
+        const size_t start = nsearched >= delim_len - 1 ? nsearched - (delim_len - 1) : 0;
+
+        strview_t delim = STRVIEW_EMPTY;
+        if (find_func(strview_drop(buffered, start), &delim)) {
+            const size_t len = (size_t)(delim.buf - buffered.buf) + delim_len;
+            *out_view = strview_take(buffered, len);
+            buffered_reader_consume(reader, len);
+            return NO_ERRORS;
+        }
+        nsearched = buffered.length;
+
         size_t nread = 0;
-        const Error_t error = bytes_recv_buffered(ei, reader, 1, &c, &nread);
+        const Error_t error = buffered_reader_recv_more(ei, reader, &nread);
         if (error.tag != ERROR_NONE) {
             return error;
         }
         else if (nread == 0) {
             // EOF
-            break;
+            *out_view = STRVIEW_EMPTY;
+            return NO_ERRORS;
+        }
+    }
+}
+
+Error_t bytes_recvline_view_(const ErrorInfo_t ei, struct BufferedReader *reader, strview_t *out_line)
+{
+    return bytes_recv_until_view(ei, reader, strview_find_crlf, 2, out_line);
+}
+
+Error_t bytes_recv_header_block_(const ErrorInfo_t ei, struct BufferedReader *reader, strview_t *out_block)
+{
+    return bytes_recv_until_view(ei, reader, strview_find_header_end, 4, out_block);
+}
+
+Error_t bytes_recv_chunked_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    struct HTTPChunkedDecoder *decoder,
+    strview_t *out_data,
+    bool *out_done)
+{
+    RETURN_IF_NULL(ei, reader);
+    RETURN_IF_NULL(ei, decoder);
+    RETURN_IF_NULL(ei, out_data);
+    RETURN_IF_NULL(ei, out_done);
+
+    while (true) {
+        size_t nconsumed = 0;
+        const Error_t error =
+            http_chunked_decode_(ei, decoder, buffered_reader_view(reader), &nconsumed, out_data, out_done);
+        if (error.tag != ERROR_NONE) {
+            return error;
+        }
+        // the decoded bytes are marked read, but stay in the buffer until the next recieve.
+        buffered_reader_consume(reader, nconsumed);
+        if (out_data->length > 0 || *out_done) {
+            return NO_ERRORS;
+        }
+
+        size_t nread = 0;
+        const Error_t recv_error = buffered_reader_recv_more(ei, reader, &nread);
+        if (recv_error.tag != ERROR_NONE) {
+            return recv_error;
+        }
+        else if (nread == 0) {
+            return error_format_location(
+                ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "connection closed before the end of the body"});
+        }
+    }
+}
+
+Error_t bytes_recv_body_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    struct HTTPBodyReader *body,
+    strview_t *out_data,
+    bool *out_done)
+{
+    RETURN_IF_NULL(ei, reader);
+    RETURN_IF_NULL(ei, body);
+    RETURN_IF_NULL(ei, out_data);
+    RETURN_IF_NULL(ei, out_done);
+
+    while (true) {
+        size_t nconsumed = 0;
+        const Error_t error = http_body_read_(ei, body, buffered_reader_view(reader), &nconsumed, out_data, out_done);
+        if (error.tag != ERROR_NONE) {
+            return error;
+        }
+        buffered_reader_consume(reader, nconsumed);
+        if (out_data->length > 0 || *out_done) {
+            return NO_ERRORS;
+        }
+
+        size_t nread = 0;
+        const Error_t recv_error = buffered_reader_recv_more(ei, reader, &nread);
+        if (recv_error.tag != ERROR_NONE) {
+            return recv_error;
+        }
+        else if (nread == 0) {
+            return error_format_location(
+                ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "connection closed before the end of the body"});
         }
-        else {
-            *out_buf++ = c;
-            if (c == '\n') {
-                len++;
+    }
+}
+
+// largest number of bytes moved through the pipe in one splice() call, and the size of the pipe asked for.
+#define SPLICE_MAX_CHUNK ((size_t)1 << 20)
+
+Error_t bytes_splice_to_file_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    size_t *out_nwritten)
+{
+    RETURN_IF_NULL(ei, reader);
+    RETURN_IF_NULL(ei, out_nwritten);
+
+    *out_nwritten = 0;
+    off_t curr_offset = offset;
+
+    // the bytes recieved already are in the buffer of the reader:
+    const size_t nbuffered = MIN(reader->nleft, nbytes);
+    while (*out_nwritten < nbuffered) {
+        const ssize_t retval = pwrite(file_fd, &reader->curr[*out_nwritten], nbuffered - *out_nwritten, curr_offset);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        *out_nwritten += (size_t)retval;
+        curr_offset += retval;
+    }
+    buffered_reader_consume(reader, nbuffered);
+    if (*out_nwritten == nbytes) {
+        return NO_ERRORS;
+    }
+
+    int pipe_fds[2] = {-1, -1};
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    // a larger pipe moves more bytes per call. the default size still works, so failing is fine.
+    (void)fcntl(pipe_fds[1], F_SETPIPE_SZ, (int)SPLICE_MAX_CHUNK);
+
+    Error_t error = NO_ERRORS;
+    size_t npiped = 0; // bytes in the pipe not written to the file yet
+    while (*out_nwritten < nbytes) {
+        if (npiped == 0) {
+            const size_t nleft = nbytes - *out_nwritten;
+            const ssize_t retval = splice(
+                reader->conn_fd, NULL, pipe_fds[1], NULL, MIN(nleft, SPLICE_MAX_CHUNK), SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (retval < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                error = error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+                break;
+            }
+            else if (retval == 0) {
+                error = error_format_location(
+                    ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "connection closed before the end of the body"});
                 break;
             }
+            npiped = (size_t)retval;
         }
+        // splice() advances the offset by the number of bytes written.
+        const ssize_t retval = splice(pipe_fds[0], NULL, file_fd, &curr_offset, npiped, SPLICE_F_MOVE);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+            break;
+        }
+        else if (retval == 0) {
+            error = error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "file not written to"});
+            break;
+        }
+        npiped -= (size_t)retval;
+        *out_nwritten += (size_t)retval;
     }
-    *out_buf = '\0';
-    *out_len = len - 1;
-    return NO_ERRORS;
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return error;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "error.h"
+#include "message.h"
+#include "types/strview.h"
 
 #include <stdbool.h>
 
@@ -14,11 +16,23 @@ Error_t open_tcp_client_(const ErrorInfo_t ei, const char *hostname, const char
  */
 Error_t open_tcp_server_(const ErrorInfo_t ei, const int backlog_size, const char *port, int *out_server_fd);
 
+/**
+ * Open a tcp server socket sharing its port with other sockets opened this way. The kernel load-balances incoming
+ * connections between the sockets.
+ */
+Error_t open_tcp_server_reuseport_(const ErrorInfo_t ei, const int backlog_size, const char *port, int *out_server_fd);
+
 /**
  * Open a tcp client connection socket from the server.
  */
 Error_t open_tcp_client_connection_(const ErrorInfo_t ei, const int server_fd, int *out_conn_fd);
 
+/**
+ * Open a non-blocking tcp client connection socket from a non-blocking server socket. out_conn_fd is set to -1 if
+ * there are no pending connections.
+ */
+Error_t open_tcp_client_connection_nonblocking_(const ErrorInfo_t ei, const int server_fd, int *out_conn_fd);
+
 /**
  * Send a stream of bytes.
  */
@@ -26,9 +40,30 @@ Error_t
 bytes_sendall_(const ErrorInfo_t ei, const int flags, const int conn_fd, const size_t nbytes, const char *inp_buf);
 
 /**
- * Send a file
+ * Send nbytes of a file starting at offset, retrying short writes until done. Files of any size are sent in chunks.
+ * out_nsent is set to the number of bytes sent, also on errors.
  */
-Error_t bytes_sendfile_(const ErrorInfo_t ei, const int conn_fd, const int file_fd, size_t max_file_size);
+Error_t bytes_sendfile_(
+    const ErrorInfo_t ei,
+    const int conn_fd,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    size_t *out_nsent);
+
+/**
+ * Send up to nbytes of a file to a non-blocking socket, starting at and advancing *inout_offset, until done or the
+ * socket would block. out_nsent is set to the number of bytes sent, so the caller can resume once the socket is
+ * writable again.
+ */
+Error_t bytes_sendfile_nonblocking_(
+    const ErrorInfo_t ei,
+    const int conn_fd,
+    const int file_fd,
+    off_t *inout_offset,
+    const size_t nbytes,
+    size_t *out_nsent,
+    bool *out_would_block);
 
 /**
  * Buffered reader
@@ -48,11 +83,39 @@ struct BufferedReader {
 void buffered_reader_init_(
     const int recv_flags, struct BufferedReader *reader, const int conn_fd, const size_t max_msg_len, char *msgbuf);
 
+/**
+ * Replace the underlying buffer, e.g. to grow it, or to give it back while no bytes are left to read. The bytes not
+ * read yet are moved to the front of the new buffer, and must fit in it.
+ */
+void buffered_reader_swap_buffer(struct BufferedReader *reader, const size_t max_msg_len, char *msgbuf);
+
 /**
  * Flush the current the stream of bytes.
  */
 void buffered_reader_flush(struct BufferedReader *reader);
 
+/**
+ * Recieve as many bytes as fits in the buffer from a non-blocking socket, keeping the bytes not read yet. Stops
+ * when the buffer is full or no more bytes are available. out_eof is set if the peer has closed the connection.
+ */
+Error_t buffered_reader_fill_(const ErrorInfo_t ei, struct BufferedReader *reader, size_t *out_nread, bool *out_eof);
+
+/**
+ * Append bytes recieved by other means, e.g. completions of io_uring, keeping the bytes not read yet. Returns the
+ * number of bytes that fit in the buffer.
+ */
+size_t buffered_reader_append(struct BufferedReader *reader, const size_t nbytes, const char *buf);
+
+/**
+ * View the bytes not read yet without copying them.
+ */
+strview_t buffered_reader_view(const struct BufferedReader *reader);
+
+/**
+ * Mark some number of the bytes not read yet as read.
+ */
+void buffered_reader_consume(struct BufferedReader *reader, const size_t nbytes);
+
 /**
  * Recvieve some number of bytes from a buffered stream of bytes.
  */
@@ -65,13 +128,79 @@ Error_t bytes_recvn_(
 Error_t bytes_recvline_(
     const ErrorInfo_t ei, struct BufferedReader *reader, const size_t max_len, char *out_buf, size_t *out_len);
 
+/**
+ * Recvieve a line ending with CRLF from a buffered stream of bytes, without copying it. The line includes the CRLF,
+ * and is empty on EOF. The line is valid until the next recieve from the reader.
+ */
+Error_t bytes_recvline_view_(const ErrorInfo_t ei, struct BufferedReader *reader, strview_t *out_line);
+
+/**
+ * Recvieve a header block (request line / status line and headers) ending with an empty line from a buffered stream
+ * of bytes, without copying it. The block includes the empty line, and is empty on EOF. The block is valid until the
+ * next recieve from the reader.
+ */
+Error_t bytes_recv_header_block_(const ErrorInfo_t ei, struct BufferedReader *reader, strview_t *out_block);
+
+/**
+ * Recieve the next part of a body in chunked transfer coding from a buffered stream of bytes, without copying it. The
+ * data is empty with out_done set once the body ends. The data is valid until the next recieve from the reader, so
+ * bodies of any size are recieved in the memory of the reader.
+ */
+Error_t bytes_recv_chunked_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    struct HTTPChunkedDecoder *decoder,
+    strview_t *out_data,
+    bool *out_done);
+
+/**
+ * Recieve the next part of the body of a request from a buffered stream of bytes, without copying it, as for
+ * bytes_recv_chunked(). The body reader decides how the body ends, and how large it may be.
+ */
+Error_t bytes_recv_body_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    struct HTTPBodyReader *body,
+    strview_t *out_data,
+    bool *out_done);
+
+/**
+ * Recieve nbytes from a buffered stream of bytes into a file starting at offset, e.g. the body of an upload given by
+ * its Content-Length. The bytes already in the reader are written first. The rest is moved from the socket to the file
+ * with splice() through a pipe, without copying it into user space. The file must not be opened with O_APPEND.
+ * out_nwritten is set to the number of bytes written, also on errors.
+ *
+ * The socket must be blocking, as for bytes_sendfile(): on a non-blocking socket, e.g. of an event loop, splice()
+ * fails with EAGAIN once the recieved bytes run out. Connections of an event loop recieve bodies with
+ * connection_begin_body() instead.
+ */
+Error_t bytes_splice_to_file_(
+    const ErrorInfo_t ei,
+    struct BufferedReader *reader,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    size_t *out_nwritten);
+
 #define open_tcp_client(...)              open_tcp_client_(ERROR_INFO("open_tcp_client"), __VA_ARGS__)
 #define open_tcp_server(...)              open_tcp_server_(ERROR_INFO("open_tcp_server"), 20, __VA_ARGS__)
 #define open_tcp_server_with_backlog(...) open_tcp_server_(ERROR_INFO("open_tcp_server_with_backlog"), __VA_ARGS__)
+#define open_tcp_server_reuseport(...) \
+    open_tcp_server_reuseport_(ERROR_INFO("open_tcp_server_reuseport"), __VA_ARGS__)
 #define open_tcp_client_connection(...) \
     open_tcp_client_connection_(ERROR_INFO("open_tcp_client_connection"), __VA_ARGS__)
-#define bytes_sendall(...)        bytes_sendall_(ERROR_INFO("bytes_sendall"), 0, __VA_ARGS__)
-#define bytes_sendfile(...)       bytes_sendfile_(ERROR_INFO("bytes_sendfile"), __VA_ARGS__)
-#define bytes_recvn(...)          bytes_recvn_(ERROR_INFO("bytes_recvn"), __VA_ARGS__)
-#define bytes_recvline(...)       bytes_recvline_(ERROR_INFO("bytes_recvline"), __VA_ARGS__)
-#define buffered_reader_init(...) buffered_reader_init_(0, __VA_ARGS__)
+#define open_tcp_client_connection_nonblocking(...) \
+    open_tcp_client_connection_nonblocking_(ERROR_INFO("open_tcp_client_connection_nonblocking"), __VA_ARGS__)
+#define bytes_sendall(...)           bytes_sendall_(ERROR_INFO("bytes_sendall"), 0, __VA_ARGS__)
+#define bytes_sendfile(...)          bytes_sendfile_(ERROR_INFO("bytes_sendfile"), __VA_ARGS__)
+#define bytes_sendfile_nonblocking(...) \
+    bytes_sendfile_nonblocking_(ERROR_INFO("bytes_sendfile_nonblocking"), __VA_ARGS__)
+#define bytes_recvn(...)             bytes_recvn_(ERROR_INFO("bytes_recvn"), __VA_ARGS__)
+#define bytes_recvline(...)          bytes_recvline_(ERROR_INFO("bytes_recvline"), __VA_ARGS__)
+#define bytes_recvline_view(...)     bytes_recvline_view_(ERROR_INFO("bytes_recvline_view"), __VA_ARGS__)
+#define bytes_recv_header_block(...) bytes_recv_header_block_(ERROR_INFO("bytes_recv_header_block"), __VA_ARGS__)
+#define bytes_recv_chunked(...)      bytes_recv_chunked_(ERROR_INFO("bytes_recv_chunked"), __VA_ARGS__)
+#define bytes_recv_body(...)         bytes_recv_body_(ERROR_INFO("bytes_recv_body"), __VA_ARGS__)
+#define bytes_splice_to_file(...)    bytes_splice_to_file_(ERROR_INFO("bytes_splice_to_file"), __VA_ARGS__)
+#define buffered_reader_init(...)    buffered_reader_init_(0, __VA_ARGS__)
+#define buffered_reader_fill(...)    buffered_reader_fill_(ERROR_INFO("buffered_reader_fill"), __VA_ARGS__)
@@ -0,0 +1,1596 @@
+#define _GNU_SOURCE // pipe2, splice
+
+#include "event_loop.h"
+#include "connection.h"
+#include "connection_tcp.h"
+#include "uring.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// based on:
+// https://man7.org/linux/man-pages/man7/epoll.7.html
+//
+// connections are registered once for both reading and writing in edge-triggered mode. every event on a connection
+// drives its state machine, which reads / writes until the socket would block, so no events are missed.
+//
+// output is queued as a list of segments. runs of in-memory segments are sent with a single sendmsg(), and file
+// segments with sendfile().
+//
+// connections hold a recieve buffer from the pool of the loop only while they have bytes not handled yet, so idle
+// keep-alive connections cost no more than their struct. a request not fitting in its buffer moves to a buffer of the
+// next size class.
+//
+// the epoll data of the server socket is NULL, and that of watched file handles is their index in the loop plus one,
+// which no connection pointer can be.
+//
+// connections are kept in a list ordered by their last activity, so idle connections are found at the end of the
+// list without scanning every connection.
+
+#define MIN(a, b) (((a) <= (b)) ? (a) : (b))
+
+#ifdef HAVE_IO_URING
+static Error_t uring_connection_open(struct EventLoop *loop, struct Connection *conn);
+static void uring_connection_close(struct EventLoop *loop, struct Connection *conn);
+#endif
+
+static void report_error(const struct EventLoop *loop, const Error_t error)
+{
+    if (loop->handler.on_error) {
+        loop->handler.on_error(loop->handler.arg, error);
+    }
+}
+
+static uint64_t get_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void connection_unlink(struct EventLoop *loop, struct Connection *conn)
+{
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    }
+    else {
+        loop->connections = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    else {
+        loop->oldest = conn->prev;
+    }
+    conn->prev = conn->next = NULL;
+}
+
+static void connection_push_front(struct EventLoop *loop, struct Connection *conn)
+{
+    conn->prev = NULL;
+    conn->next = loop->connections;
+    if (loop->connections) {
+        loop->connections->prev = conn;
+    }
+    else {
+        loop->oldest = conn;
+    }
+    loop->connections = conn;
+}
+
+static void connection_touch(struct EventLoop *loop, struct Connection *conn)
+{
+    conn->last_active_ms = loop->now_ms;
+    if (loop->connections != conn) {
+        connection_unlink(loop, conn);
+        connection_push_front(loop, conn);
+    }
+}
+
+static bool connection_has_output(const struct Connection *conn)
+{
+    return conn->first_segment < conn->nsegments;
+}
+
+/**
+ * Release the resources of a segment once it is sent, or dropped.
+ */
+static void segment_release(struct OutputSegment *segment)
+{
+    if (segment->kind == OUTPUT_SEGMENT_FILE && segment->close_file) {
+        close(segment->file_fd);
+    }
+    if (segment->release) {
+        segment->release(segment->release_arg);
+    }
+}
+
+/**
+ * Attach a recieve buffer to a connection, unless it has one already.
+ */
+static Error_t connection_attach_buffer(struct EventLoop *loop, struct Connection *conn)
+{
+    if (conn->reader.msgbuf) {
+        return NO_ERRORS;
+    }
+    size_t size = 0;
+    char *buf = buffer_pool_acquire(&loop->buffers, 0, &size);
+    if (!buf) {
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    buffered_reader_swap_buffer(&conn->reader, size, buf);
+    return NO_ERRORS;
+}
+
+/**
+ * Give the recieve buffer of a connection back to the pool once every byte in it is handled.
+ */
+static void connection_detach_buffer(struct EventLoop *loop, struct Connection *conn)
+{
+    if (!conn->reader.msgbuf || conn->reader.nleft > 0) {
+        return;
+    }
+    char *buf = conn->reader.msgbuf;
+    const size_t size = conn->reader.max_msg_len;
+    buffered_reader_swap_buffer(&conn->reader, 0, NULL);
+    buffer_pool_release(&loop->buffers, buf, size);
+}
+
+/**
+ * Move the bytes of a connection to a buffer of the next size class. Fails at the largest size class.
+ */
+static bool connection_grow_buffer(struct EventLoop *loop, struct Connection *conn)
+{
+    char *buf = conn->reader.msgbuf;
+    const size_t size = conn->reader.max_msg_len;
+    size_t new_size = 0;
+    char *new_buf = buffer_pool_acquire(&loop->buffers, size + 1, &new_size);
+    if (!new_buf) {
+        return false;
+    }
+    buffered_reader_swap_buffer(&conn->reader, new_size, new_buf);
+    buffer_pool_release(&loop->buffers, buf, size);
+    return true;
+}
+
+static void connection_free(struct EventLoop *loop, struct Connection *conn)
+{
+    // closing the socket removes it from the epoll instance.
+    const Error_t close_error = close_socket(conn->conn_fd);
+    if (close_error.tag != ERROR_NONE) {
+        report_error(loop, close_error);
+    }
+    for (size_t i = conn->first_segment; i < conn->nsegments; i++) {
+        segment_release(&conn->segments[i]);
+    }
+    free(conn->segments);
+    strdyn_free(conn->outbuf);
+    buffered_reader_flush(&conn->reader);
+    connection_detach_buffer(loop, conn);
+    free(conn);
+}
+
+static void connection_close(struct EventLoop *loop, struct Connection *conn)
+{
+    connection_unlink(loop, conn);
+    loop->nconnections--;
+
+#ifdef HAVE_IO_URING
+    if (conn->uring) {
+        // freed once the operations in flight on the connection have ended.
+        uring_connection_close(loop, conn);
+        return;
+    }
+#endif
+    connection_free(loop, conn);
+}
+
+static Error_t connection_open(struct EventLoop *loop, const int conn_fd)
+{
+    struct Connection *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    conn->conn_fd = conn_fd;
+    conn->state = CONNECTION_STATE_READING;
+    conn->nrequests_left =
+        loop->config.max_requests_per_connection == 0 ? SIZE_MAX : loop->config.max_requests_per_connection;
+    conn->last_active_ms = loop->now_ms;
+    conn->reader = (struct BufferedReader){.conn_fd = conn_fd}; // with a buffer once bytes arrive
+    http_request_parser_init(&conn->parser);
+
+    const Error_t error = strdyn_empty(&conn->outbuf);
+    if (error.tag != ERROR_NONE) {
+        free(conn);
+        return error;
+    }
+
+#ifdef HAVE_IO_URING
+    if (loop->uring) {
+        const Error_t uring_error = uring_connection_open(loop, conn);
+        if (uring_error.tag != ERROR_NONE) {
+            strdyn_free(conn->outbuf);
+            free(conn);
+            return uring_error;
+        }
+        connection_push_front(loop, conn);
+        loop->nconnections++;
+        return NO_ERRORS;
+    }
+#endif
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = conn,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, conn_fd, &event) == -1) {
+        const int errno_num = errno;
+        strdyn_free(conn->outbuf);
+        free(conn);
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+
+    connection_push_front(loop, conn);
+    loop->nconnections++;
+    return NO_ERRORS;
+}
+
+static void segment_advance(struct OutputSegment *segment, const size_t nbytes)
+{
+    segment->nbytes -= nbytes;
+    switch (segment->kind) {
+    case OUTPUT_SEGMENT_BYTES:
+        segment->outbuf_offset += nbytes;
+        break;
+    case OUTPUT_SEGMENT_BORROWED:
+        segment->buf += nbytes;
+        break;
+    case OUTPUT_SEGMENT_FILE:
+        // the offset is advanced by bytes_sendfile_nonblocking()
+        break;
+    }
+}
+
+/**
+ * Mark bytes sent from the first segments, releasing the segments sent in full.
+ */
+static void connection_consume_output(struct Connection *conn, size_t nsent)
+{
+    conn->nbytes_sent += nsent;
+    while (nsent > 0) {
+        struct OutputSegment *segment = &conn->segments[conn->first_segment];
+        const size_t n = MIN(nsent, segment->nbytes);
+        segment_advance(segment, n);
+        nsent -= n;
+        if (segment->nbytes == 0) {
+            segment_release(segment);
+            conn->first_segment++;
+        }
+    }
+}
+
+/**
+ * Send a run of in-memory segments with a single system call.
+ */
+static Error_t connection_send_segments(struct Connection *conn, bool *out_would_block)
+{
+    struct iovec iov[EVENT_LOOP_MAX_IOVECS];
+    size_t niov = 0;
+    for (size_t i = conn->first_segment; i < conn->nsegments && niov < EVENT_LOOP_MAX_IOVECS; i++) {
+        const struct OutputSegment *segment = &conn->segments[i];
+        if (segment->kind == OUTPUT_SEGMENT_FILE) {
+            break;
+        }
+        iov[niov++] = (struct iovec){
+            .iov_base = (void *)(segment->kind == OUTPUT_SEGMENT_BYTES ? &conn->outbuf[segment->outbuf_offset]
+                                                                        : segment->buf),
+            .iov_len = segment->nbytes,
+        };
+    }
+
+    const struct msghdr msg = {.msg_iov = iov, .msg_iovlen = niov};
+    ssize_t retval = -1;
+    while ((retval = sendmsg(conn->conn_fd, &msg, MSG_NOSIGNAL)) < 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            *out_would_block = true;
+            return NO_ERRORS;
+        }
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+
+    connection_consume_output(conn, (size_t)retval);
+    return NO_ERRORS;
+}
+
+static Error_t connection_send_file_segment(struct Connection *conn, bool *out_would_block)
+{
+    struct OutputSegment *segment = &conn->segments[conn->first_segment];
+
+    size_t nsent = 0;
+    const Error_t error = bytes_sendfile_nonblocking(
+        conn->conn_fd, segment->file_fd, &segment->file_offset, segment->nbytes, &nsent, out_would_block);
+    segment_advance(segment, nsent);
+    conn->nbytes_sent += nsent;
+    if (error.tag != ERROR_NONE || *out_would_block) {
+        return error;
+    }
+
+    segment_release(segment);
+    conn->first_segment++;
+    return NO_ERRORS;
+}
+
+/**
+ * Send queued output until done or the socket would block.
+ */
+static Error_t connection_flush(struct Connection *conn, bool *out_done)
+{
+    *out_done = false;
+
+    while (connection_has_output(conn)) {
+        bool would_block = false;
+        const Error_t error = conn->segments[conn->first_segment].kind == OUTPUT_SEGMENT_FILE
+                                ? connection_send_file_segment(conn, &would_block)
+                                : connection_send_segments(conn, &would_block);
+        if (error.tag != ERROR_NONE) {
+            return error;
+        }
+        else if (would_block) {
+            return NO_ERRORS;
+        }
+    }
+
+    strdyn_clear(conn->outbuf);
+    conn->first_segment = conn->nsegments = 0;
+    *out_done = true;
+    return NO_ERRORS;
+}
+
+/**
+ * Pass the part of the request body recieved so far to the handler, marking it read.
+ */
+static void connection_feed_body(struct EventLoop *loop, struct Connection *conn)
+{
+    size_t nconsumed = 0;
+    strview_t data = STRVIEW_EMPTY;
+    bool done = false;
+    const Error_t body_error =
+        http_body_read(&conn->body, buffered_reader_view(&conn->reader), &nconsumed, &data, &done);
+    buffered_reader_consume(&conn->reader, nconsumed);
+    if (body_error.tag != ERROR_NONE) {
+        // the end of the body is unknown, so the bytes after it can not be handled.
+        report_error(loop, body_error);
+        conn->reading_body = false;
+        conn->close_after_write = true;
+        done = true;
+    }
+    else if (done) {
+        conn->reading_body = false;
+    }
+    if (loop->handler.on_body && (data.length > 0 || done)) {
+        const Error_t handler_error = loop->handler.on_body(loop->handler.arg, conn, data, done);
+        if (handler_error.tag != ERROR_NONE) {
+            // the rest of the body is left unread, and the handler is not called again.
+            report_error(loop, handler_error);
+            conn->reading_body = false;
+            conn->close_after_write = true;
+        }
+    }
+}
+
+/**
+ * Answer every complete request recieved, before the responses are sent. Closes the connection if a request does not
+ * fit in the reader.
+ */
+static void connection_handle_requests(struct EventLoop *loop, struct Connection *conn)
+{
+    while (conn->reader.nleft > 0 && (conn->reading_body || !conn->close_after_write)) {
+        if (conn->reading_body) {
+            connection_feed_body(loop, conn);
+            continue;
+        }
+        const size_t nleft_before = conn->reader.nleft;
+        const Error_t handler_error = loop->handler.on_data(loop->handler.arg, conn);
+        if (handler_error.tag != ERROR_NONE) {
+            report_error(loop, handler_error);
+            conn->close_after_write = true;
+        }
+        else if (conn->reader.nleft == nleft_before) {
+            // incomplete request.
+            break;
+        }
+    }
+    if (conn->reader.nleft > 0 && conn->reader.nleft == conn->reader.max_msg_len && !connection_has_output(conn)
+        && !conn->close_after_write && !connection_grow_buffer(loop, conn)) {
+        report_error(
+            loop,
+            error_format_location(
+                ERROR_INFO(__func__),
+                (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "request does not fit in the buffer"}));
+        conn->state = CONNECTION_STATE_CLOSING;
+    }
+}
+
+/**
+ * Drive the state machine of a connection until it would block or is closed.
+ */
+static void connection_process(struct EventLoop *loop, struct Connection *conn)
+{
+    // set when bytes left in the reader should be handled without recieving more bytes first.
+    bool resume_handling = false;
+
+    connection_touch(loop, conn);
+
+    while (true) {
+        switch (conn->state) {
+        case CONNECTION_STATE_READING: {
+            const Error_t attach_error = connection_attach_buffer(loop, conn);
+            if (attach_error.tag != ERROR_NONE) {
+                report_error(loop, attach_error);
+                conn->state = CONNECTION_STATE_CLOSING;
+                break;
+            }
+            size_t nread = 0;
+            bool eof = false;
+            const Error_t fill_error = buffered_reader_fill(&conn->reader, &nread, &eof);
+            if (fill_error.tag != ERROR_NONE) {
+                report_error(loop, fill_error);
+                conn->state = CONNECTION_STATE_CLOSING;
+                break;
+            }
+            const bool is_full = conn->reader.nleft == conn->reader.max_msg_len;
+
+            if (conn->reader.nleft > 0 && (nread > 0 || resume_handling)) {
+                connection_handle_requests(loop, conn);
+                if (conn->state == CONNECTION_STATE_CLOSING) {
+                    break;
+                }
+            }
+            resume_handling = false;
+
+            // the rest of a request body is read before closing, as the handler may answer once it is read.
+            if (connection_has_output(conn) || (conn->close_after_write && !conn->reading_body)) {
+                conn->state = CONNECTION_STATE_WRITING;
+            }
+            else if (eof) {
+                conn->state = CONNECTION_STATE_CLOSING;
+            }
+            else if (!is_full) {
+                // the socket would block. wait for more bytes.
+                connection_detach_buffer(loop, conn);
+                return;
+            }
+        } break;
+        case CONNECTION_STATE_WRITING: {
+            bool done = false;
+            const Error_t flush_error = connection_flush(conn, &done);
+            if (flush_error.tag != ERROR_NONE) {
+                report_error(loop, flush_error);
+                conn->state = CONNECTION_STATE_CLOSING;
+                break;
+            }
+            if (!done) {
+                // the socket would block. wait for EPOLLOUT.
+                connection_detach_buffer(loop, conn);
+                return;
+            }
+            if (conn->close_after_write && !conn->reading_body) {
+                conn->state = CONNECTION_STATE_CLOSING;
+            }
+            else {
+                conn->state = CONNECTION_STATE_READING;
+                resume_handling = true;
+            }
+        } break;
+        case CONNECTION_STATE_CLOSING:
+            connection_close(loop, conn);
+            return;
+        }
+    }
+}
+
+static void accept_connections(struct EventLoop *loop)
+{
+    while (true) {
+        int conn_fd = -1;
+        const Error_t accept_error = open_tcp_client_connection_nonblocking(loop->server_fd, &conn_fd);
+        if (accept_error.tag != ERROR_NONE) {
+            report_error(loop, accept_error);
+            return;
+        }
+        else if (conn_fd == -1) {
+            return;
+        }
+
+        const Error_t open_error = connection_open(loop, conn_fd);
+        if (open_error.tag != ERROR_NONE) {
+            report_error(loop, open_error);
+            close(conn_fd);
+            continue;
+        }
+        // bytes may already have arrived before the socket was registered.
+        connection_process(loop, loop->connections);
+    }
+}
+
+static void close_idle_connections(struct EventLoop *loop)
+{
+    if (loop->config.idle_timeout_ms == 0) {
+        return;
+    }
+    while (loop->oldest && loop->now_ms - loop->oldest->last_active_ms >= loop->config.idle_timeout_ms) {
+        connection_close(loop, loop->oldest);
+    }
+}
+
+static int get_wait_timeout_ms(const struct EventLoop *loop)
+{
+    if (loop->config.idle_timeout_ms == 0 || loop->oldest == NULL) {
+        return -1;
+    }
+    const uint64_t deadline_ms = loop->oldest->last_active_ms + loop->config.idle_timeout_ms;
+    const uint64_t timeout_ms = deadline_ms > loop->now_ms ? deadline_ms - loop->now_ms : 0;
+    return timeout_ms > INT32_MAX ? INT32_MAX : (int)timeout_ms;
+}
+
+#ifdef HAVE_IO_URING
+
+// the io_uring backend drives the same connections with completions instead of readiness:
+//
+// - the server socket has a multishot accept in flight, and every connection a multishot recieve picking buffers from
+//   a ring shared by the connections, so idle connections hold no buffer. recieved bytes are copied into the reader of
+//   the connection, and the buffer is given back right away, unless the reader is full.
+// - output is sent with a chain of linked operations: a sendmsg() of the in-memory segments, then chunks of the next
+//   file segment spliced through a pipe of the connection, file -> pipe -> socket. operations after one falling short
+//   are canceled, and the chain is continued from where it stopped.
+// - submissions are collected while completions are handled, and submitted along with waiting for the next
+//   completions in a single system call.
+//
+// the user data of an operation is a pointer to its connection or watch, with the kind of the operation in the lowest
+// bits, which are zero in the pointers.
+
+#define URING_QUEUE_DEPTH     (1024)
+#define URING_BUFFER_GROUP    (0)
+#define URING_NBUFFERS        (1024)
+#define URING_BUFFER_SIZE     (4096)
+#define URING_PIPE_SIZE       (1 << 18)
+#define URING_MAX_FILE_CHUNKS (4)
+#define URING_OP_MASK         ((uint64_t)7)
+
+enum URingOp {
+    URING_OP_ACCEPT = 0,
+    URING_OP_WATCH,
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_SPLICE_IN,
+    URING_OP_SPLICE_OUT,
+    URING_OP_CANCEL,
+};
+
+/**
+ * Part of a recieved buffer not fitting in the reader of its connection yet.
+ */
+struct PendingInput {
+    uint16_t buffer_id; ///< buffer of the buffer ring
+    uint32_t offset;    ///< offset of the first byte not taken yet
+    uint32_t nbytes;    ///< number of bytes not taken yet
+};
+
+/**
+ * State of a connection driven by io_uring.
+ */
+struct ConnectionUring {
+    size_t ninflight;                        ///< number of operations in flight
+    size_t nsends_inflight;                  ///< number of operations in flight sending output
+    bool recv_armed;                         ///< whether a multishot recieve is in flight
+    bool recv_starved;                       ///< whether the recieve ended as the buffer ring ran out
+    bool eof;                                ///< whether the peer closed its side of the connection
+    bool closing;                            ///< whether the connection is freed once no operations are in flight
+    int pipe_fds[2];                         ///< pipe splicing files to the socket, opened on first use
+    size_t pipe_size;                        ///< capacity of the pipe
+    size_t npiped;                           ///< bytes of the first file segment in the pipe
+    struct msghdr msg;                       ///< message of the sendmsg() in flight
+    struct iovec iov[EVENT_LOOP_MAX_IOVECS]; ///< in-memory segments of the sendmsg() in flight
+    struct PendingInput *pending;            ///< recieved bytes not fitting in the reader yet, in order
+    size_t npending;                         ///< number of pending parts
+    size_t pending_capacity;                 ///< capacity of the pending array
+};
+
+/**
+ * State of an event loop driven by io_uring.
+ */
+struct EventLoopUring {
+    struct URing ring;              ///< io_uring instance
+    struct URingBufferRing buffers; ///< buffers picked by the recieves
+    bool accept_armed;              ///< whether a multishot accept is in flight
+    bool buffers_recycled;          ///< whether buffers were given back since recieves ran out of them
+    size_t nstarved;                ///< number of connections whose recieve ran out of buffers
+    struct Connection *closing;     ///< closed connections waiting for their operations to end
+};
+
+/**
+ * Make room for nentries submissions, submitting the ones collected so far if needed.
+ */
+static Error_t uring_reserve(struct EventLoop *loop, const uint32_t nentries)
+{
+    struct URing *ring = &loop->uring->ring;
+    if (uring_sq_space_left(ring) >= nentries) {
+        return NO_ERRORS;
+    }
+    const Error_t error = uring_submit_and_wait(ring, 0, 0);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+    else if (uring_sq_space_left(ring) < nentries) {
+        return error_format_location(
+            ERROR_INFO(__func__), (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "io_uring submission queue is full"});
+    }
+    return NO_ERRORS;
+}
+
+/**
+ * Get a submission entry for an operation, after room was made for it with uring_reserve().
+ */
+static struct io_uring_sqe *uring_push(struct EventLoop *loop, void *ptr, const enum URingOp op)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->uring->ring);
+    sqe->user_data = (uint64_t)(uintptr_t)ptr | (uint64_t)op;
+    return sqe;
+}
+
+static void uring_prep_splice(
+    struct io_uring_sqe *sqe, const int fd_in, const int64_t off_in, const int fd_out, const size_t nbytes)
+{
+    sqe->opcode = IORING_OP_SPLICE;
+    sqe->fd = fd_out;
+    sqe->off = (uint64_t)-1;
+    sqe->splice_fd_in = fd_in;
+    sqe->splice_off_in = (uint64_t)off_in;
+    sqe->len = (uint32_t)nbytes;
+    sqe->splice_flags = SPLICE_F_MOVE;
+}
+
+static Error_t uring_arm_accept(struct EventLoop *loop)
+{
+    const Error_t error = uring_reserve(loop, 1);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+    struct io_uring_sqe *sqe = uring_push(loop, NULL, URING_OP_ACCEPT);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    loop->uring->accept_armed = true;
+    return NO_ERRORS;
+}
+
+static Error_t uring_arm_watch(struct EventLoop *loop, struct EventLoopWatch *watch)
+{
+    const Error_t error = uring_reserve(loop, 1);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+    struct io_uring_sqe *sqe = uring_push(loop, watch, URING_OP_WATCH);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = watch->fd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    return NO_ERRORS;
+}
+
+static Error_t uring_connection_arm_recv(struct EventLoop *loop, struct Connection *conn)
+{
+    const Error_t error = uring_reserve(loop, 1);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+    struct io_uring_sqe *sqe = uring_push(loop, conn, URING_OP_RECV);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->conn_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    conn->uring->recv_armed = true;
+    conn->uring->ninflight++;
+    return NO_ERRORS;
+}
+
+static Error_t uring_connection_open(struct EventLoop *loop, struct Connection *conn)
+{
+    conn->uring = calloc(1, sizeof(*conn->uring));
+    if (!conn->uring) {
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    conn->uring->pipe_fds[0] = conn->uring->pipe_fds[1] = -1;
+
+    const Error_t error = uring_connection_arm_recv(loop, conn);
+    if (error.tag != ERROR_NONE) {
+        free(conn->uring);
+        conn->uring = NULL;
+    }
+    return error;
+}
+
+static void uring_recycle_buffer(struct EventLoop *loop, const uint16_t buffer_id)
+{
+    uring_buffer_recycle(&loop->uring->buffers, buffer_id);
+    loop->uring->buffers_recycled = true;
+}
+
+static void uring_connection_free(struct EventLoop *loop, struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    }
+    else {
+        loop->uring->closing = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    if (cu->recv_starved) {
+        loop->uring->nstarved--;
+    }
+    for (size_t i = 0; i < cu->npending; i++) {
+        uring_recycle_buffer(loop, cu->pending[i].buffer_id);
+    }
+    free(cu->pending);
+    if (cu->pipe_fds[0] != -1) {
+        close(cu->pipe_fds[0]);
+        close(cu->pipe_fds[1]);
+    }
+    free(cu);
+    conn->uring = NULL;
+    connection_free(loop, conn);
+}
+
+static void uring_connection_close(struct EventLoop *loop, struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+    cu->closing = true;
+    conn->state = CONNECTION_STATE_CLOSING;
+
+    conn->prev = NULL;
+    conn->next = loop->uring->closing;
+    if (conn->next) {
+        conn->next->prev = conn;
+    }
+    loop->uring->closing = conn;
+
+    if (cu->ninflight == 0) {
+        uring_connection_free(loop, conn);
+        return;
+    }
+    // ends the recieve, and the sends waiting for the peer.
+    shutdown(conn->conn_fd, SHUT_RDWR);
+    if (uring_reserve(loop, 1).tag == ERROR_NONE) {
+        struct io_uring_sqe *sqe = uring_push(loop, conn, URING_OP_CANCEL);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = conn->conn_fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        cu->ninflight++;
+    }
+}
+
+/**
+ * Keep the part of a recieved buffer not fitting in the reader, until there is room for it.
+ */
+static Error_t uring_connection_push_pending(struct Connection *conn, const struct PendingInput pending)
+{
+    struct ConnectionUring *cu = conn->uring;
+    if (cu->npending == cu->pending_capacity) {
+        const size_t capacity = cu->pending_capacity == 0 ? 4 : cu->pending_capacity * 2;
+        struct PendingInput *new_pending = realloc(cu->pending, capacity * sizeof(*new_pending));
+        if (!new_pending) {
+            return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        cu->pending = new_pending;
+        cu->pending_capacity = capacity;
+    }
+    cu->pending[cu->npending++] = pending;
+    return NO_ERRORS;
+}
+
+/**
+ * Move pending bytes into the reader while they fit, giving back the buffers taken in full.
+ */
+static void uring_connection_take_pending(struct EventLoop *loop, struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+    if (cu->npending == 0) {
+        return;
+    }
+    const Error_t attach_error = connection_attach_buffer(loop, conn);
+    if (attach_error.tag != ERROR_NONE) {
+        report_error(loop, attach_error);
+        conn->state = CONNECTION_STATE_CLOSING;
+        return;
+    }
+    size_t ntaken = 0;
+    for (; ntaken < cu->npending; ntaken++) {
+        struct PendingInput *pending = &cu->pending[ntaken];
+        const char *buf = uring_buffer_get(&loop->uring->buffers, pending->buffer_id);
+        const size_t ncopied = buffered_reader_append(&conn->reader, pending->nbytes, &buf[pending->offset]);
+        pending->offset += (uint32_t)ncopied;
+        pending->nbytes -= (uint32_t)ncopied;
+        if (pending->nbytes > 0) {
+            break;
+        }
+        uring_recycle_buffer(loop, pending->buffer_id);
+    }
+    memmove(cu->pending, &cu->pending[ntaken], (cu->npending - ntaken) * sizeof(*cu->pending));
+    cu->npending -= ntaken;
+}
+
+static void uring_connection_on_recv(struct EventLoop *loop, struct Connection *conn, const struct io_uring_cqe *cqe)
+{
+    struct ConnectionUring *cu = conn->uring;
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        cu->recv_armed = false;
+        cu->ninflight--;
+    }
+
+    if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        const uint16_t buffer_id = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        if (cu->closing) {
+            uring_recycle_buffer(loop, buffer_id);
+            return;
+        }
+        connection_touch(loop, conn);
+
+        const Error_t error = uring_connection_push_pending(
+            conn, (struct PendingInput){.buffer_id = buffer_id, .offset = 0, .nbytes = (uint32_t)cqe->res});
+        if (error.tag != ERROR_NONE) {
+            report_error(loop, error);
+            uring_recycle_buffer(loop, buffer_id);
+            conn->state = CONNECTION_STATE_CLOSING;
+            return;
+        }
+        // the bytes are taken in order, once the bytes pending before have been taken.
+        uring_connection_take_pending(loop, conn);
+    }
+    else if (cqe->res == 0) {
+        cu->eof = true;
+    }
+    else if (cqe->res == -ENOBUFS) {
+        // recieved again once buffers are given back.
+        cu->recv_starved = true;
+        loop->uring->nstarved++;
+    }
+    else if (cqe->res < 0 && cqe->res != -ECANCELED && !cu->closing) {
+        report_error(
+            loop,
+            error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = -cqe->res}));
+        conn->state = CONNECTION_STATE_CLOSING;
+    }
+}
+
+static void
+uring_connection_on_send(struct EventLoop *loop, struct Connection *conn, const enum URingOp op, const int res)
+{
+    struct ConnectionUring *cu = conn->uring;
+    cu->ninflight--;
+    cu->nsends_inflight--;
+
+    if (res == -ECANCELED || cu->closing) {
+        // an operation before fell short, or the connection is closed.
+        return;
+    }
+    else if (res < 0) {
+        report_error(
+            loop, error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = -res}));
+        conn->state = CONNECTION_STATE_CLOSING;
+        return;
+    }
+    connection_touch(loop, conn);
+
+    struct OutputSegment *segment = &conn->segments[conn->first_segment];
+    switch (op) {
+    case URING_OP_SEND:
+        connection_consume_output(conn, (size_t)res);
+        break;
+    case URING_OP_SPLICE_IN:
+        if (res == 0) {
+            report_error(
+                loop,
+                error_format_location(
+                    ERROR_INFO(__func__), (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "file ended before expected"}));
+            conn->state = CONNECTION_STATE_CLOSING;
+            break;
+        }
+        segment->file_offset += res;
+        cu->npiped += (size_t)res;
+        break;
+    case URING_OP_SPLICE_OUT:
+        cu->npiped -= (size_t)res;
+        connection_consume_output(conn, (size_t)res);
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * Open the pipe splicing files to the socket of a connection.
+ */
+static Error_t uring_connection_open_pipe(struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+    if (pipe2(cu->pipe_fds, O_CLOEXEC) == -1) {
+        cu->pipe_fds[0] = cu->pipe_fds[1] = -1;
+        return error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    // a larger pipe splices more bytes per operation. the default size still works, so failing is fine.
+    (void)fcntl(cu->pipe_fds[1], F_SETPIPE_SZ, URING_PIPE_SIZE);
+    const int pipe_size = fcntl(cu->pipe_fds[1], F_GETPIPE_SZ);
+    cu->pipe_size = pipe_size > 0 ? (size_t)pipe_size : 65536;
+    return NO_ERRORS;
+}
+
+/**
+ * Get a submission entry for the next operation of the chain sending the output of a connection, linked to the
+ * operation before, if any.
+ */
+static struct io_uring_sqe *uring_connection_push_send(
+    struct EventLoop *loop, struct Connection *conn, const enum URingOp op, struct io_uring_sqe **prev)
+{
+    struct io_uring_sqe *sqe = uring_push(loop, conn, op);
+    if (*prev) {
+        (*prev)->flags |= IOSQE_IO_LINK;
+    }
+    *prev = sqe;
+    conn->uring->ninflight++;
+    conn->uring->nsends_inflight++;
+    return sqe;
+}
+
+/**
+ * Send queued output with a chain of linked operations: a sendmsg() of the in-memory segments up to the next file
+ * segment, followed by chunks of that file segment spliced through the pipe of the connection.
+ */
+static Error_t uring_connection_send(struct EventLoop *loop, struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+
+    // the sendmsg(), the bytes left in the pipe, and a splice into and out of the pipe for each chunk.
+    Error_t error = uring_reserve(loop, 2 + 2 * URING_MAX_FILE_CHUNKS);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+
+    struct io_uring_sqe *prev = NULL;
+    size_t i = conn->first_segment;
+    size_t niov = 0;
+    for (; cu->npiped == 0 && i < conn->nsegments && niov < EVENT_LOOP_MAX_IOVECS; i++) {
+        const struct OutputSegment *segment = &conn->segments[i];
+        if (segment->kind == OUTPUT_SEGMENT_FILE) {
+            break;
+        }
+        cu->iov[niov++] = (struct iovec){
+            .iov_base = (void *)(segment->kind == OUTPUT_SEGMENT_BYTES ? &conn->outbuf[segment->outbuf_offset]
+                                                                        : segment->buf),
+            .iov_len = segment->nbytes,
+        };
+    }
+    if (niov > 0) {
+        cu->msg = (struct msghdr){.msg_iov = cu->iov, .msg_iovlen = niov};
+        struct io_uring_sqe *sqe = uring_connection_push_send(loop, conn, URING_OP_SEND, &prev);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->conn_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&cu->msg;
+        sqe->len = 1;
+        // sent in full, or the chain is cut short.
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    }
+    if (i == conn->nsegments || conn->segments[i].kind != OUTPUT_SEGMENT_FILE) {
+        return NO_ERRORS;
+    }
+
+    const struct OutputSegment *segment = &conn->segments[i];
+    if (cu->pipe_fds[0] == -1 && (error = uring_connection_open_pipe(conn)).tag != ERROR_NONE) {
+        // the in-memory segments are sent anyway.
+        return niov > 0 ? NO_ERRORS : error;
+    }
+    // bytes left in the pipe by a chain cut short are sent first.
+    if (cu->npiped > 0) {
+        struct io_uring_sqe *sqe = uring_connection_push_send(loop, conn, URING_OP_SPLICE_OUT, &prev);
+        uring_prep_splice(sqe, cu->pipe_fds[0], -1, conn->conn_fd, cu->npiped);
+    }
+    size_t nspliced = cu->npiped;
+    int64_t offset = segment->file_offset;
+    for (size_t k = 0; k < URING_MAX_FILE_CHUNKS && nspliced < segment->nbytes; k++) {
+        const size_t nchunk = MIN(segment->nbytes - nspliced, cu->pipe_size);
+
+        struct io_uring_sqe *sqe = uring_connection_push_send(loop, conn, URING_OP_SPLICE_IN, &prev);
+        uring_prep_splice(sqe, segment->file_fd, offset, cu->pipe_fds[1], nchunk);
+        sqe = uring_connection_push_send(loop, conn, URING_OP_SPLICE_OUT, &prev);
+        uring_prep_splice(sqe, cu->pipe_fds[0], -1, conn->conn_fd, nchunk);
+
+        offset += (int64_t)nchunk;
+        nspliced += nchunk;
+    }
+    return NO_ERRORS;
+}
+
+/**
+ * Drive the state machine of a connection after a completion, until it waits for the next completion.
+ */
+static void uring_connection_drive(struct EventLoop *loop, struct Connection *conn)
+{
+    struct ConnectionUring *cu = conn->uring;
+
+    while (!cu->closing) {
+        if (cu->nsends_inflight > 0) {
+            // the output is not touched until the chain in flight is done.
+            return;
+        }
+        if (conn->state == CONNECTION_STATE_CLOSING) {
+            connection_close(loop, conn);
+            return;
+        }
+        if (connection_has_output(conn)) {
+            conn->state = CONNECTION_STATE_WRITING;
+            const Error_t send_error = uring_connection_send(loop, conn);
+            if (send_error.tag != ERROR_NONE) {
+                report_error(loop, send_error);
+                conn->state = CONNECTION_STATE_CLOSING;
+                continue;
+            }
+            connection_detach_buffer(loop, conn);
+            return;
+        }
+        // the rest of a request body is read before closing, as the handler may answer once it is read.
+        if (conn->close_after_write && !conn->reading_body) {
+            conn->state = CONNECTION_STATE_CLOSING;
+            continue;
+        }
+
+        conn->state = CONNECTION_STATE_READING;
+        uring_connection_take_pending(loop, conn);
+        if (conn->reader.nleft > 0) {
+            connection_handle_requests(loop, conn);
+        }
+        if (conn->state == CONNECTION_STATE_CLOSING || connection_has_output(conn)
+            || (conn->close_after_write && !conn->reading_body)) {
+            continue;
+        }
+        else if (cu->npending > 0 && conn->reader.nleft < conn->reader.max_msg_len) {
+            // room was made for more of the bytes pending.
+            continue;
+        }
+        else if (cu->eof) {
+            conn->state = CONNECTION_STATE_CLOSING;
+            continue;
+        }
+        if (!cu->recv_armed && !cu->recv_starved) {
+            const Error_t recv_error = uring_connection_arm_recv(loop, conn);
+            if (recv_error.tag != ERROR_NONE) {
+                report_error(loop, recv_error);
+                conn->state = CONNECTION_STATE_CLOSING;
+                continue;
+            }
+        }
+        connection_detach_buffer(loop, conn);
+        return;
+    }
+    if (cu->ninflight == 0) {
+        uring_connection_free(loop, conn);
+    }
+}
+
+/**
+ * Recieve again on the connections whose recieve ran out of buffers, once buffers were given back.
+ */
+static void uring_rearm_starved(struct EventLoop *loop)
+{
+    loop->uring->buffers_recycled = false;
+    struct Connection *next = NULL;
+    for (struct Connection *conn = loop->connections; conn && loop->uring->nstarved > 0; conn = next) {
+        // driving the connection may close it.
+        next = conn->next;
+        if (!conn->uring->recv_starved) {
+            continue;
+        }
+        conn->uring->recv_starved = false;
+        loop->uring->nstarved--;
+        uring_connection_drive(loop, conn);
+    }
+}
+
+static void uring_on_accept(struct EventLoop *loop, const struct io_uring_cqe *cqe)
+{
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        loop->uring->accept_armed = false;
+    }
+    if (cqe->res < 0) {
+        if (cqe->res != -ECANCELED) {
+            report_error(
+                loop,
+                error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = -cqe->res}));
+        }
+        return;
+    }
+    if (!loop->running) {
+        close(cqe->res);
+        return;
+    }
+    const Error_t open_error = connection_open(loop, cqe->res);
+    if (open_error.tag != ERROR_NONE) {
+        report_error(loop, open_error);
+        close(cqe->res);
+    }
+}
+
+static void uring_on_watch(struct EventLoop *loop, struct EventLoopWatch *watch, const struct io_uring_cqe *cqe)
+{
+    if (cqe->res > 0 && loop->running) {
+        watch->on_readable(watch->arg);
+    }
+    else if (cqe->res < 0 && cqe->res != -ECANCELED) {
+        report_error(
+            loop, error_format_location(ERROR_INFO(__func__), (Error_t){.tag = ERROR_ERRNO, .errno_num = -cqe->res}));
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE) && loop->running) {
+        const Error_t error = uring_arm_watch(loop, watch);
+        if (error.tag != ERROR_NONE) {
+            report_error(loop, error);
+        }
+    }
+}
+
+static void uring_on_completion(struct EventLoop *loop, const struct io_uring_cqe *cqe)
+{
+    const enum URingOp op = (enum URingOp)(cqe->user_data & URING_OP_MASK);
+    void *ptr = (void *)(uintptr_t)(cqe->user_data & ~URING_OP_MASK);
+
+    switch (op) {
+    case URING_OP_ACCEPT:
+        uring_on_accept(loop, cqe);
+        return;
+    case URING_OP_WATCH:
+        uring_on_watch(loop, ptr, cqe);
+        return;
+    case URING_OP_RECV:
+        uring_connection_on_recv(loop, ptr, cqe);
+        break;
+    case URING_OP_SEND:
+    case URING_OP_SPLICE_IN:
+    case URING_OP_SPLICE_OUT:
+        uring_connection_on_send(loop, ptr, op, cqe->res);
+        break;
+    case URING_OP_CANCEL:
+        ((struct Connection *)ptr)->uring->ninflight--;
+        break;
+    }
+    uring_connection_drive(loop, ptr);
+}
+
+/**
+ * Handle the completions posted so far.
+ */
+static void uring_handle_completions(struct EventLoop *loop)
+{
+    struct io_uring_cqe *cqe = NULL;
+    while ((cqe = uring_peek_cqe(&loop->uring->ring))) {
+        // the entry is copied, as handling it may submit operations, whose completions reuse the entry.
+        const struct io_uring_cqe copy = *cqe;
+        uring_cqe_seen(&loop->uring->ring);
+        uring_on_completion(loop, &copy);
+    }
+}
+
+static Error_t uring_loop_init(const ErrorInfo_t ei, struct EventLoop *loop)
+{
+    loop->uring = calloc(1, sizeof(*loop->uring));
+    if (!loop->uring) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    Error_t error = uring_init_(ei, &loop->uring->ring, URING_QUEUE_DEPTH);
+    if (error.tag != ERROR_NONE) {
+        free(loop->uring);
+        loop->uring = NULL;
+        return error;
+    }
+    error = uring_buffer_ring_init_(
+        ei, &loop->uring->ring, &loop->uring->buffers, URING_BUFFER_GROUP, URING_NBUFFERS, URING_BUFFER_SIZE);
+    if (error.tag != ERROR_NONE) {
+        uring_destroy(&loop->uring->ring);
+        free(loop->uring);
+        loop->uring = NULL;
+        return error;
+    }
+    return NO_ERRORS;
+}
+
+static void uring_loop_destroy(struct EventLoop *loop)
+{
+    // the closed connections are freed once their operations have ended.
+    while (loop->uring->closing) {
+        const Error_t error = uring_submit_and_wait(&loop->uring->ring, 1, -1);
+        if (error.tag != ERROR_NONE) {
+            report_error(loop, error);
+            break;
+        }
+        uring_handle_completions(loop);
+    }
+    uring_buffer_ring_destroy(&loop->uring->ring, &loop->uring->buffers);
+    uring_destroy(&loop->uring->ring);
+    free(loop->uring);
+    loop->uring = NULL;
+}
+
+static Error_t uring_loop_run(const ErrorInfo_t ei, struct EventLoop *loop)
+{
+    while (loop->running) {
+        if (!loop->uring->accept_armed) {
+            const Error_t accept_error = uring_arm_accept(loop);
+            if (accept_error.tag != ERROR_NONE) {
+                return accept_error;
+            }
+        }
+        if (loop->uring->nstarved > 0 && loop->uring->buffers_recycled) {
+            uring_rearm_starved(loop);
+        }
+
+        const Error_t wait_error = uring_submit_and_wait_(ei, &loop->uring->ring, 1, get_wait_timeout_ms(loop));
+        if (wait_error.tag != ERROR_NONE) {
+            return wait_error;
+        }
+        loop->now_ms = get_time_ms();
+
+        uring_handle_completions(loop);
+        close_idle_connections(loop);
+    }
+    return NO_ERRORS;
+}
+
+#endif
+
+Error_t event_loop_init_(
+    const ErrorInfo_t ei,
+    struct EventLoop *loop,
+    const int server_fd,
+    const struct EventLoopConfig config,
+    const struct EventLoopHandler handler)
+{
+    RETURN_IF_NULL(ei, loop);
+    RETURN_IF_NULL(ei, handler.on_data);
+
+    *loop = (struct EventLoop){
+        .epoll_fd = -1,
+        .uring = NULL,
+        .server_fd = server_fd,
+        .running = false,
+        .now_ms = get_time_ms(),
+        .nconnections = 0,
+        .connections = NULL,
+        .oldest = NULL,
+        .config = config,
+        .handler = handler,
+        .nwatches = 0,
+    };
+    buffer_pool_init(&loop->buffers);
+
+    const Error_t nonblocking_error = set_socket_nonblocking_(ei, server_fd);
+    if (nonblocking_error.tag != ERROR_NONE) {
+        return nonblocking_error;
+    }
+
+    if (config.backend == EVENT_LOOP_BACKEND_IO_URING) {
+#ifdef HAVE_IO_URING
+        return uring_loop_init(ei, loop);
+#else
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOSYS});
+#endif
+    }
+
+    if ((loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.ptr = NULL, // the server socket
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, server_fd, &event) == -1) {
+        const int errno_num = errno;
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    return NO_ERRORS;
+}
+
+void event_loop_destroy(struct EventLoop *loop)
+{
+    while (loop->connections) {
+        connection_close(loop, loop->connections);
+    }
+#ifdef HAVE_IO_URING
+    if (loop->uring) {
+        uring_loop_destroy(loop);
+    }
+#endif
+    if (loop->epoll_fd >= 0) {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+    buffer_pool_destroy(&loop->buffers);
+}
+
+Error_t event_loop_run_(const ErrorInfo_t ei, struct EventLoop *loop)
+{
+    RETURN_IF_NULL(ei, loop);
+
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    if (loop->handler.on_start) {
+        const Error_t start_error = loop->handler.on_start(loop->handler.arg, loop);
+        if (start_error.tag != ERROR_NONE) {
+            return start_error;
+        }
+    }
+
+    loop->running = true;
+#ifdef HAVE_IO_URING
+    if (loop->uring) {
+        return uring_loop_run(ei, loop);
+    }
+#endif
+    while (loop->running) {
+        const int nevents = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, get_wait_timeout_ms(loop));
+        if (nevents == -1 && errno != EINTR) {
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        loop->now_ms = get_time_ms();
+
+        for (int i = 0; i < nevents; i++) {
+            if (events[i].data.u64 == 0) {
+                accept_connections(loop);
+            }
+            else if (events[i].data.u64 <= EVENT_LOOP_MAX_WATCHES) {
+                const struct EventLoopWatch *watch = &loop->watches[events[i].data.u64 - 1];
+                watch->on_readable(watch->arg);
+            }
+            else {
+                connection_process(loop, events[i].data.ptr);
+            }
+        }
+        close_idle_connections(loop);
+    }
+    return NO_ERRORS;
+}
+
+Error_t event_loop_watch_fd_(
+    const ErrorInfo_t ei, struct EventLoop *loop, const int fd, void (*on_readable)(void *arg), void *arg)
+{
+    RETURN_IF_NULL(ei, loop);
+    RETURN_IF_NULL(ei, on_readable);
+
+    if (loop->nwatches == EVENT_LOOP_MAX_WATCHES) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "too many file handles watched by the event loop"});
+    }
+#ifdef HAVE_IO_URING
+    if (loop->uring) {
+        struct EventLoopWatch *watch = &loop->watches[loop->nwatches];
+        *watch = (struct EventLoopWatch){.fd = fd, .arg = arg, .on_readable = on_readable};
+        const Error_t error = uring_arm_watch(loop, watch);
+        if (error.tag != ERROR_NONE) {
+            return error;
+        }
+        loop->nwatches++;
+        return NO_ERRORS;
+    }
+#endif
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLET,
+        .data.u64 = loop->nwatches + 1,
+    };
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    loop->watches[loop->nwatches++] = (struct EventLoopWatch){.fd = fd, .arg = arg, .on_readable = on_readable};
+    return NO_ERRORS;
+}
+
+void event_loop_stop(struct EventLoop *loop)
+{
+    loop->running = false;
+}
+
+bool connection_count_request(struct Connection *conn, const bool keep_alive)
+{
+    if (conn->nrequests_left > 0) {
+        conn->nrequests_left--;
+    }
+    if (!keep_alive || conn->nrequests_left == 0) {
+        conn->close_after_write = true;
+    }
+    return !conn->close_after_write;
+}
+
+Error_t connection_begin_body_(
+    const ErrorInfo_t ei, struct Connection *conn, const struct HTTPRequest *request, const uint64_t max_body_size)
+{
+    RETURN_IF_NULL(ei, conn);
+    RETURN_IF_NULL(ei, request);
+
+    conn->reading_body = false;
+    const Error_t error = http_body_reader_init_(ei, &conn->body, request, max_body_size);
+    if (error.tag != ERROR_NONE) {
+        // the end of the request is unknown.
+        conn->close_after_write = true;
+        return error;
+    }
+    if (conn->body.framing == HTTP_BODY_NONE) {
+        return NO_ERRORS;
+    }
+    conn->reading_body = true;
+
+    /*
+        10.1.1 Expect
+
+        A server that receives a 100-continue expectation in an HTTP/1.1 request [...] MUST send an immediate 100
+        (Continue) response if it intends to receive and process the message body [...] unless it has already received
+        some or all of the message body
+    */
+    if (http_expects_continue(request) && conn->reader.nleft == 0) {
+        return connection_queue_borrowed_bytes_(
+            ei, conn, HTTP_CONTINUE_RESPONSE.length, (const char *)HTTP_CONTINUE_RESPONSE.buf);
+    }
+    return NO_ERRORS;
+}
+
+static Error_t
+connection_push_segment(const ErrorInfo_t ei, struct Connection *conn, const struct OutputSegment segment)
+{
+    if (conn->nsegments == conn->segments_capacity) {
+        const size_t capacity = conn->segments_capacity == 0 ? 8 : conn->segments_capacity * 2;
+        struct OutputSegment *segments = realloc(conn->segments, capacity * sizeof(*segments));
+        if (!segments) {
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+        }
+        conn->segments = segments;
+        conn->segments_capacity = capacity;
+    }
+    conn->segments[conn->nsegments++] = segment;
+    return NO_ERRORS;
+}
+
+Error_t connection_queue_bytes_(const ErrorInfo_t ei, struct Connection *conn, const size_t nbytes, const char *buf)
+{
+    RETURN_IF_NULL(ei, conn);
+    RETURN_IF_NULL(ei, buf);
+
+    if (nbytes == 0) {
+        return NO_ERRORS;
+    }
+    const size_t outbuf_offset = strdyn_length(conn->outbuf);
+    const Error_t error = strdyn_append_len_(ei, &conn->outbuf, buf, nbytes);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+
+    // extend the last segment if the bytes follow it in the output buffer.
+    if (conn->nsegments > conn->first_segment) {
+        struct OutputSegment *last = &conn->segments[conn->nsegments - 1];
+        if (last->kind == OUTPUT_SEGMENT_BYTES && last->outbuf_offset + last->nbytes == outbuf_offset) {
+            last->nbytes += nbytes;
+            return NO_ERRORS;
+        }
+    }
+    return connection_push_segment(
+        ei,
+        conn,
+        (struct OutputSegment){.kind = OUTPUT_SEGMENT_BYTES, .nbytes = nbytes, .outbuf_offset = outbuf_offset});
+}
+
+Error_t
+connection_queue_borrowed_bytes_(const ErrorInfo_t ei, struct Connection *conn, const size_t nbytes, const char *buf)
+{
+    RETURN_IF_NULL(ei, conn);
+    RETURN_IF_NULL(ei, buf);
+
+    if (nbytes == 0) {
+        return NO_ERRORS;
+    }
+    return connection_push_segment(
+        ei, conn, (struct OutputSegment){.kind = OUTPUT_SEGMENT_BORROWED, .nbytes = nbytes, .buf = buf});
+}
+
+Error_t connection_queue_shared_bytes_(
+    const ErrorInfo_t ei,
+    struct Connection *conn,
+    const size_t nbytes,
+    const char *buf,
+    OutputReleaseFunc release,
+    void *release_arg)
+{
+    RETURN_IF_NULL(ei, conn);
+    RETURN_IF_NULL(ei, buf);
+
+    if (nbytes == 0) {
+        if (release) {
+            release(release_arg);
+        }
+        return NO_ERRORS;
+    }
+    return connection_push_segment(
+        ei,
+        conn,
+        (struct OutputSegment){
+            .kind = OUTPUT_SEGMENT_BORROWED,
+            .nbytes = nbytes,
+            .buf = buf,
+            .release = release,
+            .release_arg = release_arg,
+        });
+}
+
+Error_t connection_queue_file_(
+    const ErrorInfo_t ei, struct Connection *conn, const int file_fd, const off_t offset, const size_t nbytes)
+{
+    RETURN_IF_NULL(ei, conn);
+
+    if (nbytes == 0) {
+        close(file_fd);
+        return NO_ERRORS;
+    }
+    return connection_push_segment(
+        ei,
+        conn,
+        (struct OutputSegment){
+            .kind = OUTPUT_SEGMENT_FILE,
+            .nbytes = nbytes,
+            .file_fd = file_fd,
+            .close_file = true,
+            .file_offset = offset,
+        });
+}
+
+Error_t connection_queue_borrowed_file_(
+    const ErrorInfo_t ei,
+    struct Connection *conn,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    OutputReleaseFunc release,
+    void *release_arg)
+{
+    RETURN_IF_NULL(ei, conn);
+
+    if (nbytes == 0) {
+        if (release) {
+            release(release_arg);
+        }
+        return NO_ERRORS;
+    }
+    return connection_push_segment(
+        ei,
+        conn,
+        (struct OutputSegment){
+            .kind = OUTPUT_SEGMENT_FILE,
+            .nbytes = nbytes,
+            .file_fd = file_fd,
+            .close_file = false,
+            .file_offset = offset,
+            .release = release,
+            .release_arg = release_arg,
+        });
+}
@@ -0,0 +1,276 @@
+#pragma once
+
+#include "buffer_pool.h"
+#include "connection_tcp.h"
+#include "error.h"
+#include "message.h"
+
+#include "types/strdyn.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define EVENT_LOOP_MAX_EVENTS  (256)
+#define EVENT_LOOP_MAX_IOVECS  (64)
+#define EVENT_LOOP_MAX_WATCHES (4)
+
+enum ConnectionState {
+    CONNECTION_STATE_READING = 0,
+    CONNECTION_STATE_WRITING,
+    CONNECTION_STATE_CLOSING,
+};
+
+enum OutputSegmentKind {
+    OUTPUT_SEGMENT_BYTES = 0, ///< bytes copied into the output buffer of the connection
+    OUTPUT_SEGMENT_BORROWED,  ///< bytes owned by the caller
+    OUTPUT_SEGMENT_FILE,      ///< part of a file
+};
+
+/**
+ * Callback releasing borrowed output once it is sent, or dropped as the connection closes.
+ */
+typedef void (*OutputReleaseFunc)(void *arg);
+
+/**
+ * Part of the output queued on a connection.
+ */
+struct OutputSegment {
+    enum OutputSegmentKind kind; ///< kind of the segment
+    size_t nbytes;               ///< number of bytes left to send
+    size_t outbuf_offset;        ///< offset of the next byte to send in the output buffer (OUTPUT_SEGMENT_BYTES)
+    const char *buf;             ///< next byte to send (OUTPUT_SEGMENT_BORROWED)
+    int file_fd;                 ///< file handle (OUTPUT_SEGMENT_FILE)
+    bool close_file;             ///< whether the file handle is owned by the connection (OUTPUT_SEGMENT_FILE)
+    off_t file_offset;           ///< offset of the next byte to send in the file, 64-bit (OUTPUT_SEGMENT_FILE)
+    OutputReleaseFunc release;   ///< called once the segment is done, or NULL
+    void *release_arg;           ///< argument passed to release
+};
+
+struct ConnectionUring;
+struct EventLoopUring;
+
+/**
+ * Non-blocking connection owned by the event loop.
+ */
+struct Connection {
+    int conn_fd;                     ///< non-blocking connection socket file handle
+    enum ConnectionState state;      ///< what the connection is waiting for
+    bool close_after_write;          ///< close the connection once the queued bytes are sent
+    struct BufferedReader reader;    ///< bytes recieved and not handled yet, in a pooled buffer
+    struct HTTPRequestParser parser; ///< progress parsing the request at the start of the reader
+    bool reading_body;               ///< whether the reader starts with the body of the last request
+    struct HTTPBodyReader body;      ///< progress reading the body of the last request
+    strdyn_t outbuf;                 ///< bytes copied for sending
+    struct ConnectionUring *uring;   ///< state of the io_uring backend, or NULL with epoll
+    struct OutputSegment *segments;  ///< output queued for sending, in order
+    size_t first_segment;            ///< index of the first segment not sent yet
+    size_t nsegments;                ///< number of queued segments
+    size_t segments_capacity;        ///< capacity of the segments array
+    size_t nrequests_left;           ///< number of requests left before the connection is closed
+    uint64_t nbytes_sent;            ///< number of bytes sent on the connection
+    uint64_t last_active_ms;         ///< time of the last activity on the connection
+    struct Connection *prev;         ///< more recently active connection in the event loop
+    struct Connection *next;         ///< less recently active connection in the event loop
+};
+
+struct EventLoop;
+
+/**
+ * File handle other than a connection, watched by an event loop.
+ */
+struct EventLoopWatch {
+    int fd;                         ///< non-blocking file handle
+    void *arg;                      ///< argument passed to on_readable
+    void (*on_readable)(void *arg); ///< called when the file handle becomes readable. must read until it would block
+};
+
+/**
+ * Callbacks driving the connections of an event loop.
+ */
+struct EventLoopHandler {
+    void *arg; ///< argument passed to the callbacks
+
+    /**
+     * Called once from event_loop_run() before any connection is accepted, e.g. to watch file handles of the handler
+     * with event_loop_watch_fd(). Nullable.
+     */
+    Error_t (*on_start)(void *arg, struct EventLoop *loop);
+
+    /**
+     * Called when new bytes are recieved. Complete requests should be marked read with buffered_reader_consume() and
+     * answered with connection_queue_bytes() / connection_queue_file(). Incomplete requests should be left in the
+     * reader, and are handled again once more bytes arrive. The parser of the connection can be used to resume parsing
+     * where the last call stopped.
+     *
+     * Called again as long as it marks bytes read, so pipelined requests are all answered before the queued output is
+     * sent with as few system calls as possible.
+     *
+     * Returning an error closes the connection after the queued bytes are sent.
+     */
+    Error_t (*on_data)(void *arg, struct Connection *conn);
+
+    /**
+     * Called with the parts of a request body as they are recieved, after connection_begin_body() was called from
+     * on_data. The data is valid until the call returns. Called with done set once the body ends, or once reading it
+     * failed, in which case the error status of conn->body is set and the connection is closed after the queued bytes
+     * are sent. on_data is called again for the requests after the body. Nullable, in which case bodies are discarded.
+     *
+     * Returning an error closes the connection after the queued bytes are sent.
+     */
+    Error_t (*on_body)(void *arg, struct Connection *conn, const strview_t data, const bool done);
+
+    /**
+     * Called with errors that are not returned from event_loop_run(). Nullable.
+     */
+    void (*on_error)(void *arg, const Error_t error);
+};
+
+enum EventLoopBackend {
+    EVENT_LOOP_BACKEND_EPOLL = 0, ///< edge-triggered epoll, with non-blocking system calls per connection
+    EVENT_LOOP_BACKEND_IO_URING,  ///< io_uring, with batched submissions and completions (HAVE_IO_URING, Linux 6.0)
+};
+
+/**
+ * Limits on the connections of an event loop.
+ */
+struct EventLoopConfig {
+    uint64_t idle_timeout_ms;           ///< close connections inactive for longer, or 0 for no timeout
+    size_t max_requests_per_connection; ///< close connections after this many requests, or 0 for no limit
+    enum EventLoopBackend backend;      ///< how the connections are driven
+};
+
+static const struct EventLoopConfig EVENT_LOOP_DEFAULT_CONFIG = {
+    .idle_timeout_ms = 5000,
+    .max_requests_per_connection = 1000,
+    .backend = EVENT_LOOP_BACKEND_EPOLL,
+};
+
+/**
+ * Event loop accepting and serving connections of a server socket, with edge-triggered epoll or io_uring.
+ */
+struct EventLoop {
+    int epoll_fd;                                          ///< epoll instance file handle, or -1 with io_uring
+    struct EventLoopUring *uring;                          ///< state of the io_uring backend, or NULL with epoll
+    int server_fd;                                         ///< non-blocking server socket file handle
+    bool running;                                          ///< whether event_loop_run() should keep running
+    uint64_t now_ms;                                       ///< time of the current events
+    size_t nconnections;                                   ///< number of open connections
+    struct Connection *connections;                        ///< open connections, most recently active first
+    struct Connection *oldest;                             ///< least recently active connection
+    struct EventLoopConfig config;                         ///< limits on the connections
+    struct EventLoopHandler handler;                       ///< callbacks driving the connections
+    size_t nwatches;                                       ///< number of watched file handles
+    struct EventLoopWatch watches[EVENT_LOOP_MAX_WATCHES]; ///< watched file handles other than connections
+    struct BufferPool buffers;                             ///< recieve buffers of the connections
+};
+
+/**
+ * Initiate an event loop on a server socket. The server socket is made non-blocking. Fails with ENOSYS if the
+ * io_uring backend is asked for, but not built, and with the error of io_uring if the kernel does not support it.
+ */
+Error_t event_loop_init_(
+    const ErrorInfo_t ei,
+    struct EventLoop *loop,
+    const int server_fd,
+    const struct EventLoopConfig config,
+    const struct EventLoopHandler handler);
+
+/**
+ * Close the open connections and the epoll instance. The server socket is left open.
+ */
+void event_loop_destroy(struct EventLoop *loop);
+
+/**
+ * Accept and serve connections until event_loop_stop() is called.
+ */
+Error_t event_loop_run_(const ErrorInfo_t ei, struct EventLoop *loop);
+
+/**
+ * Watch a non-blocking file handle, e.g. an inotify instance, calling on_readable from the loop when it becomes
+ * readable. The file handle is left open.
+ */
+Error_t event_loop_watch_fd_(
+    const ErrorInfo_t ei, struct EventLoop *loop, const int fd, void (*on_readable)(void *arg), void *arg);
+
+/**
+ * Make event_loop_run() return after handling the current events.
+ */
+void event_loop_stop(struct EventLoop *loop);
+
+/**
+ * Count a request answered on the connection, and decide whether the connection persists after the response, given
+ * whether the request asked for it (see http_keep_alive()). Connections not persisting are closed once the queued
+ * bytes are sent.
+ */
+bool connection_count_request(struct Connection *conn, const bool keep_alive);
+
+/**
+ * Start reading the body of a request, whose header block was marked read, passing it to on_body as it is recieved.
+ * 100 Continue is queued if the client waits for it. Fails, with the status to answer with in conn->body, if the
+ * framing of the body is invalid or the body is larger than max_body_size (see http_body_reader_init()). The end of the
+ * request is then unknown, so the connection is closed after the queued bytes are sent.
+ */
+Error_t connection_begin_body_(
+    const ErrorInfo_t ei, struct Connection *conn, const struct HTTPRequest *request, const uint64_t max_body_size);
+
+/**
+ * Queue bytes to be sent on the connection. The bytes are copied.
+ */
+Error_t connection_queue_bytes_(const ErrorInfo_t ei, struct Connection *conn, const size_t nbytes, const char *buf);
+
+/**
+ * Queue bytes to be sent on the connection without copying them. The bytes must stay valid until the connection is
+ * closed, e.g. static responses.
+ */
+Error_t
+connection_queue_borrowed_bytes_(const ErrorInfo_t ei, struct Connection *conn, const size_t nbytes, const char *buf);
+
+/**
+ * Queue bytes to be sent on the connection without copying them, e.g. bytes shared by several responses. release is
+ * called with release_arg once the bytes are sent or the connection closes, so the caller knows when the bytes are no
+ * longer used. Empty bytes are released right away. If queuing fails, release is not called.
+ */
+Error_t connection_queue_shared_bytes_(
+    const ErrorInfo_t ei,
+    struct Connection *conn,
+    const size_t nbytes,
+    const char *buf,
+    OutputReleaseFunc release,
+    void *release_arg);
+
+/**
+ * Queue part of a file to be sent on the connection. The connection takes ownership of the file handle, and closes it
+ * when done.
+ */
+Error_t connection_queue_file_(
+    const ErrorInfo_t ei, struct Connection *conn, const int file_fd, const off_t offset, const size_t nbytes);
+
+/**
+ * Queue part of a file to be sent on the connection without taking ownership of the file handle, e.g. files shared by
+ * several responses. release is called with release_arg once the part is sent or the connection closes, so the caller
+ * knows when the file handle is no longer used. Empty parts are released right away. If queuing fails, release is not
+ * called.
+ */
+Error_t connection_queue_borrowed_file_(
+    const ErrorInfo_t ei,
+    struct Connection *conn,
+    const int file_fd,
+    const off_t offset,
+    const size_t nbytes,
+    OutputReleaseFunc release,
+    void *release_arg);
+
+#define event_loop_init(...)        event_loop_init_(ERROR_INFO("event_loop_init"), __VA_ARGS__)
+#define event_loop_run(...)         event_loop_run_(ERROR_INFO("event_loop_run"), __VA_ARGS__)
+#define event_loop_watch_fd(...)    event_loop_watch_fd_(ERROR_INFO("event_loop_watch_fd"), __VA_ARGS__)
+#define connection_begin_body(...)  connection_begin_body_(ERROR_INFO("connection_begin_body"), __VA_ARGS__)
+#define connection_queue_bytes(...) connection_queue_bytes_(ERROR_INFO("connection_queue_bytes"), __VA_ARGS__)
+#define connection_queue_borrowed_bytes(...) \
+    connection_queue_borrowed_bytes_(ERROR_INFO("connection_queue_borrowed_bytes"), __VA_ARGS__)
+#define connection_queue_file(...)  connection_queue_file_(ERROR_INFO("connection_queue_file"), __VA_ARGS__)
+#define connection_queue_borrowed_file(...) \
+    connection_queue_borrowed_file_(ERROR_INFO("connection_queue_borrowed_file"), __VA_ARGS__)
+#define connection_queue_shared_bytes(...) \
+    connection_queue_shared_bytes_(ERROR_INFO("connection_queue_shared_bytes"), __VA_ARGS__)
@@ -0,0 +1,466 @@
+#include "file_cache.h"
+#include "message.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdalign.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// based on:
+// https://man7.org/linux/man-pages/man7/inotify.7.html
+//
+// entries are chained in hash buckets for lookups, and in a list ordered by their last use for eviction. every file is
+// watched with inotify, so a lookup needs no system calls to know the file is unchanged. replacing a file with
+// rename() drops a link of the old file, which is reported as IN_ATTRIB.
+//
+// several url paths may map to the same file, in which case their entries share a watch descriptor.
+//
+// small files are also read into memory, so their responses are sent with the header in a single sendmsg(). the
+// memory budget is kept by evicting the least recently used entries holding a body.
+//
+// precompressed sidecars are entries of their own, keyed by the url path of the original file and their coding. they
+// are looked for as the original file is cached, and remembered in its entry, so they are not looked for again until
+// the original file changes.
+
+#define FILE_CACHE_WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+
+static const char *const SIDECAR_SUFFIXES[HTTP_CODING_COUNT] = {
+    [HTTP_CODING_IDENTITY] = "",
+    [HTTP_CODING_BR] = ".br",
+    [HTTP_CODING_ZSTD] = ".zst",
+    [HTTP_CODING_GZIP] = ".gz",
+};
+
+static uint32_t hash_key(const strview_t url_path, const enum HTTPContentCoding coding)
+{
+    return (uint32_t)strtable_hash(url_path) ^ ((uint32_t)coding * 0x9e3779b9u);
+}
+
+static void lru_unlink(struct FileCache *cache, struct FileCacheEntry *entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_push_front(struct FileCache *cache, struct FileCacheEntry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    }
+    else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+static struct FileCacheEntry *cache_find(
+    const struct FileCache *cache, const strview_t url_path, const enum HTTPContentCoding coding, const uint32_t hash)
+{
+    for (struct FileCacheEntry *entry = cache->buckets[hash & (cache->nbuckets - 1)]; entry;
+         entry = entry->bucket_next) {
+        if (entry->hash == hash && entry->coding == coding && strview_equals(entry->url_path, url_path)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Remove a watch descriptor unless an entry still uses it.
+ */
+static void cache_remove_unused_watch(struct FileCache *cache, const int watch_fd)
+{
+    for (const struct FileCacheEntry *entry = cache->lru_head; entry; entry = entry->lru_next) {
+        if (entry->watch_fd == watch_fd) {
+            return;
+        }
+    }
+    inotify_rm_watch(cache->inotify_fd, watch_fd);
+}
+
+/**
+ * Drop an entry from the cache. The entry is freed once no response uses it.
+ */
+static void cache_remove(struct FileCache *cache, struct FileCacheEntry *entry, const bool remove_watch)
+{
+    struct FileCacheEntry **link = &cache->buckets[entry->hash & (cache->nbuckets - 1)];
+    while (*link != entry) {
+        link = &(*link)->bucket_next;
+    }
+    *link = entry->bucket_next;
+    entry->bucket_next = NULL;
+
+    lru_unlink(cache, entry);
+    if (remove_watch) {
+        cache_remove_unused_watch(cache, entry->watch_fd);
+    }
+    cache->nentries--;
+    cache->nbytes -= entry->size;
+    if (entry->body) {
+        cache->nbody_bytes -= entry->size;
+    }
+    file_cache_entry_release(entry);
+}
+
+/**
+ * Drop every entry of a watch descriptor.
+ */
+static void cache_invalidate_watch(struct FileCache *cache, const int watch_fd, const bool remove_watch)
+{
+    bool removed = false;
+    struct FileCacheEntry *entry = cache->lru_head;
+    while (entry) {
+        struct FileCacheEntry *next = entry->lru_next;
+        if (entry->watch_fd == watch_fd) {
+            cache_remove(cache, entry, false);
+            removed = true;
+        }
+        entry = next;
+    }
+    if (removed && remove_watch) {
+        inotify_rm_watch(cache->inotify_fd, watch_fd);
+    }
+}
+
+Error_t file_cache_init_(const ErrorInfo_t ei, struct FileCache *cache, const struct FileCacheConfig config)
+{
+    RETURN_IF_NULL(ei, cache);
+
+    size_t nbuckets = 16;
+    while (nbuckets < 2 * config.max_files) {
+        nbuckets *= 2;
+    }
+    *cache = (struct FileCache){
+        .config = config,
+        .inotify_fd = -1,
+        .buckets = calloc(nbuckets, sizeof(struct FileCacheEntry *)),
+        .nbuckets = nbuckets,
+    };
+    if (!cache->buckets) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    if ((cache->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+        const int errno_num = errno;
+        free(cache->buckets);
+        cache->buckets = NULL;
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    return NO_ERRORS;
+}
+
+void file_cache_destroy(struct FileCache *cache)
+{
+    if (cache->uncached) {
+        file_cache_entry_release(cache->uncached);
+        cache->uncached = NULL;
+    }
+    while (cache->lru_head) {
+        // closing the inotify instance removes the watches.
+        cache_remove(cache, cache->lru_head, false);
+    }
+    free(cache->buckets);
+    cache->buckets = NULL;
+    if (cache->inotify_fd >= 0) {
+        close(cache->inotify_fd);
+        cache->inotify_fd = -1;
+    }
+}
+
+struct FileCacheEntry *
+file_cache_get(struct FileCache *cache, const strview_t url_path, const enum HTTPContentCoding coding)
+{
+    struct FileCacheEntry *entry = cache_find(cache, url_path, coding, hash_key(url_path, coding));
+    if (!entry) {
+        cache->nmisses++;
+        return NULL;
+    }
+    cache->nhits++;
+    if (entry->body) {
+        cache->nbody_hits++;
+    }
+    else if (entry->size <= cache->config.max_body_size) {
+        cache->nbody_misses++;
+    }
+    if (cache->lru_head != entry) {
+        lru_unlink(cache, entry);
+        lru_push_front(cache, entry);
+    }
+    return entry;
+}
+
+static Error_t entry_render_headers(struct FileCacheEntry *entry)
+{
+    struct ResponseWriter writer;
+    response_writer_init(&writer, sizeof(entry->header), entry->header);
+    response_writer_status(&writer, HTTP_STATUS_OK);
+    response_writer_header(&writer, STRVIEW_FROM("Content-Type"), entry->content_type);
+    response_writer_header_uint(&writer, STRVIEW_FROM("Content-Length"), entry->size);
+    response_writer_header(&writer, STRVIEW_FROM("ETag"), entry->etag);
+    response_writer_header(&writer, STRVIEW_FROM("Last-Modified"), entry->last_modified);
+    response_writer_header(&writer, STRVIEW_FROM("Accept-Ranges"), STRVIEW_FROM("bytes"));
+    if (entry->coding != HTTP_CODING_IDENTITY) {
+        response_writer_header(&writer, STRVIEW_FROM("Content-Encoding"), http_coding_name(entry->coding));
+    }
+    if (entry->coding != HTTP_CODING_IDENTITY || entry->codings != 0) {
+        // caches must not give the encoded file to clients not accepting it, or the other way around.
+        response_writer_header(&writer, STRVIEW_FROM("Vary"), STRVIEW_FROM("Accept-Encoding"));
+    }
+
+    // 304 responses carry the validators the 200 response would have, and no content.
+    struct ResponseWriter not_modified_writer;
+    response_writer_init(&not_modified_writer, sizeof(entry->not_modified_header), entry->not_modified_header);
+    response_writer_status(&not_modified_writer, HTTP_STATUS_NOT_MODIFIED);
+    response_writer_header(&not_modified_writer, STRVIEW_FROM("ETag"), entry->etag);
+    response_writer_header(&not_modified_writer, STRVIEW_FROM("Last-Modified"), entry->last_modified);
+    if (entry->coding != HTTP_CODING_IDENTITY || entry->codings != 0) {
+        response_writer_header(&not_modified_writer, STRVIEW_FROM("Vary"), STRVIEW_FROM("Accept-Encoding"));
+    }
+
+    if (writer.overflowed || not_modified_writer.overflowed) {
+        return error_format_location(
+            ERROR_INFO(__func__),
+            (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "response header does not fit in the cache entry"});
+    }
+    entry->header_len = writer.length;
+    entry->not_modified_header_len = not_modified_writer.length;
+    return NO_ERRORS;
+}
+
+/**
+ * Read a small file into memory. Failing to do so is not an error, as the file can still be sent from disk.
+ */
+static char *read_body(const int file_fd, const size_t size)
+{
+    char *body = malloc(size);
+    if (!body) {
+        return NULL;
+    }
+    size_t nread = 0;
+    while (nread < size) {
+        const ssize_t retval = pread(file_fd, &body[nread], size - nread, (off_t)nread);
+        if (retval < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (retval <= 0) {
+            free(body);
+            return NULL;
+        }
+        nread += (size_t)retval;
+    }
+    return body;
+}
+
+/**
+ * Look for the precompressed sidecars of a file, returning their codings as (1 << coding) bits.
+ */
+static uint32_t find_sidecars(const char *filepath)
+{
+    uint32_t codings = 0;
+    for (size_t coding = HTTP_CODING_IDENTITY + 1; coding < HTTP_CODING_COUNT; coding++) {
+        char sidecar_path[PATH_MAX];
+        struct stat statbuf;
+        const int len = snprintf(sidecar_path, sizeof(sidecar_path), "%s%s", filepath, SIDECAR_SUFFIXES[coding]);
+        if (len > 0 && (size_t)len < sizeof(sidecar_path) && stat(sidecar_path, &statbuf) == 0
+            && S_ISREG(statbuf.st_mode)) {
+            codings |= 1u << coding;
+        }
+    }
+    return codings;
+}
+
+Error_t file_cache_insert_(
+    const ErrorInfo_t ei,
+    struct FileCache *cache,
+    const strview_t url_path,
+    const enum HTTPContentCoding coding,
+    const char *filepath,
+    const strview_t content_type,
+    struct FileCacheEntry **out_entry)
+{
+    RETURN_IF_NULL(ei, cache);
+    RETURN_IF_NULL(ei, filepath);
+    RETURN_IF_NULL(ei, out_entry);
+
+    if (coding >= HTTP_CODING_COUNT) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "unknown content coding"});
+    }
+    char open_path[PATH_MAX];
+    const int open_path_len = snprintf(open_path, sizeof(open_path), "%s%s", filepath, SIDECAR_SUFFIXES[coding]);
+    if (open_path_len < 0 || (size_t)open_path_len >= sizeof(open_path)) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENAMETOOLONG});
+    }
+
+    if (cache->uncached) {
+        file_cache_entry_release(cache->uncached);
+        cache->uncached = NULL;
+    }
+
+    // watch before opening, so changes made in between are not missed.
+    const int watch_fd = inotify_add_watch(cache->inotify_fd, open_path, FILE_CACHE_WATCH_MASK);
+    if (watch_fd == -1) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+
+    const int file_fd = open(open_path, O_RDONLY | O_CLOEXEC);
+    struct stat statbuf;
+    if (file_fd < 0 || fstat(file_fd, &statbuf) == -1) {
+        const int errno_num = errno;
+        if (file_fd >= 0) {
+            close(file_fd);
+        }
+        cache_remove_unused_watch(cache, watch_fd);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    if (!S_ISREG(statbuf.st_mode)) {
+        close(file_fd);
+        cache_remove_unused_watch(cache, watch_fd);
+        return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "not a regular file"});
+    }
+
+    // the key and the file path are stored right after the entry.
+    const size_t filepath_size = strlen(filepath) + 1;
+    struct FileCacheEntry *entry = calloc(1, sizeof(*entry) + url_path.length + filepath_size);
+    if (!entry) {
+        const int errno_num = errno;
+        close(file_fd);
+        cache_remove_unused_watch(cache, watch_fd);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    uint8_t *key = (uint8_t *)(entry + 1);
+    memcpy(key, url_path.buf, url_path.length);
+    memcpy(&key[url_path.length], filepath, filepath_size);
+
+    entry->url_path = strview_from_sized(key, url_path.length);
+    entry->coding = coding;
+    entry->hash = hash_key(url_path, coding);
+    entry->filepath = (const char *)&key[url_path.length];
+    entry->codings = coding == HTTP_CODING_IDENTITY ? find_sidecars(filepath) : 0;
+    entry->file_fd = file_fd;
+    entry->size = (size_t)statbuf.st_size;
+    entry->inode = statbuf.st_ino;
+    entry->mtime = statbuf.st_mtim;
+    entry->content_type = content_type;
+    entry->watch_fd = watch_fd;
+    entry->nrefs = 1;
+
+    const int etag_len = snprintf(
+        entry->etag_buf,
+        sizeof(entry->etag_buf),
+        "\"%jx-%jx-%jx.%lx\"",
+        (uintmax_t)statbuf.st_ino,
+        (uintmax_t)statbuf.st_size,
+        (uintmax_t)statbuf.st_mtim.tv_sec,
+        (unsigned long)statbuf.st_mtim.tv_nsec);
+    entry->etag = strview_from_sized((const uint8_t *)entry->etag_buf, (size_t)etag_len);
+
+    http_format_date(statbuf.st_mtim.tv_sec, entry->last_modified_buf);
+    entry->last_modified = strview_from_sized((const uint8_t *)entry->last_modified_buf, HTTP_DATE_SIZE);
+
+    const Error_t render_error = entry_render_headers(entry);
+    if (render_error.tag != ERROR_NONE) {
+        file_cache_entry_release(entry);
+        cache_remove_unused_watch(cache, watch_fd);
+        return render_error;
+    }
+
+    struct FileCacheEntry *old_entry = cache_find(cache, url_path, coding, entry->hash);
+    if (old_entry) {
+        cache_remove(cache, old_entry, old_entry->watch_fd != watch_fd);
+    }
+    if (entry->size > cache->config.max_bytes || cache->config.max_files == 0) {
+        // too large to be cached. the entry lives until the next insertion, or until released by the caller.
+        entry->watch_fd = -1;
+        cache_remove_unused_watch(cache, watch_fd);
+        cache->uncached = entry;
+        *out_entry = entry;
+        return NO_ERRORS;
+    }
+    while (cache->lru_tail
+           && (cache->nentries >= cache->config.max_files || cache->nbytes + entry->size > cache->config.max_bytes)) {
+        cache_remove(cache, cache->lru_tail, cache->lru_tail->watch_fd != watch_fd);
+    }
+
+    if (entry->size > 0 && entry->size <= cache->config.max_body_size
+        && entry->size <= cache->config.max_body_bytes) {
+        // make room by dropping the least recently used files kept in memory.
+        struct FileCacheEntry *victim = cache->lru_tail;
+        while (victim && cache->nbody_bytes + entry->size > cache->config.max_body_bytes) {
+            struct FileCacheEntry *prev = victim->lru_prev;
+            if (victim->body) {
+                cache_remove(cache, victim, victim->watch_fd != watch_fd);
+            }
+            victim = prev;
+        }
+        if ((entry->body = read_body(file_fd, entry->size)) != NULL) {
+            cache->nbody_bytes += entry->size;
+        }
+    }
+
+    struct FileCacheEntry **bucket = &cache->buckets[entry->hash & (cache->nbuckets - 1)];
+    entry->bucket_next = *bucket;
+    *bucket = entry;
+    lru_push_front(cache, entry);
+    cache->nentries++;
+    cache->nbytes += entry->size;
+
+    *out_entry = entry;
+    return NO_ERRORS;
+}
+
+void file_cache_process_events(struct FileCache *cache)
+{
+    alignas(struct inotify_event) char buf[4096];
+    while (true) {
+        const ssize_t nread = read(cache->inotify_fd, buf, sizeof(buf));
+        if (nread < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (nread <= 0) {
+            // no events left.
+            return;
+        }
+        for (size_t offset = 0; offset < (size_t)nread;) {
+            const struct inotify_event *event = (const struct inotify_event *)&buf[offset];
+            // watches removed by the kernel, e.g. as the file is deleted, are reported with IN_IGNORED.
+            cache_invalidate_watch(cache, event->wd, (event->mask & IN_IGNORED) == 0);
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+}
+
+void file_cache_entry_acquire(struct FileCacheEntry *entry)
+{
+    entry->nrefs++;
+}
+
+void file_cache_entry_release(void *arg)
+{
+    struct FileCacheEntry *entry = arg;
+    if (entry->nrefs > 0) {
+        entry->nrefs--;
+    }
+    if (entry->nrefs == 0) {
+        close(entry->file_fd);
+        free(entry->body);
+        free(entry);
+    }
+}
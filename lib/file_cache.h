@@ -0,0 +1,147 @@
+#pragma once
+
+#include "error.h"
+#include "message.h"
+
+#include "types/strview.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define FILE_CACHE_HEADER_SIZE              (320)
+#define FILE_CACHE_NOT_MODIFIED_HEADER_SIZE (160)
+#define FILE_CACHE_ETAG_SIZE                (64)
+
+/**
+ * Limits on the files kept open by a file cache.
+ */
+struct FileCacheConfig {
+    size_t max_files;      ///< max number of open files, evicting the least recently used
+    size_t max_bytes;      ///< max total size of the open files, evicting the least recently used
+    size_t max_body_size;  ///< max size of files kept in memory, or 0 to keep none
+    size_t max_body_bytes; ///< max total size of the files kept in memory, evicting the least recently used
+};
+
+static const struct FileCacheConfig FILE_CACHE_DEFAULT_CONFIG = {
+    .max_files = 512,
+    .max_bytes = (size_t)1 << 30,
+    .max_body_size = (size_t)64 << 10,
+    .max_body_bytes = (size_t)64 << 20,
+};
+
+/**
+ * Open file and its metadata, looked up by url path and content coding. Files can have precompressed sidecars next to
+ * them, e.g. "style.css.gz" for "style.css", which are cached as entries of their own under the same url path.
+ */
+struct FileCacheEntry {
+    strview_t url_path;                     ///< key of the entry, owned by the entry
+    enum HTTPContentCoding coding;          ///< coding of the file, identity unless it is a sidecar
+    uint32_t hash;                          ///< hash of the url path and coding
+    const char *filepath;                   ///< path of the file without the sidecar suffix, owned by the entry
+    uint32_t codings;                       ///< sidecars found next to the file, as (1 << coding) bits (identity)
+    int file_fd;                            ///< read-only file handle
+    size_t size;                            ///< file size in bytes
+    ino_t inode;                            ///< file inode number
+    struct timespec mtime;                  ///< time of the last modification of the file
+    strview_t content_type;                 ///< mime type of the file, borrowed from the caller
+    strview_t etag;                         ///< entity tag derived from the inode, size and mtime
+    strview_t last_modified;                ///< mtime formatted as an HTTP date
+    int watch_fd;                           ///< inotify watch descriptor of the file
+    size_t nrefs;                           ///< 1 while in the cache, plus 1 per response in flight
+    size_t header_len;                      ///< length of the pre-rendered header
+    size_t not_modified_header_len;         ///< length of the pre-rendered 304 header
+    char *body;                             ///< contents of the file kept in memory, or NULL
+    struct FileCacheEntry *bucket_next;     ///< next entry in the same bucket
+    struct FileCacheEntry *lru_prev;        ///< more recently used entry
+    struct FileCacheEntry *lru_next;        ///< less recently used entry
+    char etag_buf[FILE_CACHE_ETAG_SIZE];    ///< underlying buffer of the entity tag
+    char last_modified_buf[HTTP_DATE_SIZE]; ///< underlying buffer of the last modification date
+
+    /// status line and entity headers of a 200 response, including Content-Encoding and Vary, without the Connection
+    /// header and the empty line
+    char header[FILE_CACHE_HEADER_SIZE];
+
+    /// status line and validators of a 304 response, without the Connection header and the empty line
+    char not_modified_header[FILE_CACHE_NOT_MODIFIED_HEADER_SIZE];
+};
+
+/**
+ * Cache of open files keyed by url path, evicting the least recently used files, and invalidating files as they
+ * change on disk through inotify. Small files are also kept in memory, within a budget, so their responses need no
+ * sendfile(). Sidecars are looked for once, as a file is cached, so negotiating them costs no system calls either.
+ * Not thread-safe: give every worker its own cache.
+ */
+struct FileCache {
+    struct FileCacheConfig config;   ///< limits on the open files
+    int inotify_fd;                  ///< non-blocking inotify instance watching the open files
+    struct FileCacheEntry **buckets; ///< hash buckets of the entries
+    size_t nbuckets;                 ///< number of buckets, a power of two
+    size_t nentries;                 ///< number of entries
+    size_t nbytes;                   ///< total size of the files of the entries
+    size_t nbody_bytes;              ///< total size of the files kept in memory
+    struct FileCacheEntry *lru_head; ///< most recently used entry
+    struct FileCacheEntry *lru_tail; ///< least recently used entry
+    uint64_t nhits;                  ///< number of lookups finding an entry
+    uint64_t nmisses;                ///< number of lookups finding no entry
+    uint64_t nbody_hits;             ///< number of lookups finding a file kept in memory
+    uint64_t nbody_misses;           ///< number of lookups of small files not kept in memory
+    struct FileCacheEntry *uncached; ///< last file inserted without being cached, kept until the next insertion
+};
+
+/**
+ * Initiate an empty file cache.
+ */
+Error_t file_cache_init_(const ErrorInfo_t ei, struct FileCache *cache, const struct FileCacheConfig config);
+
+/**
+ * Drop every entry and close the inotify instance. Entries used by responses in flight are freed once released.
+ */
+void file_cache_destroy(struct FileCache *cache);
+
+/**
+ * Get the entry of a url path in a content coding, or NULL. Costs no system calls.
+ */
+struct FileCacheEntry *
+file_cache_get(struct FileCache *cache, const strview_t url_path, const enum HTTPContentCoding coding);
+
+/**
+ * Open a file, and cache it under a url path, evicting the least recently used files to stay within the limits.
+ * Files larger than the byte limit are not cached, but are still returned. Files up to the body size limit are read
+ * into memory.
+ *
+ * With the identity coding, the file itself is opened, and the sidecars next to it are noted in the codings of the
+ * entry. With other codings, the sidecar of the file in that coding is opened instead.
+ *
+ * The returned entry is only valid until the next call on the cache, unless acquired with file_cache_entry_acquire().
+ */
+Error_t file_cache_insert_(
+    const ErrorInfo_t ei,
+    struct FileCache *cache,
+    const strview_t url_path,
+    const enum HTTPContentCoding coding,
+    const char *filepath,
+    const strview_t content_type,
+    struct FileCacheEntry **out_entry);
+
+/**
+ * Read the pending inotify events, and drop the entries of the files changed since. Call when the inotify file
+ * handle becomes readable.
+ */
+void file_cache_process_events(struct FileCache *cache);
+
+/**
+ * Keep an entry valid, e.g. while a response is sending its file, even if it is dropped from the cache meanwhile.
+ */
+void file_cache_entry_acquire(struct FileCacheEntry *entry);
+
+/**
+ * Release an entry acquired with file_cache_entry_acquire(). Takes a void pointer to be usable as an
+ * OutputReleaseFunc.
+ */
+void file_cache_entry_release(void *entry);
+
+#define file_cache_init(...)   file_cache_init_(ERROR_INFO("file_cache_init"), __VA_ARGS__)
+#define file_cache_insert(...) file_cache_insert_(ERROR_INFO("file_cache_insert"), __VA_ARGS__)
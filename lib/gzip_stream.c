@@ -0,0 +1,154 @@
+#include "gzip_stream.h"
+
+#ifdef HAVE_ZLIB
+
+#include <limits.h>
+#include <string.h>
+
+// based on:
+// https://zlib.net/zlib_how.html
+//
+// the output buffer is laid out as the chunk it becomes:
+//
+//   [ room for the chunk size line ][ compressed bytes ][ CRLF ]
+//
+// the size line is written right before the compressed bytes once the size is known, so every chunk is written with
+// a single call, without copying.
+
+#define CHUNK_END_LEN    (2)
+#define GZIP_WINDOW_BITS (15 + 16) // max window, with a gzip header and trailer
+
+static Error_t zlib_error(const ErrorInfo_t ei, const z_stream *zstream, const int retval)
+{
+    const char *msg = zstream->msg ? zstream->msg : (retval == Z_MEM_ERROR ? "out of memory" : "deflate failed");
+    return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = msg});
+}
+
+static char *stream_data(struct GzipStream *stream)
+{
+    return &stream->buf[HTTP_CHUNK_SIZE_LINE_MAX];
+}
+
+static size_t stream_data_capacity(const struct GzipStream *stream)
+{
+    return stream->capacity - HTTP_CHUNK_SIZE_LINE_MAX - CHUNK_END_LEN;
+}
+
+static void stream_reset_output(struct GzipStream *stream)
+{
+    stream->zstream.next_out = (Bytef *)stream_data(stream);
+    stream->zstream.avail_out = (uInt)stream_data_capacity(stream);
+}
+
+/**
+ * Frame the compressed bytes collected so far as a chunk, write it, and empty the buffer.
+ */
+static Error_t stream_write_chunk(struct GzipStream *stream)
+{
+    const size_t nbytes = stream_data_capacity(stream) - stream->zstream.avail_out;
+    if (nbytes == 0) {
+        return NO_ERRORS;
+    }
+
+    char size_line[HTTP_CHUNK_SIZE_LINE_MAX];
+    const size_t size_line_nbytes = http_format_chunk_size_line(nbytes, size_line);
+
+    char *chunk = stream_data(stream) - size_line_nbytes;
+    memcpy(chunk, size_line, size_line_nbytes);
+    memcpy(stream_data(stream) + nbytes, "\r\n", CHUNK_END_LEN);
+
+    const Error_t e = stream->write(stream->write_arg, size_line_nbytes + nbytes + CHUNK_END_LEN, chunk);
+    if (e.tag != ERROR_NONE) return e;
+    stream_reset_output(stream);
+    return NO_ERRORS;
+}
+
+Error_t gzip_stream_init_(
+    const ErrorInfo_t ei,
+    struct GzipStream *stream,
+    const int level,
+    StreamWriteFunc write,
+    void *write_arg,
+    const size_t buf_size,
+    char *buf)
+{
+    RETURN_IF_NULL(ei, stream);
+    RETURN_IF_NULL(ei, write);
+    RETURN_IF_NULL(ei, buf);
+
+    if (buf_size < GZIP_STREAM_MIN_BUF_SIZE || buf_size > UINT_MAX) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "gzip stream buffer size out of range"});
+    }
+    *stream = (struct GzipStream){
+        .write = write,
+        .write_arg = write_arg,
+        .capacity = buf_size,
+        .buf = buf,
+    };
+    const int retval = deflateInit2(&stream->zstream, level, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY);
+    if (retval != Z_OK) {
+        return zlib_error(ei, &stream->zstream, retval);
+    }
+    stream_reset_output(stream);
+    return NO_ERRORS;
+}
+
+/**
+ * Run deflate on the pending input until it is consumed, or with Z_FINISH, until the stream ends.
+ */
+static Error_t stream_deflate(const ErrorInfo_t ei, struct GzipStream *stream, const int flush)
+{
+    while (true) {
+        const int retval = deflate(&stream->zstream, flush);
+        if (retval == Z_STREAM_ERROR) {
+            return zlib_error(ei, &stream->zstream, retval);
+        }
+        const bool done = (flush == Z_FINISH) ? retval == Z_STREAM_END : stream->zstream.avail_in == 0;
+        if (stream->zstream.avail_out == 0 || (done && flush == Z_FINISH)) {
+            const Error_t e = stream_write_chunk(stream);
+            if (e.tag != ERROR_NONE) return e;
+        }
+        if (done) {
+            return NO_ERRORS;
+        }
+    }
+}
+
+Error_t gzip_stream_write_(const ErrorInfo_t ei, struct GzipStream *stream, const size_t nbytes, const char *buf)
+{
+    RETURN_IF_NULL(ei, stream);
+
+    size_t nleft = nbytes;
+    const char *next = buf;
+    while (nleft > 0) {
+        // avail_in is an unsigned int, so larger inputs are fed in parts.
+        const size_t n = nleft < UINT_MAX ? nleft : UINT_MAX;
+        stream->zstream.next_in = (Bytef *)next;
+        stream->zstream.avail_in = (uInt)n;
+        const Error_t e = stream_deflate(ei, stream, Z_NO_FLUSH);
+        if (e.tag != ERROR_NONE) return e;
+        next += n;
+        nleft -= n;
+    }
+    return NO_ERRORS;
+}
+
+Error_t gzip_stream_finish_(const ErrorInfo_t ei, struct GzipStream *stream)
+{
+    RETURN_IF_NULL(ei, stream);
+
+    stream->zstream.next_in = NULL;
+    stream->zstream.avail_in = 0;
+    Error_t e = stream_deflate(ei, stream, Z_FINISH);
+    if (e.tag != ERROR_NONE) return e;
+
+    return stream->write(stream->write_arg, HTTP_LAST_CHUNK.length, (const char *)HTTP_LAST_CHUNK.buf);
+}
+
+void gzip_stream_destroy(struct GzipStream *stream)
+{
+    deflateEnd(&stream->zstream);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "error.h"
+#include "message.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// only available when zlib was found by the build, which defines HAVE_ZLIB.
+#ifdef HAVE_ZLIB
+
+#include <zlib.h>
+
+#define GZIP_STREAM_MIN_BUF_SIZE (64)
+
+/**
+ * Gzip compressor of a response body of unknown length, emitting it in chunked transfer coding. Compressed bytes are
+ * collected in a caller-provided buffer, and written as one chunk whenever the buffer fills up, so the body is never
+ * held in memory as a whole.
+ */
+struct GzipStream {
+    z_stream zstream;      ///< zlib deflate state
+    StreamWriteFunc write; ///< writes the chunks
+    void *write_arg;       ///< argument passed to write
+    size_t capacity;       ///< size of the output buffer
+    char *buf;             ///< output buffer, with room for the chunk framing around the compressed bytes
+};
+
+/**
+ * Initiate a gzip stream writing chunks with write, collecting the compressed bytes in a buffer of buf_size bytes
+ * (at least GZIP_STREAM_MIN_BUF_SIZE), which must outlive the stream.
+ */
+Error_t gzip_stream_init_(
+    const ErrorInfo_t ei,
+    struct GzipStream *stream,
+    const int level,
+    StreamWriteFunc write,
+    void *write_arg,
+    const size_t buf_size,
+    char *buf);
+
+/**
+ * Compress bytes of the body. Full chunks are written as they come.
+ */
+Error_t gzip_stream_write_(const ErrorInfo_t ei, struct GzipStream *stream, const size_t nbytes, const char *buf);
+
+/**
+ * Compress the rest of the body, and write the last chunks, ending the body.
+ */
+Error_t gzip_stream_finish_(const ErrorInfo_t ei, struct GzipStream *stream);
+
+/**
+ * Free the deflate state of a stream.
+ */
+void gzip_stream_destroy(struct GzipStream *stream);
+
+#define gzip_stream_init(...)   gzip_stream_init_(ERROR_INFO("gzip_stream_init"), __VA_ARGS__)
+#define gzip_stream_write(...)  gzip_stream_write_(ERROR_INFO("gzip_stream_write"), __VA_ARGS__)
+#define gzip_stream_finish(...) gzip_stream_finish_(ERROR_INFO("gzip_stream_finish"), __VA_ARGS__)
+
+#endif
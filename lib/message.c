@@ -4,6 +4,7 @@
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -39,7 +40,7 @@ Error_t tokenize_request_line_(const ErrorInfo_t ei, const strview_t LINE, struc
     }
 
     strview_t CLRS = STRVIEW_EMPTY;
-    if (!strview_find_first(strview_drop(SLASH, 1), STRVIEW_FROM("\r\n"), &CLRS)) {
+    if (!strview_find_crlf(strview_drop(SLASH, 1), &CLRS)) {
         return error_format_location(
             ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "missing CLRS delimiter for Request-Line"});
     }
@@ -87,21 +88,701 @@ Error_t tokenize_header_(const ErrorInfo_t ei, const strview_t LINE, struct HTTP
             ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "missing `:` delimiter in header"});
     }
 
-    strview_t FIELD_VALUE = strview_trim_left(COLON);
+    strview_t FIELD_VALUE = strview_drop(COLON, 1);
+    while (FIELD_VALUE.length > 0 && (FIELD_VALUE.buf[0] == ' ' || FIELD_VALUE.buf[0] == '\t')) {
+        FIELD_VALUE = strview_drop(FIELD_VALUE, 1);
+    }
     strview_t CLRS = STRVIEW_EMPTY;
-    if (!strview_find_first(strview_drop(FIELD_VALUE, 1), STRVIEW_FROM("\r\n"), &CLRS)) {
+    if (!strview_find_crlf(FIELD_VALUE, &CLRS)) {
         return error_format_location(
             ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "missing CLRS delimiter for header"});
     }
 
     // clang-format off
     out->field_name    = strview_take(LINE, (size_t)(COLON.buf - LINE.buf));
-    out->field_content = strview_take(FIELD_VALUE, (size_t)(CLRS.buf - FIELD_VALUE.buf));
+    out->field_content = strview_trim_right(strview_take(FIELD_VALUE, (size_t)(CLRS.buf - FIELD_VALUE.buf)));
+    out->id            = http_header_lookup(out->field_name);
     // clang-format on
 
     return NO_ERRORS;
 }
 
+enum HTTPRequestParserState {
+    PARSER_STATE_START = 0,       ///< before the request line
+    PARSER_STATE_START_LF,        ///< after the CR of an empty line before the request line
+    PARSER_STATE_METHOD,          ///< in the method token
+    PARSER_STATE_URL,             ///< in the request target
+    PARSER_STATE_VERSION,         ///< in the protocol name and version
+    PARSER_STATE_REQUEST_LINE_LF, ///< after the CR ending the request line
+    PARSER_STATE_HEADER_START,    ///< at the start of a header line, or of the empty line ending the header block
+    PARSER_STATE_HEADER_NAME,     ///< in a field name
+    PARSER_STATE_VALUE_START,     ///< in the whitespace before a field value
+    PARSER_STATE_VALUE,           ///< in a field value
+    PARSER_STATE_HEADER_LF,       ///< after the CR ending a header line
+    PARSER_STATE_END_LF,          ///< after the CR ending the header block
+};
+
+static inline bool is_tchar(const uint8_t c)
+{
+    /*
+        tchar = "!" / "#" / "$" / "%" / "&" / "'" / "*"
+              / "+" / "-" / "." / "^" / "_" / "`" / "|" / "~"
+              / DIGIT / ALPHA
+              ; any VCHAR, except delimiters
+    */
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    return c != '\0' && memchr("!#$%&'*+-.^_`|~", c, sizeof("!#$%&'*+-.^_`|~") - 1) != NULL;
+}
+
+static enum HTTPMethod get_http_method(const strview_t name)
+{
+    switch (name.length) {
+    case 3:
+        if (memcmp(name.buf, "GET", 3) == 0) return HTTP_METHOD_GET;
+        if (memcmp(name.buf, "PUT", 3) == 0) return HTTP_METHOD_PUT;
+        break;
+    case 4:
+        if (memcmp(name.buf, "HEAD", 4) == 0) return HTTP_METHOD_HEAD;
+        if (memcmp(name.buf, "POST", 4) == 0) return HTTP_METHOD_POST;
+        break;
+    case 5:
+        if (memcmp(name.buf, "TRACE", 5) == 0) return HTTP_METHOD_TRACE;
+        if (memcmp(name.buf, "PATCH", 5) == 0) return HTTP_METHOD_PATCH;
+        break;
+    case 6:
+        if (memcmp(name.buf, "DELETE", 6) == 0) return HTTP_METHOD_DELETE;
+        break;
+    case 7:
+        if (memcmp(name.buf, "CONNECT", 7) == 0) return HTTP_METHOD_CONNECT;
+        if (memcmp(name.buf, "OPTIONS", 7) == 0) return HTTP_METHOD_OPTIONS;
+        break;
+    }
+    return HTTP_METHOD_UNKNOWN;
+}
+
+static const strview_t HTTP_HEADER_NAMES[HTTP_HEADER_COUNT] = {
+    [HTTP_HEADER_UNKNOWN] = STRVIEW(""),
+    [HTTP_HEADER_ACCEPT] = STRVIEW("Accept"),
+    [HTTP_HEADER_ACCEPT_CHARSET] = STRVIEW("Accept-Charset"),
+    [HTTP_HEADER_ACCEPT_ENCODING] = STRVIEW("Accept-Encoding"),
+    [HTTP_HEADER_ACCEPT_LANGUAGE] = STRVIEW("Accept-Language"),
+    [HTTP_HEADER_AUTHORIZATION] = STRVIEW("Authorization"),
+    [HTTP_HEADER_CACHE_CONTROL] = STRVIEW("Cache-Control"),
+    [HTTP_HEADER_CONNECTION] = STRVIEW("Connection"),
+    [HTTP_HEADER_CONTENT_ENCODING] = STRVIEW("Content-Encoding"),
+    [HTTP_HEADER_CONTENT_LENGTH] = STRVIEW("Content-Length"),
+    [HTTP_HEADER_CONTENT_TYPE] = STRVIEW("Content-Type"),
+    [HTTP_HEADER_COOKIE] = STRVIEW("Cookie"),
+    [HTTP_HEADER_DATE] = STRVIEW("Date"),
+    [HTTP_HEADER_DNT] = STRVIEW("DNT"),
+    [HTTP_HEADER_EXPECT] = STRVIEW("Expect"),
+    [HTTP_HEADER_FORWARDED] = STRVIEW("Forwarded"),
+    [HTTP_HEADER_FROM] = STRVIEW("From"),
+    [HTTP_HEADER_HOST] = STRVIEW("Host"),
+    [HTTP_HEADER_IF_MATCH] = STRVIEW("If-Match"),
+    [HTTP_HEADER_IF_MODIFIED_SINCE] = STRVIEW("If-Modified-Since"),
+    [HTTP_HEADER_IF_NONE_MATCH] = STRVIEW("If-None-Match"),
+    [HTTP_HEADER_IF_RANGE] = STRVIEW("If-Range"),
+    [HTTP_HEADER_IF_UNMODIFIED_SINCE] = STRVIEW("If-Unmodified-Since"),
+    [HTTP_HEADER_KEEP_ALIVE] = STRVIEW("Keep-Alive"),
+    [HTTP_HEADER_MAX_FORWARDS] = STRVIEW("Max-Forwards"),
+    [HTTP_HEADER_ORIGIN] = STRVIEW("Origin"),
+    [HTTP_HEADER_PRAGMA] = STRVIEW("Pragma"),
+    [HTTP_HEADER_PROXY_AUTHORIZATION] = STRVIEW("Proxy-Authorization"),
+    [HTTP_HEADER_RANGE] = STRVIEW("Range"),
+    [HTTP_HEADER_REFERER] = STRVIEW("Referer"),
+    [HTTP_HEADER_SEC_FETCH_DEST] = STRVIEW("Sec-Fetch-Dest"),
+    [HTTP_HEADER_SEC_FETCH_MODE] = STRVIEW("Sec-Fetch-Mode"),
+    [HTTP_HEADER_SEC_FETCH_SITE] = STRVIEW("Sec-Fetch-Site"),
+    [HTTP_HEADER_TE] = STRVIEW("TE"),
+    [HTTP_HEADER_TRAILER] = STRVIEW("Trailer"),
+    [HTTP_HEADER_TRANSFER_ENCODING] = STRVIEW("Transfer-Encoding"),
+    [HTTP_HEADER_UPGRADE] = STRVIEW("Upgrade"),
+    [HTTP_HEADER_UPGRADE_INSECURE_REQUESTS] = STRVIEW("Upgrade-Insecure-Requests"),
+    [HTTP_HEADER_USER_AGENT] = STRVIEW("User-Agent"),
+    [HTTP_HEADER_VIA] = STRVIEW("Via"),
+    [HTTP_HEADER_X_FORWARDED_FOR] = STRVIEW("X-Forwarded-For"),
+    [HTTP_HEADER_X_FORWARDED_PROTO] = STRVIEW("X-Forwarded-Proto"),
+    [HTTP_HEADER_X_REQUESTED_WITH] = STRVIEW("X-Requested-With"),
+};
+
+/**
+ * Compare a field name with a lowercase name. Field names are tokens, so setting the 0x20 bit only folds letters.
+ */
+static inline bool header_name_is(const strview_t name, const char *lowercase_name)
+{
+    for (size_t i = 0; i < name.length; i++) {
+        if ((name.buf[i] | 0x20) != (uint8_t)lowercase_name[i]) return false;
+    }
+    return true;
+}
+
+enum HTTPHeaderId http_header_lookup(const strview_t name)
+{
+    // switch on the length and the first letter, leaving at most a few names to compare with.
+    switch (name.length) {
+    case 2:
+        return header_name_is(name, "te") ? HTTP_HEADER_TE : HTTP_HEADER_UNKNOWN;
+    case 3:
+        switch (name.buf[0] | 0x20) {
+        case 'd':
+            return header_name_is(name, "dnt") ? HTTP_HEADER_DNT : HTTP_HEADER_UNKNOWN;
+        case 'v':
+            return header_name_is(name, "via") ? HTTP_HEADER_VIA : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 4:
+        switch (name.buf[0] | 0x20) {
+        case 'd':
+            return header_name_is(name, "date") ? HTTP_HEADER_DATE : HTTP_HEADER_UNKNOWN;
+        case 'f':
+            return header_name_is(name, "from") ? HTTP_HEADER_FROM : HTTP_HEADER_UNKNOWN;
+        case 'h':
+            return header_name_is(name, "host") ? HTTP_HEADER_HOST : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 5:
+        return header_name_is(name, "range") ? HTTP_HEADER_RANGE : HTTP_HEADER_UNKNOWN;
+    case 6:
+        switch (name.buf[0] | 0x20) {
+        case 'a':
+            return header_name_is(name, "accept") ? HTTP_HEADER_ACCEPT : HTTP_HEADER_UNKNOWN;
+        case 'c':
+            return header_name_is(name, "cookie") ? HTTP_HEADER_COOKIE : HTTP_HEADER_UNKNOWN;
+        case 'e':
+            return header_name_is(name, "expect") ? HTTP_HEADER_EXPECT : HTTP_HEADER_UNKNOWN;
+        case 'o':
+            return header_name_is(name, "origin") ? HTTP_HEADER_ORIGIN : HTTP_HEADER_UNKNOWN;
+        case 'p':
+            return header_name_is(name, "pragma") ? HTTP_HEADER_PRAGMA : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 7:
+        switch (name.buf[0] | 0x20) {
+        case 'r':
+            return header_name_is(name, "referer") ? HTTP_HEADER_REFERER : HTTP_HEADER_UNKNOWN;
+        case 't':
+            return header_name_is(name, "trailer") ? HTTP_HEADER_TRAILER : HTTP_HEADER_UNKNOWN;
+        case 'u':
+            return header_name_is(name, "upgrade") ? HTTP_HEADER_UPGRADE : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 8:
+        switch (name.buf[0] | 0x20) {
+        case 'i':
+            if (header_name_is(name, "if-match")) return HTTP_HEADER_IF_MATCH;
+            return header_name_is(name, "if-range") ? HTTP_HEADER_IF_RANGE : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 9:
+        return header_name_is(name, "forwarded") ? HTTP_HEADER_FORWARDED : HTTP_HEADER_UNKNOWN;
+    case 10:
+        switch (name.buf[0] | 0x20) {
+        case 'c':
+            return header_name_is(name, "connection") ? HTTP_HEADER_CONNECTION : HTTP_HEADER_UNKNOWN;
+        case 'k':
+            return header_name_is(name, "keep-alive") ? HTTP_HEADER_KEEP_ALIVE : HTTP_HEADER_UNKNOWN;
+        case 'u':
+            return header_name_is(name, "user-agent") ? HTTP_HEADER_USER_AGENT : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 12:
+        switch (name.buf[0] | 0x20) {
+        case 'c':
+            return header_name_is(name, "content-type") ? HTTP_HEADER_CONTENT_TYPE : HTTP_HEADER_UNKNOWN;
+        case 'm':
+            return header_name_is(name, "max-forwards") ? HTTP_HEADER_MAX_FORWARDS : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 13:
+        switch (name.buf[0] | 0x20) {
+        case 'a':
+            return header_name_is(name, "authorization") ? HTTP_HEADER_AUTHORIZATION : HTTP_HEADER_UNKNOWN;
+        case 'c':
+            return header_name_is(name, "cache-control") ? HTTP_HEADER_CACHE_CONTROL : HTTP_HEADER_UNKNOWN;
+        case 'i':
+            return header_name_is(name, "if-none-match") ? HTTP_HEADER_IF_NONE_MATCH : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 14:
+        switch (name.buf[0] | 0x20) {
+        case 'a':
+            return header_name_is(name, "accept-charset") ? HTTP_HEADER_ACCEPT_CHARSET : HTTP_HEADER_UNKNOWN;
+        case 'c':
+            return header_name_is(name, "content-length") ? HTTP_HEADER_CONTENT_LENGTH : HTTP_HEADER_UNKNOWN;
+        case 's':
+            if (header_name_is(name, "sec-fetch-dest")) return HTTP_HEADER_SEC_FETCH_DEST;
+            if (header_name_is(name, "sec-fetch-mode")) return HTTP_HEADER_SEC_FETCH_MODE;
+            return header_name_is(name, "sec-fetch-site") ? HTTP_HEADER_SEC_FETCH_SITE : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 15:
+        switch (name.buf[0] | 0x20) {
+        case 'a':
+            if (header_name_is(name, "accept-encoding")) return HTTP_HEADER_ACCEPT_ENCODING;
+            return header_name_is(name, "accept-language") ? HTTP_HEADER_ACCEPT_LANGUAGE : HTTP_HEADER_UNKNOWN;
+        case 'x':
+            return header_name_is(name, "x-forwarded-for") ? HTTP_HEADER_X_FORWARDED_FOR : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 16:
+        switch (name.buf[0] | 0x20) {
+        case 'c':
+            return header_name_is(name, "content-encoding") ? HTTP_HEADER_CONTENT_ENCODING : HTTP_HEADER_UNKNOWN;
+        case 'x':
+            return header_name_is(name, "x-requested-with") ? HTTP_HEADER_X_REQUESTED_WITH : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 17:
+        switch (name.buf[0] | 0x20) {
+        case 'i':
+            return header_name_is(name, "if-modified-since") ? HTTP_HEADER_IF_MODIFIED_SINCE : HTTP_HEADER_UNKNOWN;
+        case 't':
+            return header_name_is(name, "transfer-encoding") ? HTTP_HEADER_TRANSFER_ENCODING : HTTP_HEADER_UNKNOWN;
+        case 'x':
+            return header_name_is(name, "x-forwarded-proto") ? HTTP_HEADER_X_FORWARDED_PROTO : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 19:
+        switch (name.buf[0] | 0x20) {
+        case 'i':
+            return header_name_is(name, "if-unmodified-since") ? HTTP_HEADER_IF_UNMODIFIED_SINCE : HTTP_HEADER_UNKNOWN;
+        case 'p':
+            return header_name_is(name, "proxy-authorization") ? HTTP_HEADER_PROXY_AUTHORIZATION : HTTP_HEADER_UNKNOWN;
+        }
+        break;
+    case 25:
+        return header_name_is(name, "upgrade-insecure-requests") ? HTTP_HEADER_UPGRADE_INSECURE_REQUESTS
+                                                                 : HTTP_HEADER_UNKNOWN;
+    }
+    return HTTP_HEADER_UNKNOWN;
+}
+
+strview_t http_header_name(const enum HTTPHeaderId id)
+{
+    return id < HTTP_HEADER_COUNT ? HTTP_HEADER_NAMES[id] : HTTP_HEADER_NAMES[HTTP_HEADER_UNKNOWN];
+}
+
+void http_request_parser_init(struct HTTPRequestParser *parser)
+{
+    parser->state = PARSER_STATE_START;
+    parser->offset = 0;
+    parser->query_offset = 0;
+    parser->nheaders = 0;
+}
+
+static void fill_request(const struct HTTPRequestParser *parser, const uint8_t *buf, struct HTTPRequest *out)
+{
+    const size_t method_offset = (size_t)(parser->url_offset - parser->method_len - 1);
+    const size_t version_offset = (size_t)parser->url_offset + parser->url_len + sizeof(" HTTP/") - 1;
+
+    out->method_name = strview_from_sized(&buf[method_offset], parser->method_len);
+    out->method = get_http_method(out->method_name);
+    out->url = strview_from_sized(&buf[parser->url_offset], parser->url_len);
+    if (parser->query_offset != 0) {
+        const size_t path_len = (size_t)(parser->query_offset - parser->url_offset);
+        out->path = strview_take(out->url, path_len);
+        out->query = strview_drop(out->url, path_len + 1);
+    }
+    else {
+        out->path = out->url;
+        out->query = STRVIEW_EMPTY;
+    }
+    out->protocol_version = strview_from_sized(&buf[version_offset], 3);
+
+    out->nheaders = parser->nheaders;
+    memset(out->header_slots, 0, sizeof(out->header_slots));
+    for (size_t i = 0; i < parser->nheaders; i++) {
+        out->headers[i].field_name =
+            strview_from_sized(&buf[parser->headers[i].name_offset], parser->headers[i].name_len);
+        out->headers[i].field_content =
+            strview_from_sized(&buf[parser->headers[i].value_offset], parser->headers[i].value_len);
+        out->headers[i].id = (enum HTTPHeaderId)parser->headers[i].id;
+        if (out->headers[i].id != HTTP_HEADER_UNKNOWN && out->header_slots[out->headers[i].id] == 0) {
+            out->header_slots[out->headers[i].id] = (uint8_t)(i + 1);
+        }
+    }
+}
+
+Error_t http_request_parse_(
+    const ErrorInfo_t ei,
+    struct HTTPRequestParser *parser,
+    const strview_t received,
+    struct HTTPRequest *out_request,
+    bool *out_complete)
+{
+    RETURN_IF_NULL(ei, parser);
+    RETURN_IF_NULL(ei, out_request);
+    RETURN_IF_NULL(ei, out_complete);
+
+    /*
+        3. Message Format
+
+         HTTP-message   = start-line
+                          *( header-field CRLF )
+                          CRLF
+                          [ message-body ]
+
+        3.1.1 Request Line
+
+         request-line   = method SP request-target SP HTTP-version CRLF
+
+        3.2 Header Fields
+
+         header-field   = field-name ":" OWS field-value OWS
+    */
+    const uint8_t *buf = received.buf;
+    const size_t end =
+        received.length < HTTP_REQUEST_MAX_HEADER_BLOCK ? received.length : HTTP_REQUEST_MAX_HEADER_BLOCK;
+    const char *error_msg = NULL;
+    bool complete = false;
+
+    size_t i = parser->offset;
+    for (; i < end && !complete && error_msg == NULL; i++) {
+        const uint8_t c = buf[i];
+        switch ((enum HTTPRequestParserState)parser->state) {
+        case PARSER_STATE_START:
+            // "a server that is expecting to receive and parse a request-line SHOULD ignore at least one empty line
+            // (CRLF) received prior to the request-line." (RFC 7230 3.5)
+            if (c == '\r') {
+                parser->state = PARSER_STATE_START_LF;
+            }
+            else if (is_tchar(c)) {
+                parser->token_offset = (uint16_t)i;
+                parser->state = PARSER_STATE_METHOD;
+            }
+            else {
+                error_msg = "invalid method in request line";
+            }
+            break;
+        case PARSER_STATE_START_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            parser->state = PARSER_STATE_START;
+            break;
+        case PARSER_STATE_METHOD:
+            if (c == ' ') {
+                parser->method_len = (uint16_t)(i - parser->token_offset);
+                parser->url_offset = (uint16_t)(i + 1);
+                parser->state = PARSER_STATE_URL;
+            }
+            else if (!is_tchar(c)) {
+                error_msg = "invalid method in request line";
+            }
+            break;
+        case PARSER_STATE_URL:
+            if (c == ' ') {
+                if (i == parser->url_offset) {
+                    error_msg = "missing url in request line";
+                }
+                parser->url_len = (uint16_t)(i - parser->url_offset);
+                parser->token_offset = (uint16_t)(i + 1);
+                parser->state = PARSER_STATE_VERSION;
+            }
+            else if (c == '?' && parser->query_offset == 0) {
+                parser->query_offset = (uint16_t)i;
+            }
+            else if (c < ' ' || c == 0x7f) {
+                error_msg = "invalid character in url";
+            }
+            break;
+        case PARSER_STATE_VERSION:
+            // HTTP-version = "HTTP" "/" DIGIT "." DIGIT
+            if (c == '\r') {
+                const uint8_t *version = &buf[parser->token_offset];
+                if (i - parser->token_offset != sizeof("HTTP/x.x") - 1 || memcmp(version, "HTTP/", 5) != 0
+                    || !isdigit(version[5]) || version[6] != '.' || !isdigit(version[7])) {
+                    error_msg = "invalid protocol version in request line";
+                }
+                parser->state = PARSER_STATE_REQUEST_LINE_LF;
+            }
+            else if (i - parser->token_offset >= sizeof("HTTP/x.x") - 1) {
+                error_msg = "invalid protocol version in request line";
+            }
+            break;
+        case PARSER_STATE_REQUEST_LINE_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            parser->state = PARSER_STATE_HEADER_START;
+            break;
+        case PARSER_STATE_HEADER_START:
+            if (c == '\r') {
+                parser->state = PARSER_STATE_END_LF;
+            }
+            else if (is_tchar(c)) {
+                parser->token_offset = (uint16_t)i;
+                parser->state = PARSER_STATE_HEADER_NAME;
+            }
+            else if (c == ' ' || c == '\t') {
+                // a server MAY reject obs-fold with 400 (RFC 7230 3.2.4)
+                error_msg = "obsolete line folding in header";
+            }
+            else {
+                error_msg = "invalid field name in header";
+            }
+            break;
+        case PARSER_STATE_HEADER_NAME:
+            if (c == ':') {
+                parser->name_len = (uint16_t)(i - parser->token_offset);
+                parser->name_id = (uint8_t)http_header_lookup(
+                    strview_from_sized(&buf[parser->token_offset], parser->name_len));
+                parser->state = PARSER_STATE_VALUE_START;
+            }
+            else if (!is_tchar(c)) {
+                error_msg = "invalid field name in header";
+            }
+            break;
+        case PARSER_STATE_VALUE_START:
+            if (c == ' ' || c == '\t') {
+                break;
+            }
+            parser->value_offset = (uint16_t)i;
+            parser->state = PARSER_STATE_VALUE;
+            [[fallthrough]];
+        case PARSER_STATE_VALUE:
+            if (c == '\r') {
+                if (parser->nheaders == HTTP_REQUEST_MAX_HEADERS) {
+                    error_msg = "too many headers";
+                    break;
+                }
+                size_t value_len = i - parser->value_offset;
+                while (value_len > 0 && (buf[parser->value_offset + value_len - 1] == ' '
+                                         || buf[parser->value_offset + value_len - 1] == '\t')) {
+                    value_len--;
+                }
+                parser->headers[parser->nheaders].name_offset = parser->token_offset;
+                parser->headers[parser->nheaders].name_len = parser->name_len;
+                parser->headers[parser->nheaders].value_offset = parser->value_offset;
+                parser->headers[parser->nheaders].value_len = (uint16_t)value_len;
+                parser->headers[parser->nheaders].id = parser->name_id;
+                parser->nheaders++;
+                parser->state = PARSER_STATE_HEADER_LF;
+            }
+            else if ((c < ' ' && c != '\t') || c == 0x7f) {
+                error_msg = "invalid character in field value";
+            }
+            break;
+        case PARSER_STATE_HEADER_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            parser->state = PARSER_STATE_HEADER_START;
+            break;
+        case PARSER_STATE_END_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            complete = true;
+            break;
+        }
+    }
+
+    if (error_msg != NULL) {
+        http_request_parser_init(parser);
+        return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = error_msg});
+    }
+    if (!complete) {
+        if (i == HTTP_REQUEST_MAX_HEADER_BLOCK) {
+            http_request_parser_init(parser);
+            return error_format_location(
+                ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "request line and headers are too large"});
+        }
+        parser->offset = (uint16_t)i;
+        *out_complete = false;
+        return NO_ERRORS;
+    }
+
+    fill_request(parser, buf, out_request);
+    out_request->length = i;
+    http_request_parser_init(parser);
+    *out_complete = true;
+    return NO_ERRORS;
+}
+
+enum HTTPChunkedDecoderState {
+    CHUNKED_STATE_SIZE = 0,       ///< in the hex digits of a chunk size
+    CHUNKED_STATE_SIZE_EXT,       ///< after the chunk size, skipping chunk extensions
+    CHUNKED_STATE_SIZE_LF,        ///< after the CR of the chunk size line
+    CHUNKED_STATE_DATA,           ///< in the data of a chunk
+    CHUNKED_STATE_DATA_CR,        ///< after the data of a chunk
+    CHUNKED_STATE_DATA_LF,        ///< after the CR following the data of a chunk
+    CHUNKED_STATE_TRAILER,        ///< at the start of a trailer line, or of the empty line ending the body
+    CHUNKED_STATE_TRAILER_LINE,   ///< in a trailer line, skipping it
+    CHUNKED_STATE_END_LF,         ///< after the CR of the empty line ending the body
+    CHUNKED_STATE_DONE,           ///< after the body
+};
+
+void http_chunked_decoder_init(struct HTTPChunkedDecoder *decoder)
+{
+    *decoder = (struct HTTPChunkedDecoder){.state = CHUNKED_STATE_SIZE};
+}
+
+static inline int hex_digit_value(const uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') return (c | 0x20) - 'a' + 10;
+    return -1;
+}
+
+Error_t http_chunked_decode_(
+    const ErrorInfo_t ei,
+    struct HTTPChunkedDecoder *decoder,
+    const strview_t received,
+    size_t *out_nconsumed,
+    strview_t *out_data,
+    bool *out_done)
+{
+    RETURN_IF_NULL(ei, decoder);
+    RETURN_IF_NULL(ei, out_nconsumed);
+    RETURN_IF_NULL(ei, out_data);
+    RETURN_IF_NULL(ei, out_done);
+
+    /*
+        7.1 Chunked Transfer Coding
+
+         chunked-body   = *chunk
+                          last-chunk
+                          trailer-section
+                          CRLF
+
+         chunk          = chunk-size [ chunk-ext ] CRLF
+                          chunk-data CRLF
+         chunk-size     = 1*HEXDIG
+         last-chunk     = 1*("0") [ chunk-ext ] CRLF
+    */
+    const char *error_msg = NULL;
+    *out_data = STRVIEW_EMPTY;
+
+    size_t i = 0;
+    while (i < received.length && decoder->state != CHUNKED_STATE_DONE && error_msg == NULL) {
+        if (decoder->state == CHUNKED_STATE_DATA) {
+            // the data is viewed where it was recieved, up to the end of the chunk.
+            const size_t available = received.length - i;
+            const size_t n = decoder->chunk_left < available ? (size_t)decoder->chunk_left : available;
+            *out_data = strview_from_sized(&received.buf[i], n);
+            decoder->chunk_left -= n;
+            decoder->nbytes_decoded += n;
+            if (decoder->chunk_left == 0) {
+                decoder->state = CHUNKED_STATE_DATA_CR;
+            }
+            i += n;
+            break;
+        }
+
+        const uint8_t c = received.buf[i++];
+        switch ((enum HTTPChunkedDecoderState)decoder->state) {
+        case CHUNKED_STATE_SIZE: {
+            const int digit = hex_digit_value(c);
+            if (digit >= 0) {
+                if (decoder->chunk_left > (UINT64_MAX >> 4)) {
+                    error_msg = "chunk size too large";
+                }
+                decoder->chunk_left = (decoder->chunk_left << 4) | (uint64_t)digit;
+                decoder->line_len++;
+            }
+            else if (decoder->line_len == 0) {
+                error_msg = "missing chunk size";
+            }
+            else if (c == '\r') {
+                decoder->state = CHUNKED_STATE_SIZE_LF;
+            }
+            else if (c == ';' || c == ' ' || c == '\t') {
+                decoder->state = CHUNKED_STATE_SIZE_EXT;
+            }
+            else {
+                error_msg = "invalid chunk size";
+            }
+            break;
+        }
+        case CHUNKED_STATE_SIZE_EXT:
+            if (c == '\r') {
+                decoder->state = CHUNKED_STATE_SIZE_LF;
+            }
+            else if (++decoder->line_len > HTTP_CHUNK_LINE_MAX) {
+                error_msg = "chunk extensions too long";
+            }
+            break;
+        case CHUNKED_STATE_SIZE_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            decoder->line_len = 0;
+            decoder->state = decoder->chunk_left > 0 ? CHUNKED_STATE_DATA : CHUNKED_STATE_TRAILER;
+            break;
+        case CHUNKED_STATE_DATA_CR:
+            if (c != '\r') {
+                error_msg = "missing CRLF after chunk data";
+            }
+            decoder->state = CHUNKED_STATE_DATA_LF;
+            break;
+        case CHUNKED_STATE_DATA_LF:
+            if (c != '\n') {
+                error_msg = "missing CRLF after chunk data";
+            }
+            decoder->state = CHUNKED_STATE_SIZE;
+            break;
+        case CHUNKED_STATE_TRAILER:
+            decoder->state = (c == '\r') ? CHUNKED_STATE_END_LF : CHUNKED_STATE_TRAILER_LINE;
+            break;
+        case CHUNKED_STATE_TRAILER_LINE:
+            // trailer fields are not used, so they are skipped.
+            if (c == '\n') {
+                decoder->line_len = 0;
+                decoder->state = CHUNKED_STATE_TRAILER;
+            }
+            else if (++decoder->line_len > HTTP_CHUNK_LINE_MAX) {
+                error_msg = "trailer field too long";
+            }
+            break;
+        case CHUNKED_STATE_END_LF:
+            if (c != '\n') {
+                error_msg = "missing LF after CR";
+            }
+            decoder->state = CHUNKED_STATE_DONE;
+            break;
+        case CHUNKED_STATE_DATA:
+        case CHUNKED_STATE_DONE:
+            break;
+        }
+    }
+
+    if (error_msg) {
+        http_chunked_decoder_init(decoder);
+        return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = error_msg});
+    }
+    *out_nconsumed = i;
+    *out_done = decoder->state == CHUNKED_STATE_DONE;
+    return NO_ERRORS;
+}
+
+bool http_request_get_header(const struct HTTPRequest *request, const enum HTTPHeaderId id, strview_t *out_content)
+{
+    if (id == HTTP_HEADER_UNKNOWN || id >= HTTP_HEADER_COUNT || request->header_slots[id] == 0) {
+        return false;
+    }
+    *out_content = request->headers[request->header_slots[id] - 1].field_content;
+    return true;
+}
+
+bool http_request_find_header(const struct HTTPRequest *request, const strview_t field_name, strview_t *out_content)
+{
+    const enum HTTPHeaderId id = http_header_lookup(field_name);
+    if (id != HTTP_HEADER_UNKNOWN) {
+        return http_request_get_header(request, id, out_content);
+    }
+    for (size_t i = 0; i < request->nheaders; i++) {
+        if (strview_equals_ignore_case(request->headers[i].field_name, field_name)) {
+            *out_content = request->headers[i].field_content;
+            return true;
+        }
+    }
+    return false;
+}
+
 Error_t assemble_header_(const ErrorInfo_t ei, struct StatusLine status, const strtable_t *headers, strdyn_t *out_buf)
 {
     RETURN_IF_NULL(ei, headers);
@@ -146,11 +827,29 @@ Error_t assemble_header_(const ErrorInfo_t ei, struct StatusLine status, const s
 
     Error_t error = NO_ERRORS;
     do {
-        error = strdyn_empty(out_buf);
-        if (error.tag != ERROR_NONE) break;
+        // a buffer from an earlier response is reused:
+        if (*out_buf) {
+            strdyn_clear(*out_buf);
+        }
+        else {
+            error = strdyn_empty(out_buf);
+            if (error.tag != ERROR_NONE) break;
+        }
 
-        error = strdyn_append_fmt(
-            out_buf, "HTTP/%2s %3s %s\r\n", status.http_version.buf, status.status_code.buf, status.status_desc.buf);
+        // the views are not NUL-terminated, so append them by length:
+        error = strdyn_append_len(out_buf, "HTTP/", 5);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, (const char *)status.http_version.buf, status.http_version.length);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, " ", 1);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, (const char *)status.status_code.buf, status.status_code.length);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, " ", 1);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, (const char *)status.status_desc.buf, status.status_desc.length);
+        if (error.tag != ERROR_NONE) break;
+        error = strdyn_append_len(out_buf, "\r\n", 2);
         if (error.tag != ERROR_NONE) break;
 
         {
@@ -158,16 +857,747 @@ Error_t assemble_header_(const ErrorInfo_t ei, struct StatusLine status, const s
             struct strview value;
 
             size_t idx;
-            FHASHTABLE_FOR_EACH(headers, idx, key, value)
+            STRTABLE_FOR_EACH(headers, idx, key, value)
             {
                 if (error.tag != ERROR_NONE) continue;
-                error = strdyn_append_fmt(out_buf, "%s: %s\r\n", key.buf, value.buf);
+                error = strdyn_append_len(out_buf, (const char *)key.buf, key.length);
+                if (error.tag != ERROR_NONE) continue;
+                error = strdyn_append_len(out_buf, ": ", 2);
+                if (error.tag != ERROR_NONE) continue;
+                error = strdyn_append_len(out_buf, (const char *)value.buf, value.length);
+                if (error.tag != ERROR_NONE) continue;
+                error = strdyn_append_len(out_buf, "\r\n", 2);
             }
             if (error.tag != ERROR_NONE) break;
         }
 
-        error = strdyn_append(out_buf, "\r\n");
+        error = strdyn_append_len(out_buf, "\r\n", 2);
         if (error.tag != ERROR_NONE) break;
     } while (false);
     return error;
 }
+
+strview_t http_status_line(const enum HTTPStatus status)
+{
+    switch (status) {
+    case HTTP_STATUS_CONTINUE:
+        return STRVIEW_FROM("HTTP/1.1 100 Continue\r\n");
+    case HTTP_STATUS_OK:
+        return STRVIEW_FROM("HTTP/1.1 200 OK\r\n");
+    case HTTP_STATUS_NO_CONTENT:
+        return STRVIEW_FROM("HTTP/1.1 204 No Content\r\n");
+    case HTTP_STATUS_PARTIAL_CONTENT:
+        return STRVIEW_FROM("HTTP/1.1 206 Partial Content\r\n");
+    case HTTP_STATUS_MOVED_PERMANENTLY:
+        return STRVIEW_FROM("HTTP/1.1 301 Moved Permanently\r\n");
+    case HTTP_STATUS_FOUND:
+        return STRVIEW_FROM("HTTP/1.1 302 Found\r\n");
+    case HTTP_STATUS_NOT_MODIFIED:
+        return STRVIEW_FROM("HTTP/1.1 304 Not Modified\r\n");
+    case HTTP_STATUS_BAD_REQUEST:
+        return STRVIEW_FROM("HTTP/1.1 400 Bad Request\r\n");
+    case HTTP_STATUS_FORBIDDEN:
+        return STRVIEW_FROM("HTTP/1.1 403 Forbidden\r\n");
+    case HTTP_STATUS_NOT_FOUND:
+        return STRVIEW_FROM("HTTP/1.1 404 Not Found\r\n");
+    case HTTP_STATUS_METHOD_NOT_ALLOWED:
+        return STRVIEW_FROM("HTTP/1.1 405 Method Not Allowed\r\n");
+    case HTTP_STATUS_REQUEST_TIMEOUT:
+        return STRVIEW_FROM("HTTP/1.1 408 Request Timeout\r\n");
+    case HTTP_STATUS_LENGTH_REQUIRED:
+        return STRVIEW_FROM("HTTP/1.1 411 Length Required\r\n");
+    case HTTP_STATUS_PRECONDITION_FAILED:
+        return STRVIEW_FROM("HTTP/1.1 412 Precondition Failed\r\n");
+    case HTTP_STATUS_PAYLOAD_TOO_LARGE:
+        return STRVIEW_FROM("HTTP/1.1 413 Payload Too Large\r\n");
+    case HTTP_STATUS_RANGE_NOT_SATISFIABLE:
+        return STRVIEW_FROM("HTTP/1.1 416 Range Not Satisfiable\r\n");
+    case HTTP_STATUS_EXPECTATION_FAILED:
+        return STRVIEW_FROM("HTTP/1.1 417 Expectation Failed\r\n");
+    case HTTP_STATUS_HEADER_FIELDS_TOO_LARGE:
+        return STRVIEW_FROM("HTTP/1.1 431 Request Header Fields Too Large\r\n");
+    case HTTP_STATUS_INTERNAL_SERVER_ERROR:
+        return STRVIEW_FROM("HTTP/1.1 500 Internal Server Error\r\n");
+    case HTTP_STATUS_NOT_IMPLEMENTED:
+        return STRVIEW_FROM("HTTP/1.1 501 Not Implemented\r\n");
+    case HTTP_STATUS_SERVICE_UNAVAILABLE:
+        return STRVIEW_FROM("HTTP/1.1 503 Service Unavailable\r\n");
+    case HTTP_STATUS_VERSION_NOT_SUPPORTED:
+        return STRVIEW_FROM("HTTP/1.1 505 HTTP Version Not Supported\r\n");
+    }
+    return STRVIEW_FROM("HTTP/1.1 500 Internal Server Error\r\n");
+}
+
+size_t http_format_uint(const uint64_t value, char out_buf[static 20])
+{
+    // write the digits backwards into a scratch buffer, then copy them in order.
+    char digits[20];
+    size_t ndigits = 0;
+    uint64_t rest = value;
+    do {
+        digits[sizeof(digits) - 1 - ndigits++] = (char)('0' + rest % 10);
+        rest /= 10;
+    } while (rest > 0);
+    memcpy(out_buf, &digits[sizeof(digits) - ndigits], ndigits);
+    return ndigits;
+}
+
+void response_writer_init(struct ResponseWriter *writer, const size_t capacity, char *buf)
+{
+    writer->buf = buf;
+    writer->capacity = capacity;
+    writer->length = 0;
+    writer->overflowed = false;
+}
+
+static inline bool response_writer_fits(struct ResponseWriter *writer, const size_t nbytes)
+{
+    if (writer->overflowed || nbytes > writer->capacity - writer->length) {
+        writer->overflowed = true;
+        return false;
+    }
+    return true;
+}
+
+static inline void response_writer_put(struct ResponseWriter *writer, const void *bytes, const size_t nbytes)
+{
+    memcpy(&writer->buf[writer->length], bytes, nbytes);
+    writer->length += nbytes;
+}
+
+void response_writer_status(struct ResponseWriter *writer, const enum HTTPStatus status)
+{
+    const strview_t line = http_status_line(status);
+    if (response_writer_fits(writer, line.length)) {
+        response_writer_put(writer, line.buf, line.length);
+    }
+}
+
+void response_writer_header(struct ResponseWriter *writer, const strview_t name, const strview_t value)
+{
+    if (response_writer_fits(writer, name.length + value.length + 4)) {
+        response_writer_put(writer, name.buf, name.length);
+        response_writer_put(writer, ": ", 2);
+        response_writer_put(writer, value.buf, value.length);
+        response_writer_put(writer, "\r\n", 2);
+    }
+}
+
+void response_writer_header_uint(struct ResponseWriter *writer, const strview_t name, const uint64_t value)
+{
+    char digits[20];
+    const size_t ndigits = http_format_uint(value, digits);
+    response_writer_header(writer, name, strview_from_sized((const uint8_t *)digits, ndigits));
+}
+
+void response_writer_content_range(
+    struct ResponseWriter *writer, const struct HTTPByteRange *range, const uint64_t size)
+{
+    // "bytes first-last/size", or "bytes */size"
+    char value[6 + 20 + 1 + 20 + 1 + 20];
+    size_t length = 0;
+    memcpy(value, "bytes ", 6);
+    length += 6;
+    if (range) {
+        length += http_format_uint(range->first, &value[length]);
+        value[length++] = '-';
+        length += http_format_uint(range->last, &value[length]);
+    }
+    else {
+        value[length++] = '*';
+    }
+    value[length++] = '/';
+    length += http_format_uint(size, &value[length]);
+    response_writer_header(writer, STRVIEW_FROM("Content-Range"), strview_from_sized((const uint8_t *)value, length));
+}
+
+void response_writer_bytes(struct ResponseWriter *writer, const strview_t bytes)
+{
+    if (response_writer_fits(writer, bytes.length)) {
+        response_writer_put(writer, bytes.buf, bytes.length);
+    }
+}
+
+Error_t response_writer_finish_(const ErrorInfo_t ei, struct ResponseWriter *writer)
+{
+    RETURN_IF_NULL(ei, writer);
+
+    if (!response_writer_fits(writer, 2)) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "response header does not fit in the buffer"});
+    }
+    response_writer_put(writer, "\r\n", 2);
+    return NO_ERRORS;
+}
+
+size_t http_format_chunk_size_line(const size_t nbytes, char out_buf[static HTTP_CHUNK_SIZE_LINE_MAX])
+{
+    // write the hex digits backwards into a scratch buffer, then copy them in order.
+    char digits[HTTP_CHUNK_SIZE_LINE_MAX - 2];
+    size_t ndigits = 0;
+    size_t rest = nbytes;
+    do {
+        digits[sizeof(digits) - 1 - ndigits++] = "0123456789abcdef"[rest & 0xf];
+        rest >>= 4;
+    } while (rest > 0);
+    memcpy(out_buf, &digits[sizeof(digits) - ndigits], ndigits);
+    memcpy(&out_buf[ndigits], "\r\n", 2);
+    return ndigits + 2;
+}
+
+Error_t http_write_chunk_(
+    const ErrorInfo_t ei, StreamWriteFunc write, void *write_arg, const size_t nbytes, const char *buf)
+{
+    RETURN_IF_NULL(ei, write);
+
+    if (nbytes == 0) {
+        return NO_ERRORS;
+    }
+    char size_line[HTTP_CHUNK_SIZE_LINE_MAX];
+    const size_t size_line_len = http_format_chunk_size_line(nbytes, size_line);
+
+    Error_t e = write(write_arg, size_line_len, size_line);
+    if (e.tag != ERROR_NONE) return e;
+    e = write(write_arg, nbytes, buf);
+    if (e.tag != ERROR_NONE) return e;
+    return write(write_arg, 2, "\r\n");
+}
+
+bool header_has_token(const strview_t field_content, const strview_t token)
+{
+    strview_t rest = field_content;
+    while (rest.length > 0) {
+        strview_t COMMA = STRVIEW_EMPTY;
+        const bool has_comma = strview_find_firstc(rest, ',', &COMMA);
+        const size_t element_len = has_comma ? (size_t)(COMMA.buf - rest.buf) : rest.length;
+
+        if (strview_equals_ignore_case(strview_trim(strview_take(rest, element_len)), token)) {
+            return true;
+        }
+        rest = has_comma ? strview_drop(COMMA, 1) : STRVIEW_EMPTY;
+    }
+    return false;
+}
+
+bool http_keep_alive(const strview_t protocol_version, const strview_t connection_header)
+{
+    /*
+        6.3 Persistence
+
+        A recipient determines whether a connection is persistent or not
+        based on the most recently received message's protocol version and
+        Connection header field (if any):
+
+        o  If the "close" connection option is present, the connection will
+           not persist after the current response; else,
+
+        o  If the received protocol is HTTP/1.1 (or later), the connection
+           will persist after the current response; else,
+
+        o  If the received protocol is HTTP/1.0, the "keep-alive" connection
+           option is present, [...] the connection will persist after the
+           current response; otherwise,
+
+        o  The connection will close after the current response.
+    */
+    if (header_has_token(connection_header, STRVIEW_FROM("close"))) {
+        return false;
+    }
+    if (strview_equals(protocol_version, STRVIEW_FROM("1.1"))) {
+        return true;
+    }
+    return header_has_token(connection_header, STRVIEW_FROM("keep-alive"));
+}
+
+/**
+ * Parse a decimal number, saturating at UINT64_MAX. Returns the number of digits.
+ */
+static size_t parse_uint_saturating(const strview_t s, uint64_t *out_value)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < s.length && isdigit(s.buf[i]); i++) {
+        const uint64_t digit = (uint64_t)(s.buf[i] - '0');
+        value = (value > (UINT64_MAX - digit) / 10) ? UINT64_MAX : value * 10 + digit;
+    }
+    *out_value = value;
+    return i;
+}
+
+/**
+ * Parse a range spec "first-last", "first-" or "-suffix_length". Returns false if malformed. Unsatisfiable ranges
+ * are parsed, and marked with *out_satisfiable.
+ */
+static bool
+parse_range_spec(const strview_t spec, const uint64_t size, struct HTTPByteRange *out, bool *out_satisfiable)
+{
+    uint64_t first = 0;
+    uint64_t last = 0;
+    const size_t first_len = parse_uint_saturating(spec, &first);
+    if (first_len >= spec.length || spec.buf[first_len] != '-') {
+        return false;
+    }
+    const strview_t rest = strview_drop(spec, first_len + 1);
+    const size_t last_len = parse_uint_saturating(rest, &last);
+    if (last_len != rest.length || (first_len == 0 && last_len == 0)) {
+        return false;
+    }
+
+    if (first_len == 0) {
+        // suffix range: the last bytes of the representation.
+        *out_satisfiable = last > 0 && size > 0;
+        *out = (struct HTTPByteRange){.first = last < size ? size - last : 0, .last = size - 1};
+        return true;
+    }
+    if (last_len > 0 && last < first) {
+        return false;
+    }
+    *out_satisfiable = first < size;
+    *out = (struct HTTPByteRange){.first = first, .last = (last_len == 0 || last >= size) ? size - 1 : last};
+    return true;
+}
+
+enum HTTPRangeResult http_parse_range(
+    const strview_t range_header,
+    const uint64_t size,
+    const size_t max_ranges,
+    struct HTTPByteRange *out_ranges,
+    size_t *out_nranges)
+{
+    /*
+        14.2 Range
+
+        Range = ranges-specifier
+        ranges-specifier = range-unit "=" range-set
+        range-set        = 1#range-spec
+        range-spec       = int-range / suffix-range / other-range
+        int-range        = first-pos "-" [ last-pos ]
+        suffix-range     = "-" suffix-length
+
+        [...] A server that receives a Range header field it does not understand MUST ignore that header field.
+        [...] If all of the conditions are true, the server SHOULD send a 206 (Partial Content) response [...] if
+        none of the ranges are satisfiable, the server SHOULD send a 416 (Range Not Satisfiable) response.
+    */
+    *out_nranges = 0;
+
+    static const strview_t BYTES_UNIT = STRVIEW("bytes=");
+    if (range_header.length < BYTES_UNIT.length
+        || !strview_equals_ignore_case(strview_take(range_header, BYTES_UNIT.length), BYTES_UNIT)) {
+        return HTTP_RANGE_IGNORED;
+    }
+
+    size_t nspecs = 0;
+    strview_t rest = strview_drop(range_header, BYTES_UNIT.length);
+    while (rest.length > 0) {
+        strview_t COMMA = STRVIEW_EMPTY;
+        const bool has_comma = strview_find_firstc(rest, ',', &COMMA);
+        const size_t element_len = has_comma ? (size_t)(COMMA.buf - rest.buf) : rest.length;
+        const strview_t spec = strview_trim(strview_take(rest, element_len));
+        rest = has_comma ? strview_drop(COMMA, 1) : STRVIEW_EMPTY;
+
+        if (spec.length == 0) {
+            continue; // empty list elements are allowed
+        }
+        if (++nspecs > max_ranges) {
+            *out_nranges = 0;
+            return HTTP_RANGE_IGNORED;
+        }
+
+        struct HTTPByteRange range;
+        bool satisfiable = false;
+        if (!parse_range_spec(spec, size, &range, &satisfiable)) {
+            *out_nranges = 0;
+            return HTTP_RANGE_IGNORED;
+        }
+        if (satisfiable) {
+            out_ranges[(*out_nranges)++] = range;
+        }
+    }
+
+    if (nspecs == 0) {
+        return HTTP_RANGE_IGNORED;
+    }
+    return *out_nranges > 0 ? HTTP_RANGE_SATISFIABLE : HTTP_RANGE_NOT_SATISFIABLE;
+}
+
+bool http_if_range_matches(const strview_t if_range_header, const strview_t etag, const strview_t last_modified)
+{
+    /*
+        13.1.5 If-Range
+
+        If-Range = entity-tag / HTTP-date
+
+        [...] A server MUST NOT use a weak entity tag for a range request [...]
+        o  If the HTTP-date validator provided exactly matches the Last-Modified field value [...], the condition is
+           true.
+        o  If the entity-tag validator provided exactly matches the ETag field value [...], the condition is true.
+    */
+    const strview_t validator = strview_trim(if_range_header);
+    // an entity-tag is quoted, or weak with a "W/" prefix. anything else is a date, which may well start with 'W':
+    if (validator.length > 0 && validator.buf[0] == '"') {
+        return strview_equals(validator, etag);
+    }
+    if (strview_equals(strview_take(validator, 2), STRVIEW_FROM("W/"))) {
+        return false;
+    }
+    return last_modified.length > 0 && strview_equals(validator, last_modified);
+}
+
+static const char DAY_NAMES[7][3] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char MONTH_NAMES[12][3] =
+    {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static inline void format_2digits(char *out_buf, const int value)
+{
+    out_buf[0] = (char)('0' + value / 10);
+    out_buf[1] = (char)('0' + value % 10);
+}
+
+void http_format_date(const time_t time, char out_buf[static HTTP_DATE_SIZE])
+{
+    // "Sun, 06 Nov 1994 08:49:37 GMT"
+    struct tm tm;
+    gmtime_r(&time, &tm);
+    memcpy(&out_buf[0], DAY_NAMES[tm.tm_wday], 3);
+    memcpy(&out_buf[3], ", ", 2);
+    format_2digits(&out_buf[5], tm.tm_mday);
+    out_buf[7] = ' ';
+    memcpy(&out_buf[8], MONTH_NAMES[tm.tm_mon], 3);
+    out_buf[11] = ' ';
+    const int year = tm.tm_year + 1900;
+    format_2digits(&out_buf[12], year / 100 % 100);
+    format_2digits(&out_buf[14], year % 100);
+    out_buf[16] = ' ';
+    format_2digits(&out_buf[17], tm.tm_hour);
+    out_buf[19] = ':';
+    format_2digits(&out_buf[20], tm.tm_min);
+    out_buf[22] = ':';
+    format_2digits(&out_buf[23], tm.tm_sec);
+    memcpy(&out_buf[25], " GMT", 4);
+}
+
+/**
+ * Parse a fixed number of digits. Returns -1 if any is not a digit.
+ */
+static int parse_digits(const uint8_t *buf, const size_t ndigits)
+{
+    int value = 0;
+    for (size_t i = 0; i < ndigits; i++) {
+        if (!isdigit(buf[i])) {
+            return -1;
+        }
+        value = value * 10 + (buf[i] - '0');
+    }
+    return value;
+}
+
+bool http_parse_date(const strview_t date, time_t *out_time)
+{
+    const strview_t d = strview_trim(date);
+    if (d.length != HTTP_DATE_SIZE || memcmp(&d.buf[3], ", ", 2) != 0 || d.buf[7] != ' ' || d.buf[11] != ' '
+        || d.buf[16] != ' ' || d.buf[19] != ':' || d.buf[22] != ':' || memcmp(&d.buf[25], " GMT", 4) != 0) {
+        return false;
+    }
+    int month = -1;
+    for (int i = 0; i < 12; i++) {
+        if (memcmp(&d.buf[8], MONTH_NAMES[i], 3) == 0) {
+            month = i;
+            break;
+        }
+    }
+    struct tm tm = {
+        .tm_mday = parse_digits(&d.buf[5], 2),
+        .tm_mon = month,
+        .tm_year = parse_digits(&d.buf[12], 4) - 1900,
+        .tm_hour = parse_digits(&d.buf[17], 2),
+        .tm_min = parse_digits(&d.buf[20], 2),
+        .tm_sec = parse_digits(&d.buf[23], 2),
+    };
+    if (tm.tm_mday < 1 || tm.tm_mday > 31 || tm.tm_mon < 0 || tm.tm_year < 70 - 1900 || tm.tm_hour < 0
+        || tm.tm_hour > 23 || tm.tm_min < 0 || tm.tm_min > 59 || tm.tm_sec < 0 || tm.tm_sec > 60) {
+        return false;
+    }
+    *out_time = timegm(&tm);
+    return true;
+}
+
+/**
+ * Drop the weakness indicator of an entity tag, for the weak comparison.
+ */
+static strview_t etag_opaque_tag(const strview_t etag)
+{
+    if (etag.length >= 2 && etag.buf[0] == 'W' && etag.buf[1] == '/') {
+        return strview_drop(etag, 2);
+    }
+    return etag;
+}
+
+bool http_etag_list_matches(const strview_t if_none_match_header, const strview_t etag)
+{
+    /*
+        13.1.2 If-None-Match
+
+        If-None-Match = "*" / #entity-tag
+
+        [...] A recipient MUST use the weak comparison function when comparing entity tags for If-None-Match [...]
+    */
+    const strview_t opaque_tag = etag_opaque_tag(etag);
+    strview_t rest = strview_trim(if_none_match_header);
+    if (strview_equals(rest, STRVIEW_FROM("*"))) {
+        return true;
+    }
+    while (rest.length > 0) {
+        // entity tags can contain commas, so split after the closing quote.
+        const strview_t tag = strview_trim_left(rest);
+        const size_t prefix_len = (tag.length >= 2 && tag.buf[0] == 'W' && tag.buf[1] == '/') ? 2 : 0;
+        if (tag.length < prefix_len + 2 || tag.buf[prefix_len] != '"') {
+            return false;
+        }
+        strview_t closing_quote = STRVIEW_EMPTY;
+        if (!strview_find_firstc(strview_drop(tag, prefix_len + 1), '"', &closing_quote)) {
+            return false;
+        }
+        const size_t tag_len = (size_t)(closing_quote.buf - tag.buf) + 1;
+        if (strview_equals(etag_opaque_tag(strview_take(tag, tag_len)), opaque_tag)) {
+            return true;
+        }
+
+        rest = strview_trim_left(strview_drop(tag, tag_len));
+        if (rest.length > 0 && rest.buf[0] != ',') {
+            return false;
+        }
+        rest = strview_drop(rest, 1);
+    }
+    return false;
+}
+
+static const strview_t HTTP_CODING_NAMES[HTTP_CODING_COUNT] = {
+    [HTTP_CODING_IDENTITY] = STRVIEW("identity"),
+    [HTTP_CODING_BR] = STRVIEW("br"),
+    [HTTP_CODING_ZSTD] = STRVIEW("zstd"),
+    [HTTP_CODING_GZIP] = STRVIEW("gzip"),
+};
+
+strview_t http_coding_name(const enum HTTPContentCoding coding)
+{
+    return coding < HTTP_CODING_COUNT ? HTTP_CODING_NAMES[coding] : HTTP_CODING_NAMES[HTTP_CODING_IDENTITY];
+}
+
+/**
+ * Parse the weight of an element of a header like Accept-Encoding, in thousandths, from the parameters following its
+ * first ';'. Elements without weight weigh 1000.
+ */
+static unsigned parse_qvalue(const strview_t params)
+{
+    strview_t rest = params;
+    while (rest.length > 0) {
+        strview_t SEMICOLON = STRVIEW_EMPTY;
+        const bool has_semicolon = strview_find_firstc(rest, ';', &SEMICOLON);
+        const size_t param_len = has_semicolon ? (size_t)(SEMICOLON.buf - rest.buf) : rest.length;
+        const strview_t param = strview_trim(strview_take(rest, param_len));
+        rest = has_semicolon ? strview_drop(SEMICOLON, 1) : STRVIEW_EMPTY;
+
+        if (param.length < 3 || (param.buf[0] | 0x20) != 'q' || param.buf[1] != '=') {
+            continue;
+        }
+        // qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] )
+        const strview_t value = strview_drop(param, 2);
+        if (value.buf[0] != '0') {
+            return value.buf[0] == '1' ? 1000 : 0;
+        }
+        unsigned thousandths = 0;
+        unsigned scale = 100;
+        for (size_t i = 2; i < value.length && i < 5 && isdigit(value.buf[i]); i++) {
+            thousandths += (unsigned)(value.buf[i] - '0') * scale;
+            scale /= 10;
+        }
+        return thousandths;
+    }
+    return 1000;
+}
+
+enum HTTPContentCoding http_negotiate_coding(const strview_t accept_encoding_header, const uint32_t available_codings)
+{
+    /*
+        12.5.3 Accept-Encoding
+
+        Accept-Encoding  = #( codings [ weight ] )
+        codings          = content-coding / "identity" / "*"
+
+        [...] An "identity" token is used as a synonym for "no encoding" [...] The asterisk "*" symbol in an
+        Accept-Encoding field matches any available content coding not explicitly listed in the field.
+        [...] A coding with a weight of 0 is "not acceptable".
+    */
+    unsigned qvalues[HTTP_CODING_COUNT] = {0};
+    bool listed[HTTP_CODING_COUNT] = {0};
+    unsigned any_qvalue = 0;
+
+    strview_t rest = accept_encoding_header;
+    while (rest.length > 0) {
+        strview_t COMMA = STRVIEW_EMPTY;
+        const bool has_comma = strview_find_firstc(rest, ',', &COMMA);
+        const strview_t element = strview_take(rest, has_comma ? (size_t)(COMMA.buf - rest.buf) : rest.length);
+        rest = has_comma ? strview_drop(COMMA, 1) : STRVIEW_EMPTY;
+
+        strview_t SEMICOLON = STRVIEW_EMPTY;
+        const bool has_params = strview_find_firstc(element, ';', &SEMICOLON);
+        const strview_t name =
+            strview_trim(strview_take(element, has_params ? (size_t)(SEMICOLON.buf - element.buf) : element.length));
+        const unsigned qvalue = has_params ? parse_qvalue(strview_drop(SEMICOLON, 1)) : 1000;
+
+        if (strview_equals(name, STRVIEW_FROM("*"))) {
+            any_qvalue = qvalue;
+            continue;
+        }
+        for (size_t coding = 0; coding < HTTP_CODING_COUNT; coding++) {
+            if (strview_equals_ignore_case(name, HTTP_CODING_NAMES[coding])
+                || (coding == HTTP_CODING_GZIP && strview_equals_ignore_case(name, STRVIEW_FROM("x-gzip")))) {
+                qvalues[coding] = qvalue;
+                listed[coding] = true;
+                break;
+            }
+        }
+    }
+
+    enum HTTPContentCoding best = HTTP_CODING_IDENTITY;
+    unsigned best_qvalue = 0;
+    for (size_t coding = HTTP_CODING_IDENTITY + 1; coding < HTTP_CODING_COUNT; coding++) {
+        const unsigned qvalue = listed[coding] ? qvalues[coding] : any_qvalue;
+        if ((available_codings & (1u << coding)) && qvalue > best_qvalue) {
+            best = (enum HTTPContentCoding)coding;
+            best_qvalue = qvalue;
+        }
+    }
+    // identity is acceptable unless excluded, but only preferred when weighed higher than the encodings:
+    if (listed[HTTP_CODING_IDENTITY] && qvalues[HTTP_CODING_IDENTITY] > best_qvalue) {
+        return HTTP_CODING_IDENTITY;
+    }
+    return best;
+}
+
+bool http_expects_continue(const struct HTTPRequest *request)
+{
+    // "A server that receives a 100-continue expectation in an HTTP/1.0 request MUST ignore that expectation."
+    strview_t expect = STRVIEW_EMPTY;
+    return strview_equals(request->protocol_version, STRVIEW_FROM("1.1"))
+        && http_request_get_header(request, HTTP_HEADER_EXPECT, &expect)
+        && strview_equals_ignore_case(strview_trim(expect), STRVIEW_FROM("100-continue"));
+}
+
+static Error_t body_reader_fail(
+    const ErrorInfo_t ei, struct HTTPBodyReader *body, const enum HTTPStatus status, const char *error_msg)
+{
+    body->framing = HTTP_BODY_NONE;
+    body->error_status = status;
+    return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = error_msg});
+}
+
+Error_t http_body_reader_init_(
+    const ErrorInfo_t ei, struct HTTPBodyReader *body, const struct HTTPRequest *request, const uint64_t max_size)
+{
+    RETURN_IF_NULL(ei, body);
+    RETURN_IF_NULL(ei, request);
+
+    /*
+        6.3 Message Body Length
+
+        [...] If a message is received with both a Transfer-Encoding and a Content-Length header field, the
+        Transfer-Encoding overrides the Content-Length. Such a message might indicate an attempt to perform request
+        smuggling [...]
+
+        If a Transfer-Encoding header field is present in a request and the chunked transfer coding is not the final
+        encoding, the message body length cannot be determined reliably; the server MUST respond with the 400 (Bad
+        Request) status code and then close the connection.
+
+        If a message is received without Transfer-Encoding and with either multiple Content-Length header fields
+        having differing field-values or a single Content-Length header field having an invalid value, then the
+        message framing is invalid and the recipient MUST treat it as an unrecoverable error.
+    */
+    *body = (struct HTTPBodyReader){.framing = HTTP_BODY_NONE, .max_size = max_size, .error_status = HTTP_STATUS_OK};
+
+    bool has_content_length = false;
+    uint64_t content_length = 0;
+    for (size_t i = 0; i < request->nheaders; i++) {
+        if (request->headers[i].id != HTTP_HEADER_CONTENT_LENGTH) {
+            continue;
+        }
+        const strview_t value = strview_trim(request->headers[i].field_content);
+        uint64_t length = 0;
+        if (value.length == 0 || value.length > 19 || parse_uint_saturating(value, &length) != value.length
+            || (has_content_length && length != content_length)) {
+            return body_reader_fail(ei, body, HTTP_STATUS_BAD_REQUEST, "invalid Content-Length");
+        }
+        has_content_length = true;
+        content_length = length;
+    }
+
+    strview_t transfer_encoding = STRVIEW_EMPTY;
+    if (http_request_get_header(request, HTTP_HEADER_TRANSFER_ENCODING, &transfer_encoding)) {
+        if (has_content_length || !strview_equals(request->protocol_version, STRVIEW_FROM("1.1"))) {
+            return body_reader_fail(ei, body, HTTP_STATUS_BAD_REQUEST, "ambiguous framing of the request body");
+        }
+        // only the chunked coding is supported, so it must be the only one:
+        if (!strview_equals_ignore_case(strview_trim(transfer_encoding), STRVIEW_FROM("chunked"))) {
+            return body_reader_fail(ei, body, HTTP_STATUS_NOT_IMPLEMENTED, "unsupported transfer coding");
+        }
+        body->framing = HTTP_BODY_CHUNKED;
+        http_chunked_decoder_init(&body->chunked);
+        return NO_ERRORS;
+    }
+    if (content_length > max_size) {
+        return body_reader_fail(ei, body, HTTP_STATUS_PAYLOAD_TOO_LARGE, "request body too large");
+    }
+    body->framing = content_length > 0 ? HTTP_BODY_LENGTH : HTTP_BODY_NONE;
+    body->length_left = content_length;
+    return NO_ERRORS;
+}
+
+Error_t http_body_read_(
+    const ErrorInfo_t ei,
+    struct HTTPBodyReader *body,
+    const strview_t received,
+    size_t *out_nconsumed,
+    strview_t *out_data,
+    bool *out_done)
+{
+    RETURN_IF_NULL(ei, body);
+    RETURN_IF_NULL(ei, out_nconsumed);
+    RETURN_IF_NULL(ei, out_data);
+    RETURN_IF_NULL(ei, out_done);
+
+    *out_nconsumed = 0;
+    *out_data = STRVIEW_EMPTY;
+    *out_done = false;
+
+    switch (body->framing) {
+    case HTTP_BODY_NONE:
+        *out_done = true;
+        return NO_ERRORS;
+    case HTTP_BODY_LENGTH: {
+        const size_t n = body->length_left < received.length ? (size_t)body->length_left : received.length;
+        *out_data = strview_take(received, n);
+        *out_nconsumed = n;
+        body->length_left -= n;
+        body->nbytes_read += n;
+        *out_done = body->length_left == 0;
+        break;
+    }
+    case HTTP_BODY_CHUNKED: {
+        const Error_t error = http_chunked_decode_(ei, &body->chunked, received, out_nconsumed, out_data, out_done);
+        if (error.tag != ERROR_NONE) {
+            body->framing = HTTP_BODY_NONE;
+            body->error_status = HTTP_STATUS_BAD_REQUEST;
+            return error;
+        }
+        body->nbytes_read += out_data->length;
+        if (body->nbytes_read > body->max_size) {
+            return body_reader_fail(ei, body, HTTP_STATUS_PAYLOAD_TOO_LARGE, "request body too large");
+        }
+        break;
+    }
+    }
+    if (*out_done) {
+        body->framing = HTTP_BODY_NONE;
+    }
+    return NO_ERRORS;
+}
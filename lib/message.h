@@ -6,7 +6,9 @@
 #include "types/strtable.h"
 #include "types/strview.h"
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 
 struct RequestLine {
     strview_t method;
@@ -15,17 +17,236 @@ struct RequestLine {
     strview_t protocol_version;
 };
 
+/**
+ * Well-known request header field names.
+ */
+enum HTTPHeaderId {
+    HTTP_HEADER_UNKNOWN = 0,
+    HTTP_HEADER_ACCEPT,
+    HTTP_HEADER_ACCEPT_CHARSET,
+    HTTP_HEADER_ACCEPT_ENCODING,
+    HTTP_HEADER_ACCEPT_LANGUAGE,
+    HTTP_HEADER_AUTHORIZATION,
+    HTTP_HEADER_CACHE_CONTROL,
+    HTTP_HEADER_CONNECTION,
+    HTTP_HEADER_CONTENT_ENCODING,
+    HTTP_HEADER_CONTENT_LENGTH,
+    HTTP_HEADER_CONTENT_TYPE,
+    HTTP_HEADER_COOKIE,
+    HTTP_HEADER_DATE,
+    HTTP_HEADER_DNT,
+    HTTP_HEADER_EXPECT,
+    HTTP_HEADER_FORWARDED,
+    HTTP_HEADER_FROM,
+    HTTP_HEADER_HOST,
+    HTTP_HEADER_IF_MATCH,
+    HTTP_HEADER_IF_MODIFIED_SINCE,
+    HTTP_HEADER_IF_NONE_MATCH,
+    HTTP_HEADER_IF_RANGE,
+    HTTP_HEADER_IF_UNMODIFIED_SINCE,
+    HTTP_HEADER_KEEP_ALIVE,
+    HTTP_HEADER_MAX_FORWARDS,
+    HTTP_HEADER_ORIGIN,
+    HTTP_HEADER_PRAGMA,
+    HTTP_HEADER_PROXY_AUTHORIZATION,
+    HTTP_HEADER_RANGE,
+    HTTP_HEADER_REFERER,
+    HTTP_HEADER_SEC_FETCH_DEST,
+    HTTP_HEADER_SEC_FETCH_MODE,
+    HTTP_HEADER_SEC_FETCH_SITE,
+    HTTP_HEADER_TE,
+    HTTP_HEADER_TRAILER,
+    HTTP_HEADER_TRANSFER_ENCODING,
+    HTTP_HEADER_UPGRADE,
+    HTTP_HEADER_UPGRADE_INSECURE_REQUESTS,
+    HTTP_HEADER_USER_AGENT,
+    HTTP_HEADER_VIA,
+    HTTP_HEADER_X_FORWARDED_FOR,
+    HTTP_HEADER_X_FORWARDED_PROTO,
+    HTTP_HEADER_X_REQUESTED_WITH,
+    HTTP_HEADER_COUNT,
+};
+
 struct HTTPHeader {
     strview_t field_name;
     strview_t field_content;
+    enum HTTPHeaderId id; ///< id of the field name, or HTTP_HEADER_UNKNOWN
+};
+
+enum HTTPMethod {
+    HTTP_METHOD_UNKNOWN = 0, ///< method not listed here, see HTTPRequest::method_name
+    HTTP_METHOD_GET,
+    HTTP_METHOD_HEAD,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+    HTTP_METHOD_DELETE,
+    HTTP_METHOD_CONNECT,
+    HTTP_METHOD_OPTIONS,
+    HTTP_METHOD_TRACE,
+    HTTP_METHOD_PATCH,
+    HTTP_METHOD_COUNT,
+};
+
+#define HTTP_REQUEST_MAX_HEADERS      (32)
+#define HTTP_REQUEST_MAX_HEADER_BLOCK (UINT16_MAX)
+
+/**
+ * Request line and headers of a request, viewing the buffer the request was parsed from.
+ */
+struct HTTPRequest {
+    enum HTTPMethod method;                              ///< method of the request
+    strview_t method_name;                               ///< method token as recieved
+    strview_t url;                                       ///< request target, e.g. "/search?q=http"
+    strview_t path;                                      ///< url without the query, e.g. "/search"
+    strview_t query;                                     ///< url after the '?', e.g. "q=http", or empty
+    strview_t protocol_version;                          ///< e.g. "1.1"
+    size_t nheaders;                                     ///< number of headers
+    struct HTTPHeader headers[HTTP_REQUEST_MAX_HEADERS]; ///< headers in the order recieved
+    uint8_t header_slots[HTTP_HEADER_COUNT];             ///< 1 + index of the first header with each id, or 0
+    size_t length;                                       ///< number of bytes of the request line and headers
+};
+
+/**
+ * Progress of parsing a request recieved in parts. Positions are kept as offsets from the start of the request, so the
+ * recieved bytes may be moved between calls.
+ */
+struct HTTPRequestParser {
+    uint8_t state;         ///< what is expected next
+    uint16_t offset;       ///< number of bytes parsed
+    uint16_t token_offset; ///< offset of the token being parsed
+    uint16_t method_len;   ///< length of the method token
+    uint16_t url_offset;   ///< offset of the url
+    uint16_t url_len;      ///< length of the url
+    uint16_t query_offset; ///< offset of the '?' in the url, or 0
+    uint16_t version_len;  ///< length of the protocol version, which ends the request line
+    uint16_t name_len;     ///< length of the field name of the header being parsed
+    uint16_t value_offset; ///< offset of the field content of the header being parsed
+    uint8_t name_id;       ///< id of the field name of the header being parsed
+    uint8_t nheaders;      ///< number of headers parsed
+
+    /// offsets of the headers parsed
+    struct {
+        uint16_t name_offset;
+        uint16_t name_len;
+        uint16_t value_offset;
+        uint16_t value_len;
+        uint8_t id;
+    } headers[HTTP_REQUEST_MAX_HEADERS];
+};
+
+/**
+ * Progress of decoding a body in chunked transfer coding recieved in parts.
+ */
+struct HTTPChunkedDecoder {
+    uint8_t state;           ///< what is expected next
+    uint16_t line_len;       ///< length of the chunk size line or trailer line being skipped
+    uint64_t chunk_left;     ///< number of bytes of the current chunk not decoded yet
+    uint64_t nbytes_decoded; ///< number of bytes of the body decoded so far
 };
 
+#define HTTP_CHUNK_SIZE_LINE_MAX (16 + 2) ///< length of the longest chunk size line written, e.g. "1a\r\n"
+#define HTTP_CHUNK_LINE_MAX      (4096)   ///< max length of recieved chunk size lines and trailer lines
+
+static const strview_t HTTP_LAST_CHUNK = STRVIEW("0\r\n\r\n"); ///< last chunk and empty trailer section
+
+/**
+ * Callback writing the bytes of a stream, e.g. sending them on a connection. Must write all bytes.
+ */
+typedef Error_t (*StreamWriteFunc)(void *arg, const size_t nbytes, const char *buf);
+
 struct StatusLine {
     strview_t http_version;
     strview_t status_code;
     strview_t status_desc;
 };
 
+/**
+ * Status codes with pre-rendered status lines.
+ */
+enum HTTPStatus {
+    HTTP_STATUS_CONTINUE = 100,
+    HTTP_STATUS_OK = 200,
+    HTTP_STATUS_NO_CONTENT = 204,
+    HTTP_STATUS_PARTIAL_CONTENT = 206,
+    HTTP_STATUS_MOVED_PERMANENTLY = 301,
+    HTTP_STATUS_FOUND = 302,
+    HTTP_STATUS_NOT_MODIFIED = 304,
+    HTTP_STATUS_BAD_REQUEST = 400,
+    HTTP_STATUS_FORBIDDEN = 403,
+    HTTP_STATUS_NOT_FOUND = 404,
+    HTTP_STATUS_METHOD_NOT_ALLOWED = 405,
+    HTTP_STATUS_REQUEST_TIMEOUT = 408,
+    HTTP_STATUS_LENGTH_REQUIRED = 411,
+    HTTP_STATUS_PRECONDITION_FAILED = 412,
+    HTTP_STATUS_PAYLOAD_TOO_LARGE = 413,
+    HTTP_STATUS_RANGE_NOT_SATISFIABLE = 416,
+    HTTP_STATUS_EXPECTATION_FAILED = 417,
+    HTTP_STATUS_HEADER_FIELDS_TOO_LARGE = 431,
+    HTTP_STATUS_INTERNAL_SERVER_ERROR = 500,
+    HTTP_STATUS_NOT_IMPLEMENTED = 501,
+    HTTP_STATUS_SERVICE_UNAVAILABLE = 503,
+    HTTP_STATUS_VERSION_NOT_SUPPORTED = 505,
+};
+
+/**
+ * Writer of a response header into a caller-provided buffer. Writes that do not fit mark the writer as overflowed
+ * instead of failing one by one, which is reported by response_writer_finish().
+ */
+struct ResponseWriter {
+    char *buf;       ///< buffer the header is written to
+    size_t capacity; ///< size of the buffer
+    size_t length;   ///< number of bytes written
+    bool overflowed; ///< whether a write did not fit
+};
+
+enum HTTPBodyFraming {
+    HTTP_BODY_NONE = 0, ///< no body
+    HTTP_BODY_LENGTH,   ///< body of Content-Length bytes
+    HTTP_BODY_CHUNKED,  ///< body in chunked transfer coding, ending with the last chunk
+};
+
+/**
+ * Progress of reading the body of a request recieved in parts.
+ */
+struct HTTPBodyReader {
+    enum HTTPBodyFraming framing;      ///< how the end of the body is found
+    uint64_t max_size;                 ///< max number of bytes of the body
+    uint64_t length_left;              ///< number of bytes of the body left (HTTP_BODY_LENGTH)
+    uint64_t nbytes_read;              ///< number of bytes of the body read so far
+    enum HTTPStatus error_status;      ///< status to answer with, once reading the body failed
+    struct HTTPChunkedDecoder chunked; ///< progress decoding the body (HTTP_BODY_CHUNKED)
+};
+
+static const strview_t HTTP_CONTINUE_RESPONSE = STRVIEW("HTTP/1.1 100 Continue\r\n\r\n");
+
+#define HTTP_MAX_RANGES (16)
+#define HTTP_DATE_SIZE  (29) ///< length of an IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+
+/**
+ * Range of bytes of a representation, resolved against its size.
+ */
+struct HTTPByteRange {
+    uint64_t first; ///< offset of the first byte
+    uint64_t last;  ///< offset of the last byte, inclusive
+};
+
+enum HTTPRangeResult {
+    HTTP_RANGE_IGNORED = 0,     ///< no usable Range header: send the whole representation
+    HTTP_RANGE_SATISFIABLE,     ///< send the ranges with 206 Partial Content
+    HTTP_RANGE_NOT_SATISFIABLE, ///< send 416 Range Not Satisfiable
+};
+
+/**
+ * Content codings a representation can be stored in, in the order preferred when the client accepts several equally.
+ */
+enum HTTPContentCoding {
+    HTTP_CODING_IDENTITY = 0, ///< no encoding
+    HTTP_CODING_BR,           ///< brotli
+    HTTP_CODING_ZSTD,         ///< zstandard
+    HTTP_CODING_GZIP,         ///< gzip
+    HTTP_CODING_COUNT,
+};
+
 /**
  * Tokenize request line
  */
@@ -37,10 +258,217 @@ Error_t tokenize_request_line_(const ErrorInfo_t ei, const strview_t line, struc
 Error_t tokenize_header_(const ErrorInfo_t ei, const strview_t line, struct HTTPHeader *out);
 
 /**
- * Assemble response header with 'CLRS' as ending bytes
+ * Reset a parser to parse a new request.
+ */
+void http_request_parser_init(struct HTTPRequestParser *parser);
+
+/**
+ * Parse a request from the start of the recieved bytes in a single pass. Bytes parsed by earlier calls are not looked
+ * at again, so the recieved bytes must start with the same request as before, but may have moved or grown since.
+ *
+ * Sets out_complete and fills out_request once the header block is complete, and resets the parser for the next
+ * request. Otherwise the parser waits for more bytes. Nothing is copied: the request views the recieved bytes.
+ */
+Error_t http_request_parse_(
+    const ErrorInfo_t ei,
+    struct HTTPRequestParser *parser,
+    const strview_t received,
+    struct HTTPRequest *out_request,
+    bool *out_complete);
+
+/**
+ * Initiate a chunked decoder, e.g. before each chunked request body.
+ */
+void http_chunked_decoder_init(struct HTTPChunkedDecoder *decoder);
+
+/**
+ * Decode the next part of a chunked body from the bytes recieved so far, without copying. Chunk framing is skipped
+ * until data is found, which is viewed in out_data, up to the end of its chunk or of the recieved bytes. out_nconsumed
+ * is set to the number of recieved bytes decoded, including the data viewed, which should be marked read once the data
+ * is used. Empty data without out_done means more bytes are needed. Chunk extensions and trailers are skipped.
+ */
+Error_t http_chunked_decode_(
+    const ErrorInfo_t ei,
+    struct HTTPChunkedDecoder *decoder,
+    const strview_t received,
+    size_t *out_nconsumed,
+    strview_t *out_data,
+    bool *out_done);
+
+/**
+ * Get the id of a field name, ignoring case as field names are case-insensitive.
+ */
+enum HTTPHeaderId http_header_lookup(const strview_t field_name);
+
+/**
+ * Get the canonical field name of a header id.
+ */
+strview_t http_header_name(const enum HTTPHeaderId id);
+
+/**
+ * Get the first header with the given id in constant time.
+ */
+bool http_request_get_header(const struct HTTPRequest *request, const enum HTTPHeaderId id, strview_t *out_content);
+
+/**
+ * Get the first header with the given field name, ignoring case. Prefer http_request_get_header() for well-known
+ * headers.
+ */
+bool http_request_find_header(const struct HTTPRequest *request, const strview_t field_name, strview_t *out_content);
+
+/**
+ * Assemble response header with 'CLRS' as ending bytes. The buffer is created if NULL, and otherwise overwritten.
  */
 Error_t assemble_header_(const ErrorInfo_t ei, struct StatusLine status, const strtable_t *headers, strdyn_t *out_buf);
 
-#define tokenize_request_line(...) tokenize_request_line_(ERROR_INFO("tokenize_request_line"), __VA_ARGS__)
-#define tokenize_header(...)       tokenize_header_(ERROR_INFO("tokenize_header"), __VA_ARGS__)
-#define assemble_header(...)       assemble_header_(ERROR_INFO("assemble_header"), __VA_ARGS__)
+/**
+ * Get the status line of a status code, e.g. "HTTP/1.1 200 OK\r\n".
+ */
+strview_t http_status_line(const enum HTTPStatus status);
+
+/**
+ * Write an unsigned integer in decimal without a terminating NUL. Returns the number of characters written, at most
+ * 20.
+ */
+size_t http_format_uint(const uint64_t value, char out_buf[static 20]);
+
+/**
+ * Start writing a response header into buf.
+ */
+void response_writer_init(struct ResponseWriter *writer, const size_t capacity, char *buf);
+
+/**
+ * Write the status line. Must be written first.
+ */
+void response_writer_status(struct ResponseWriter *writer, const enum HTTPStatus status);
+
+/**
+ * Write a header. The name and value must not contain CR or LF.
+ */
+void response_writer_header(struct ResponseWriter *writer, const strview_t name, const strview_t value);
+
+/**
+ * Write a header with an unsigned integer value, e.g. Content-Length.
+ */
+void response_writer_header_uint(struct ResponseWriter *writer, const strview_t name, const uint64_t value);
+
+/**
+ * Write a Content-Range header of a range of a representation, or of an unsatisfied range if range is NULL.
+ */
+void response_writer_content_range(
+    struct ResponseWriter *writer, const struct HTTPByteRange *range, const uint64_t size);
+
+/**
+ * Write raw bytes, e.g. the delimiters of a multipart body.
+ */
+void response_writer_bytes(struct ResponseWriter *writer, const strview_t bytes);
+
+/**
+ * Write the empty line ending the header. Fails if any write did not fit in the buffer.
+ */
+Error_t response_writer_finish_(const ErrorInfo_t ei, struct ResponseWriter *writer);
+
+/**
+ * Format the size line of a chunk of nbytes bytes, to be followed by the bytes and CRLF. Returns its length.
+ */
+size_t http_format_chunk_size_line(const size_t nbytes, char out_buf[static HTTP_CHUNK_SIZE_LINE_MAX]);
+
+/**
+ * Write a chunk of a body in chunked transfer coding, without copying its bytes: the size line, the bytes and the CRLF
+ * are written with three calls of write. Empty chunks are skipped, as they would end the body.
+ */
+Error_t http_write_chunk_(
+    const ErrorInfo_t ei, StreamWriteFunc write, void *write_arg, const size_t nbytes, const char *buf);
+
+/**
+ * Check whether a comma-separated header field content contains a token, ignoring case.
+ */
+bool header_has_token(const strview_t field_content, const strview_t token);
+
+/**
+ * Check whether the connection should persist after the response, given the protocol version of the request and the
+ * content of its Connection header (empty if missing).
+ */
+bool http_keep_alive(const strview_t protocol_version, const strview_t connection_header);
+
+/**
+ * Check whether the client waits for 100 Continue before sending the body of a request.
+ */
+bool http_expects_continue(const struct HTTPRequest *request);
+
+/**
+ * Initiate a body reader for the body of a request, going by its Content-Length and Transfer-Encoding headers. Fails,
+ * setting the error status of the reader, if the framing of the body is invalid (400), uses an unsupported transfer
+ * coding (501), or the body is known to be larger than max_size (413).
+ */
+Error_t http_body_reader_init_(
+    const ErrorInfo_t ei, struct HTTPBodyReader *body, const struct HTTPRequest *request, const uint64_t max_size);
+
+/**
+ * Read the next part of a body from the bytes recieved so far, without copying, as for http_chunked_decode(). Fails,
+ * setting the error status of the reader, if a chunked body turns out to be larger than the max size (413) or is
+ * malformed (400).
+ */
+Error_t http_body_read_(
+    const ErrorInfo_t ei,
+    struct HTTPBodyReader *body,
+    const strview_t received,
+    size_t *out_nconsumed,
+    strview_t *out_data,
+    bool *out_done);
+
+/**
+ * Parse the content of a Range header against a representation of a given size, keeping the satisfiable ranges in
+ * the order requested, clamped to the size. Headers that are malformed, use another unit than bytes, or ask for more
+ * than max_ranges ranges are ignored.
+ */
+enum HTTPRangeResult http_parse_range(
+    const strview_t range_header,
+    const uint64_t size,
+    const size_t max_ranges,
+    struct HTTPByteRange *out_ranges,
+    size_t *out_nranges);
+
+/**
+ * Check whether the content of an If-Range header matches the current representation, given its strong entity tag
+ * and Last-Modified date (empty if unknown). Range headers of requests not matching must be ignored.
+ */
+bool http_if_range_matches(const strview_t if_range_header, const strview_t etag, const strview_t last_modified);
+
+/**
+ * Format a time as an IMF-fixdate, e.g. for the Last-Modified header. Does not depend on the locale.
+ */
+void http_format_date(const time_t time, char out_buf[static HTTP_DATE_SIZE]);
+
+/**
+ * Parse an IMF-fixdate. Returns false on other formats, including the obsolete ones, so conditions on them are
+ * ignored.
+ */
+bool http_parse_date(const strview_t date, time_t *out_time);
+
+/**
+ * Check whether the content of an If-None-Match header matches an entity tag, using the weak comparison.
+ */
+bool http_etag_list_matches(const strview_t if_none_match_header, const strview_t etag);
+
+/**
+ * Get the name of a content coding, as used in the Accept-Encoding and Content-Encoding headers.
+ */
+strview_t http_coding_name(const enum HTTPContentCoding coding);
+
+/**
+ * Choose the content coding to send a representation in, given the content of the Accept-Encoding header (empty if
+ * missing) and the codings available, as a mask of (1 << coding) bits. Codings are chosen by their quality values,
+ * ties going to the smaller encodings. Falls back to identity.
+ */
+enum HTTPContentCoding http_negotiate_coding(const strview_t accept_encoding_header, const uint32_t available_codings);
+
+#define tokenize_request_line(...)  tokenize_request_line_(ERROR_INFO("tokenize_request_line"), __VA_ARGS__)
+#define tokenize_header(...)        tokenize_header_(ERROR_INFO("tokenize_header"), __VA_ARGS__)
+#define assemble_header(...)        assemble_header_(ERROR_INFO("assemble_header"), __VA_ARGS__)
+#define http_request_parse(...)     http_request_parse_(ERROR_INFO("http_request_parse"), __VA_ARGS__)
+#define http_chunked_decode(...)    http_chunked_decode_(ERROR_INFO("http_chunked_decode"), __VA_ARGS__)
+#define http_write_chunk(...)       http_write_chunk_(ERROR_INFO("http_write_chunk"), __VA_ARGS__)
+#define http_body_reader_init(...)  http_body_reader_init_(ERROR_INFO("http_body_reader_init"), __VA_ARGS__)
+#define http_body_read(...)         http_body_read_(ERROR_INFO("http_body_read"), __VA_ARGS__)
+#define response_writer_finish(...) response_writer_finish_(ERROR_INFO("response_writer_finish"), __VA_ARGS__)
@@ -0,0 +1,23 @@
+#include "message.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+int main()
+{
+    const strview_t etag = STRVIEW_FROM("\"670e23cf-3039\"");
+    const strview_t wednesday = STRVIEW_FROM("Wed, 21 Oct 2015 07:28:00 GMT");
+
+    // entity-tags are compared with the ETag:
+    assert(http_if_range_matches(STRVIEW_FROM("\"670e23cf-3039\""), etag, wednesday));
+    assert(!http_if_range_matches(STRVIEW_FROM("\"other\""), etag, wednesday));
+    assert(!http_if_range_matches(STRVIEW_FROM("W/\"670e23cf-3039\""), etag, wednesday));
+
+    // dates are compared with the Last-Modified, also when starting with 'W':
+    assert(http_if_range_matches(wednesday, etag, wednesday));
+    assert(http_if_range_matches(STRVIEW_FROM(" Wed, 21 Oct 2015 07:28:00 GMT "), etag, wednesday));
+    assert(!http_if_range_matches(STRVIEW_FROM("Wed, 21 Oct 2015 07:28:01 GMT"), etag, wednesday));
+    assert(!http_if_range_matches(wednesday, etag, STRVIEW_EMPTY));
+
+    printf("OK\n");
+}
@@ -0,0 +1,386 @@
+#include "mime.h"
+
+#include "types/strtable.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the table is a perfect hash built with "hash and displace": the extensions are put in buckets by their hash, and the
+// buckets, largest first, get the first seed for which the slots of all of their extensions are still free. a lookup
+// then finds the only slot its extension can be in from its hash and the seed of its bucket.
+
+#define MIME_MAX_SEED     ((uint32_t)1 << 20)
+#define MIME_MAX_ATTEMPTS (4)
+
+// bundled copy of the common types of the web, used when no mime.types file is found:
+static const char MIME_TYPES_BUNDLED[] = "text/html                       html htm\n"
+                                         "text/css                        css\n"
+                                         "text/javascript                 js mjs\n"
+                                         "text/plain                      txt text log\n"
+                                         "text/csv                        csv\n"
+                                         "text/markdown                   md markdown\n"
+                                         "text/xml                        xml\n"
+                                         "application/json                json\n"
+                                         "application/ld+json             jsonld\n"
+                                         "application/manifest+json       webmanifest\n"
+                                         "application/wasm                wasm\n"
+                                         "application/pdf                 pdf\n"
+                                         "application/xhtml+xml           xhtml\n"
+                                         "application/rss+xml             rss\n"
+                                         "application/atom+xml            atom\n"
+                                         "application/zip                 zip\n"
+                                         "application/gzip                gz\n"
+                                         "application/x-tar               tar\n"
+                                         "application/octet-stream        bin\n"
+                                         "image/jpeg                      jpeg jpg jpe\n"
+                                         "image/png                       png\n"
+                                         "image/gif                       gif\n"
+                                         "image/webp                      webp\n"
+                                         "image/avif                      avif\n"
+                                         "image/svg+xml                   svg svgz\n"
+                                         "image/vnd.microsoft.icon        ico\n"
+                                         "image/bmp                       bmp\n"
+                                         "image/tiff                      tif tiff\n"
+                                         "font/woff                       woff\n"
+                                         "font/woff2                      woff2\n"
+                                         "font/ttf                        ttf\n"
+                                         "font/otf                        otf\n"
+                                         "audio/mpeg                      mp3\n"
+                                         "audio/ogg                       ogg oga\n"
+                                         "audio/wav                       wav\n"
+                                         "audio/aac                       aac\n"
+                                         "audio/flac                      flac\n"
+                                         "audio/webm                      weba\n"
+                                         "video/mp4                       mp4\n"
+                                         "video/webm                      webm\n"
+                                         "video/ogg                       ogv\n"
+                                         "video/mpeg                      mpeg mpg\n";
+
+static Error_t mime_error(const char *msg)
+{
+    return (Error_t){.tag = ERROR_CUSTOM, .custom_msg = msg};
+}
+
+static uint32_t slot_of(const uint64_t hash, const uint32_t seed, const size_t nslots)
+{
+    uint64_t x = hash ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ull);
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93ull;
+    x ^= x >> 32;
+    return (uint32_t)(x & (nslots - 1));
+}
+
+static size_t round_up_pow2(const size_t n)
+{
+    size_t x = 1;
+    while (x < n) {
+        x <<= 1;
+    }
+    return x;
+}
+
+// splits the text into the media types and their extensions. extensions with a '.', e.g. "tar.gz", are skipped, as only
+// the part after the last '.' of a path is looked up. with out_entries NULL, the extensions are only counted, otherwise
+// they are lowercased and all tokens are NUL-terminated in place.
+static size_t parse_mime_types(char *text, const size_t length, struct MimeEntry *out_entries)
+{
+    size_t count = 0;
+    size_t i = 0;
+    while (i < length) {
+        strview_t type = STRVIEW_EMPTY;
+        bool comment = false;
+        while (i < length && text[i] != '\n') {
+            if (text[i] == '#') {
+                comment = true;
+            }
+            if (comment || isspace((unsigned char)text[i])) {
+                i++;
+                continue;
+            }
+            const size_t begin = i;
+            while (i < length && text[i] != '\n' && text[i] != '#' && !isspace((unsigned char)text[i])) {
+                i++;
+            }
+            const strview_t token = {.length = i - begin, .buf = (const uint8_t *)&text[begin]};
+            const char end = i < length ? text[i] : '\0';
+            if (out_entries && i < length) {
+                text[i] = '\0';
+            }
+
+            if (type.length == 0) {
+                type = token;
+            }
+            else if (token.length <= MIME_MAX_EXTENSION_LENGTH && !memchr(token.buf, '.', token.length)) {
+                if (out_entries) {
+                    for (size_t k = begin; k < i; k++) {
+                        text[k] = (char)tolower((unsigned char)text[k]);
+                    }
+                    out_entries[count] = (struct MimeEntry){.extension = token, .type = type};
+                }
+                count++;
+            }
+            if (end == '\n') {
+                break;
+            }
+            comment = comment || end == '#';
+            i++;
+        }
+        i++;
+    }
+    return count;
+}
+
+// places the extensions in the slots of the table, with out_placed false if some bucket found no seed.
+static Error_t
+place_extensions(struct MimeTable *table, const struct MimeEntry *entries, const size_t n, bool *out_placed)
+{
+    const size_t nbuckets = table->nbuckets;
+    const size_t nslots = table->nslots;
+
+    // sort the extensions by bucket, keeping the order of the file within a bucket:
+    size_t *bucket_begin = calloc(nbuckets + 1, sizeof(*bucket_begin));
+    size_t *order = malloc(n * sizeof(*order));
+    size_t *buckets = malloc(nbuckets * sizeof(*buckets));
+    uint32_t *slots = malloc(n * sizeof(*slots));
+    Error_t e = NO_ERRORS;
+    bool placed = true;
+    if (!bucket_begin || !order || !buckets || !slots) {
+        e = (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+        goto cleanup;
+    }
+    for (size_t i = 0; i < n; i++) {
+        bucket_begin[(entries[i].hash & (nbuckets - 1)) + 1]++;
+    }
+    for (size_t b = 0; b < nbuckets; b++) {
+        bucket_begin[b + 1] += bucket_begin[b];
+    }
+    {
+        size_t *fill = buckets; // reused as the fill position of each bucket until sorted below
+        for (size_t b = 0; b < nbuckets; b++) {
+            fill[b] = bucket_begin[b];
+        }
+        for (size_t i = 0; i < n; i++) {
+            order[fill[entries[i].hash & (nbuckets - 1)]++] = i;
+        }
+    }
+
+    // largest buckets first, while most slots are free:
+    for (size_t b = 0; b < nbuckets; b++) {
+        buckets[b] = b;
+    }
+    for (size_t b = 1; b < nbuckets; b++) {
+        const size_t bucket = buckets[b];
+        const size_t size = bucket_begin[bucket + 1] - bucket_begin[bucket];
+        size_t k = b;
+        while (k > 0 && bucket_begin[buckets[k - 1] + 1] - bucket_begin[buckets[k - 1]] < size) {
+            buckets[k] = buckets[k - 1];
+            k--;
+        }
+        buckets[k] = bucket;
+    }
+
+    for (size_t b = 0; b < nbuckets && placed; b++) {
+        const size_t bucket = buckets[b];
+        const size_t begin = bucket_begin[bucket];
+        const size_t end = bucket_begin[bucket + 1];
+
+        // drop the extensions listed again, which share the bucket of their first listing:
+        size_t nkept = begin;
+        for (size_t i = begin; i < end; i++) {
+            bool seen = false;
+            for (size_t k = begin; k < nkept && !seen; k++) {
+                seen = strview_equals(entries[order[k]].extension, entries[order[i]].extension);
+            }
+            if (!seen) {
+                order[nkept++] = order[i];
+            }
+        }
+
+        uint32_t seed = 0;
+        for (; seed < MIME_MAX_SEED; seed++) {
+            bool fits = true;
+            for (size_t i = begin; i < nkept && fits; i++) {
+                slots[i] = slot_of(entries[order[i]].hash, seed, nslots);
+                fits = table->entries[slots[i]].extension.length == 0;
+                for (size_t k = begin; k < i && fits; k++) {
+                    fits = slots[k] != slots[i];
+                }
+            }
+            if (fits) {
+                break;
+            }
+        }
+        if (seed == MIME_MAX_SEED) {
+            placed = false;
+            break;
+        }
+        table->seeds[bucket] = seed;
+        for (size_t i = begin; i < nkept; i++) {
+            table->entries[slots[i]] = entries[order[i]];
+            table->count++;
+        }
+    }
+
+cleanup:
+    free(bucket_begin);
+    free(order);
+    free(buckets);
+    free(slots);
+    *out_placed = placed;
+    return e;
+}
+
+static Error_t build_table(struct MimeTable *table, const size_t length)
+{
+    const size_t n = parse_mime_types(table->text, length, NULL);
+    if (n == 0) {
+        return NO_ERRORS;
+    }
+    struct MimeEntry *entries = malloc(n * sizeof(*entries));
+    if (!entries) {
+        return (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+    }
+    parse_mime_types(table->text, length, entries);
+    for (size_t i = 0; i < n; i++) {
+        entries[i].hash = strtable_hash(entries[i].extension);
+    }
+
+    // a load of at most 4/5, and 4 extensions per bucket on average. the slots are doubled if placing fails, which
+    // only happens with unlucky hashes:
+    table->nbuckets = round_up_pow2(n / 4 > 0 ? n / 4 : 1);
+    table->nslots = round_up_pow2(n + n / 4 > 8 ? n + n / 4 : 8);
+    table->seeds = calloc(table->nbuckets, sizeof(*table->seeds));
+    if (!table->seeds) {
+        free(entries);
+        return (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+    }
+    for (size_t attempt = 1;; attempt++) {
+        free(table->entries);
+        table->entries = calloc(table->nslots, sizeof(*table->entries));
+        table->count = 0;
+        if (!table->entries) {
+            free(entries);
+            return (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+        }
+        bool placed = false;
+        const Error_t e = place_extensions(table, entries, n, &placed);
+        if (e.tag != ERROR_NONE || placed) {
+            free(entries);
+            return e;
+        }
+        if (attempt == MIME_MAX_ATTEMPTS) {
+            free(entries);
+            return mime_error("no perfect hash found for the extensions of the mime types");
+        }
+        table->nslots <<= 1;
+    }
+}
+
+static Error_t read_file(const char *path, char **out_text, size_t *out_length)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return (Error_t){.tag = ERROR_ERRNO, .errno_num = errno};
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        const int errno_num = errno;
+        close(fd);
+        return (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num};
+    }
+    const size_t size = (size_t)st.st_size;
+    char *text = malloc(size + 1);
+    if (!text) {
+        close(fd);
+        return (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+    }
+    size_t length = 0;
+    while (length < size) {
+        const ssize_t n = read(fd, &text[length], size - length);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            const int errno_num = errno;
+            free(text);
+            close(fd);
+            return (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num};
+        }
+        if (n == 0) {
+            break;
+        }
+        length += (size_t)n;
+    }
+    close(fd);
+    text[length] = '\0';
+    *out_text = text;
+    *out_length = length;
+    return NO_ERRORS;
+}
+
+Error_t mime_table_init_(const ErrorInfo_t ei, struct MimeTable *table, const char *path)
+{
+    RETURN_IF_NULL(ei, table);
+
+    *table = (struct MimeTable){0};
+    size_t length = 0;
+    Error_t e = path ? read_file(path, &table->text, &length) : (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOENT};
+    if (e.tag == ERROR_ERRNO && e.errno_num == ENOENT) {
+        length = sizeof(MIME_TYPES_BUNDLED) - 1;
+        table->text = malloc(length + 1);
+        if (!table->text) {
+            return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM});
+        }
+        memcpy(table->text, MIME_TYPES_BUNDLED, length + 1);
+        e = NO_ERRORS;
+    }
+    if (e.tag != ERROR_NONE) {
+        return error_format_location(ei, e);
+    }
+
+    e = build_table(table, length);
+    if (e.tag != ERROR_NONE) {
+        mime_table_destroy(table);
+        return error_format_location(ei, e);
+    }
+    return NO_ERRORS;
+}
+
+void mime_table_destroy(struct MimeTable *table)
+{
+    free(table->text);
+    free(table->entries);
+    free(table->seeds);
+    *table = (struct MimeTable){0};
+}
+
+strview_t mime_table_lookup(const struct MimeTable *table, const strview_t filepath)
+{
+    strview_t extension;
+    if (table->count == 0 || !strview_find_lastc(filepath, '.', &extension)) {
+        return STRVIEW_FROM(MIME_DEFAULT_TYPE);
+    }
+    extension = strview_drop(extension, 1);
+    if (extension.length == 0 || extension.length > MIME_MAX_EXTENSION_LENGTH ||
+        memchr(extension.buf, '/', extension.length)) {
+        return STRVIEW_FROM(MIME_DEFAULT_TYPE);
+    }
+
+    uint8_t lowered[MIME_MAX_EXTENSION_LENGTH];
+    for (size_t i = 0; i < extension.length; i++) {
+        lowered[i] = (uint8_t)tolower(extension.buf[i]);
+    }
+    const strview_t key = {.length = extension.length, .buf = lowered};
+    const uint64_t hash = strtable_hash(key);
+    const struct MimeEntry *entry =
+        &table->entries[slot_of(hash, table->seeds[hash & (table->nbuckets - 1)], table->nslots)];
+    if (entry->hash != hash || !strview_equals(entry->extension, key)) {
+        return STRVIEW_FROM(MIME_DEFAULT_TYPE);
+    }
+    return entry->type;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "error.h"
+
+#include "types/strview.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MIME_TYPES_PATH           "/etc/mime.types"
+#define MIME_DEFAULT_TYPE         "application/octet-stream"
+#define MIME_MAX_EXTENSION_LENGTH (32)
+
+/**
+ * Extension of a MIME table and its media type.
+ */
+struct MimeEntry {
+    strview_t extension; ///< lowercased extension without the '.', or empty for unused slots
+    strview_t type;      ///< media type, NUL-terminated
+    uint64_t hash;       ///< strtable_hash() of the extension
+};
+
+/**
+ * Media types of file extensions, as listed by a mime.types file: lines of a media type followed by its extensions,
+ * and comments starting with '#'. The first type listed for an extension is used.
+ *
+ * The extensions are placed in a perfect hash table when loaded, so a lookup hashes the extension once, reads the seed
+ * of its bucket, and compares the extension of a single slot. Lookups only read from the table, so a table can be
+ * shared by threads once loaded.
+ */
+struct MimeTable {
+    char *text;                ///< lowercased copy of the text loaded, which the entries view
+    struct MimeEntry *entries; ///< entries by slot
+    uint32_t *seeds;           ///< seed of the slots of the extensions of each bucket
+    size_t nslots;             ///< number of slots, a power of two
+    size_t nbuckets;           ///< number of buckets, a power of two
+    size_t count;              ///< number of extensions
+};
+
+/**
+ * Load the media types of a mime.types file, e.g. MIME_TYPES_PATH. If path is NULL or does not exist, a bundled copy
+ * of the common types of the web is loaded instead.
+ */
+Error_t mime_table_init_(const ErrorInfo_t ei, struct MimeTable *table, const char *path);
+
+/**
+ * Free the memory of the table.
+ */
+void mime_table_destroy(struct MimeTable *table);
+
+/**
+ * Get the media type of the extension of a file path, compared ignoring case, or MIME_DEFAULT_TYPE if it has no
+ * extension or the extension is unknown. The type is NUL-terminated.
+ */
+strview_t mime_table_lookup(const struct MimeTable *table, const strview_t filepath);
+
+#define mime_table_init(...) mime_table_init_(ERROR_INFO("mime_table_init"), __VA_ARGS__)
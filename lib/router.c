@@ -0,0 +1,463 @@
+#include "router.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+// routes are first added to a tree of separately allocated nodes, which is easy to insert into. compiling the router
+// lays the tree out breadth first in a single array, so the static children of a node are contiguous and can be
+// binary searched by their first byte, and the labels of all nodes in a single string.
+//
+// a static label never spans the start of a parameter or wildcard: a node ending with '/' is where they branch off.
+// static children of a node start with distinct bytes, so at most one of them can match. a parameter or wildcard is
+// only tried once the static child did not lead to a route, which makes matching linear in the path length unless
+// routes overlap.
+
+struct RouterBuildNode {
+    char *label;                       ///< static label of the node
+    size_t label_length;               ///< length of the static label
+    char *name;                        ///< name of a parameter or wildcard node
+    size_t name_length;                ///< length of the name
+    struct RouterBuildNode **children; ///< static children, sorted by the first byte of their label
+    size_t nchildren;                  ///< number of static children
+    struct RouterBuildNode *param_child;
+    struct RouterBuildNode *wildcard_child;
+    uint32_t methods;                  ///< (1 << method) bits of the routes ending at the node
+    void *values[HTTP_METHOD_COUNT];   ///< values of the routes ending at the node
+};
+
+static Error_t router_error(const char *msg)
+{
+    return (Error_t){.tag = ERROR_CUSTOM, .custom_msg = msg};
+}
+
+static struct RouterBuildNode *
+build_node_create(struct Router *router, const size_t label_length, const uint8_t *label, const strview_t name)
+{
+    struct RouterBuildNode *node = calloc(1, sizeof(*node));
+    if (!node) {
+        return NULL;
+    }
+    node->label = malloc(label_length + name.length + 1);
+    if (!node->label) {
+        free(node);
+        return NULL;
+    }
+    if (label_length > 0) {
+        memcpy(node->label, label, label_length);
+    }
+    node->label_length = label_length;
+    node->name = &node->label[label_length];
+    memcpy(node->name, name.buf, name.length);
+    node->name_length = name.length;
+    router->nbuild_nodes++;
+    return node;
+}
+
+static void build_node_free(struct RouterBuildNode *node)
+{
+    if (!node) {
+        return;
+    }
+    for (size_t i = 0; i < node->nchildren; i++) {
+        build_node_free(node->children[i]);
+    }
+    build_node_free(node->param_child);
+    build_node_free(node->wildcard_child);
+    free(node->children);
+    free(node->label);
+    free(node);
+}
+
+/**
+ * Add a static child to a node, keeping the children sorted.
+ */
+static struct RouterBuildNode *build_node_add_child(
+    struct Router *router, struct RouterBuildNode *node, const size_t label_length, const uint8_t *label)
+{
+    struct RouterBuildNode **children = realloc(node->children, (node->nchildren + 1) * sizeof(*children));
+    if (!children) {
+        return NULL;
+    }
+    node->children = children;
+    struct RouterBuildNode *child = build_node_create(router, label_length, label, STRVIEW_EMPTY);
+    if (!child) {
+        return NULL;
+    }
+    size_t idx = node->nchildren;
+    while (idx > 0 && (uint8_t)children[idx - 1]->label[0] > label[0]) {
+        children[idx] = children[idx - 1];
+        idx--;
+    }
+    children[idx] = child;
+    node->nchildren++;
+    return child;
+}
+
+/**
+ * Split the static label of a child of a node after the first n bytes, returning the node of the first n bytes.
+ */
+static struct RouterBuildNode *
+build_node_split_child(struct Router *router, struct RouterBuildNode *node, const size_t idx, const size_t n)
+{
+    struct RouterBuildNode *child = node->children[idx];
+    struct RouterBuildNode *parent = build_node_create(router, n, (const uint8_t *)child->label, STRVIEW_EMPTY);
+    if (!parent) {
+        return NULL;
+    }
+    parent->children = malloc(sizeof(*parent->children));
+    if (!parent->children) {
+        build_node_free(parent);
+        router->nbuild_nodes--;
+        return NULL;
+    }
+    parent->children[0] = child;
+    parent->nchildren = 1;
+
+    // the name of a static node is empty, so the rest of the label can be moved in place:
+    memmove(child->label, &child->label[n], child->label_length - n);
+    child->label_length -= n;
+    child->name = &child->label[child->label_length];
+
+    node->children[idx] = parent;
+    return parent;
+}
+
+static size_t find_child(const struct RouterBuildNode *node, const uint8_t c)
+{
+    for (size_t i = 0; i < node->nchildren; i++) {
+        if ((uint8_t)node->children[i]->label[0] == c) {
+            return i;
+        }
+    }
+    return node->nchildren;
+}
+
+/**
+ * Get the length of the static part of a pattern from an offset, up to and including the '/' before the next
+ * parameter or wildcard.
+ */
+static size_t static_length(const strview_t pattern, const size_t offset)
+{
+    for (size_t i = offset; i + 1 < pattern.length; i++) {
+        if (pattern.buf[i] == '/' && (pattern.buf[i + 1] == ':' || pattern.buf[i + 1] == '*')) {
+            return i + 1 - offset;
+        }
+    }
+    return pattern.length - offset;
+}
+
+static Error_t
+router_insert(struct Router *router, const enum HTTPMethod method, const strview_t pattern, void *value)
+{
+    const Error_t enomem = (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM};
+
+    struct RouterBuildNode *node = router->root;
+    size_t nparams = 0;
+    size_t i = 0;
+    while (i < pattern.length) {
+        const uint8_t c = pattern.buf[i];
+        const bool segment_start = i > 0 && pattern.buf[i - 1] == '/';
+
+        if (segment_start && (c == ':' || c == '*')) {
+            size_t end = i + 1;
+            while (end < pattern.length && pattern.buf[end] != '/') {
+                end++;
+            }
+            const strview_t name = strview_from_sized(&pattern.buf[i + 1], end - (i + 1));
+            if (c == ':' && name.length == 0) {
+                return router_error("parameters of routes must be named");
+            }
+            if (c == '*' && end != pattern.length) {
+                return router_error("wildcards of routes must be the last segment");
+            }
+            if (++nparams > ROUTER_MAX_PARAMS) {
+                return router_error("too many parameters in route");
+            }
+
+            struct RouterBuildNode **link = c == ':' ? &node->param_child : &node->wildcard_child;
+            if (!*link) {
+                *link = build_node_create(router, 0, NULL, name);
+                if (!*link) {
+                    return enomem;
+                }
+            }
+            else if (!strview_equals(strview_from_sized((const uint8_t *)(*link)->name, (*link)->name_length), name)) {
+                return router_error("parameters of routes at the same place must have the same name");
+            }
+            node = *link;
+            i = end;
+            continue;
+        }
+
+        const size_t length = static_length(pattern, i);
+        const size_t idx = find_child(node, c);
+        if (idx == node->nchildren) {
+            node = build_node_add_child(router, node, length, &pattern.buf[i]);
+            if (!node) {
+                return enomem;
+            }
+            i += length;
+            continue;
+        }
+
+        struct RouterBuildNode *child = node->children[idx];
+        size_t n = 1;
+        while (n < child->label_length && n < length && (uint8_t)child->label[n] == pattern.buf[i + n]) {
+            n++;
+        }
+        if (n < child->label_length) {
+            child = build_node_split_child(router, node, idx, n);
+            if (!child) {
+                return enomem;
+            }
+        }
+        node = child;
+        i += n;
+    }
+
+    const uint32_t bit = 1u << method;
+    if (node->methods & bit) {
+        return router_error("route was already added");
+    }
+    node->methods |= bit;
+    node->values[method] = value;
+    return NO_ERRORS;
+}
+
+Error_t router_init_(const ErrorInfo_t ei, struct Router *router)
+{
+    RETURN_IF_NULL(ei, router);
+
+    *router = (struct Router){0};
+    router->root = build_node_create(router, 0, NULL, STRVIEW_EMPTY);
+    if (!router->root) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return NO_ERRORS;
+}
+
+void router_destroy(struct Router *router)
+{
+    build_node_free(router->root);
+    free(router->nodes);
+    free(router->labels);
+    free(router->values);
+    *router = (struct Router){0};
+}
+
+Error_t router_add_(
+    const ErrorInfo_t ei, struct Router *router, const enum HTTPMethod method, const strview_t pattern, void *value)
+{
+    RETURN_IF_NULL(ei, router);
+
+    if (!router->root) {
+        return error_format_location(ei, router_error("routes cannot be added once compiled"));
+    }
+    if (pattern.length == 0 || pattern.buf[0] != '/') {
+        return error_format_location(ei, router_error("routes must start with '/'"));
+    }
+    if ((unsigned)method >= HTTP_METHOD_COUNT) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = EINVAL});
+    }
+    const Error_t e = router_insert(router, method, pattern, value);
+    if (e.tag != ERROR_NONE) {
+        return error_format_location(ei, e);
+    }
+    return NO_ERRORS;
+}
+
+Error_t router_compile_(const ErrorInfo_t ei, struct Router *router)
+{
+    RETURN_IF_NULL(ei, router);
+
+    if (!router->root) {
+        return error_format_location(ei, router_error("router was already compiled"));
+    }
+
+    // lay out the nodes breadth first, so the static children of a node end up next to each other:
+    struct RouterBuildNode **queue = malloc(router->nbuild_nodes * sizeof(*queue));
+    struct RouterNode *nodes = calloc(router->nbuild_nodes, sizeof(*nodes));
+    if (!queue || !nodes) {
+        free(queue);
+        free(nodes);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM});
+    }
+    size_t labels_length = 0;
+    size_t nvalues = 0;
+    size_t nqueued = 1;
+    queue[0] = router->root;
+    for (size_t i = 0; i < nqueued; i++) {
+        const struct RouterBuildNode *build = queue[i];
+        struct RouterNode *node = &nodes[i];
+        node->label_offset = (uint32_t)labels_length;
+        node->label_length = (uint32_t)build->label_length;
+        node->name_offset = (uint32_t)(labels_length + build->label_length);
+        node->name_length = (uint32_t)build->name_length;
+        labels_length += build->label_length + build->name_length;
+
+        node->methods = build->methods;
+        node->values_offset = (uint32_t)nvalues;
+        nvalues += (size_t)__builtin_popcount(build->methods);
+
+        node->first_child = (uint32_t)nqueued;
+        node->nchildren = (uint32_t)build->nchildren;
+        for (size_t j = 0; j < build->nchildren; j++) {
+            queue[nqueued++] = build->children[j];
+        }
+        if (build->param_child) {
+            node->param_child = (uint32_t)nqueued;
+            queue[nqueued++] = build->param_child;
+        }
+        if (build->wildcard_child) {
+            node->wildcard_child = (uint32_t)nqueued;
+            queue[nqueued++] = build->wildcard_child;
+        }
+    }
+
+    char *labels = malloc(labels_length + 1);
+    void **values = malloc((nvalues + 1) * sizeof(*values));
+    if (!labels || !values || labels_length > UINT32_MAX) {
+        free(queue);
+        free(nodes);
+        free(labels);
+        free(values);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM});
+    }
+    for (size_t i = 0; i < nqueued; i++) {
+        const struct RouterBuildNode *build = queue[i];
+        const struct RouterNode *node = &nodes[i];
+        memcpy(&labels[node->label_offset], build->label, build->label_length);
+        memcpy(&labels[node->name_offset], build->name, build->name_length);
+        size_t k = node->values_offset;
+        for (size_t m = 0; m < HTTP_METHOD_COUNT; m++) {
+            if (build->methods & (1u << m)) {
+                values[k++] = build->values[m];
+            }
+        }
+    }
+    free(queue);
+
+    build_node_free(router->root);
+    router->root = NULL;
+    router->nodes = nodes;
+    router->nnodes = nqueued;
+    router->labels = labels;
+    router->labels_length = labels_length;
+    router->values = values;
+    router->nvalues = nvalues;
+    return NO_ERRORS;
+}
+
+/**
+ * Match the method against the routes ending at a node.
+ */
+static bool match_methods(
+    const struct Router *router, const struct RouterNode *node, const enum HTTPMethod method, struct RouteMatch *out)
+{
+    uint32_t bit = 1u << method;
+    if (!(node->methods & bit) && method == HTTP_METHOD_HEAD) {
+        bit = 1u << HTTP_METHOD_GET;
+    }
+    if (!(node->methods & bit)) {
+        bit = 1u << HTTP_METHOD_UNKNOWN;
+    }
+    if (!(node->methods & bit)) {
+        out->allowed_methods |= node->methods;
+        return false;
+    }
+    out->value = router->values[node->values_offset + (uint32_t)__builtin_popcount(node->methods & (bit - 1))];
+    return true;
+}
+
+static void push_param(
+    const struct Router *router, const struct RouterNode *node, const strview_t value, struct RouteMatch *out)
+{
+    out->params[out->nparams++] = (struct RouteParam){
+        .name = strview_from_sized((const uint8_t *)&router->labels[node->name_offset], node->name_length),
+        .value = value,
+    };
+}
+
+/**
+ * Match the rest of the path after a node against its children.
+ */
+static bool match_node(
+    const struct Router *router,
+    const struct RouterNode *node,
+    const enum HTTPMethod method,
+    const strview_t rest,
+    struct RouteMatch *out)
+{
+    if (rest.length == 0 && node->methods != 0 && match_methods(router, node, method, out)) {
+        return true;
+    }
+
+    if (rest.length > 0 && node->nchildren > 0) {
+        const struct RouterNode *children = &router->nodes[node->first_child];
+        size_t lo = 0;
+        size_t hi = node->nchildren;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if ((uint8_t)router->labels[children[mid].label_offset] < rest.buf[0]) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        if (lo < node->nchildren) {
+            const struct RouterNode *child = &children[lo];
+            if (child->label_length <= rest.length
+                && memcmp(&router->labels[child->label_offset], rest.buf, child->label_length) == 0
+                && match_node(router, child, method, strview_drop(rest, child->label_length), out)) {
+                return true;
+            }
+        }
+    }
+
+    if (node->param_child && rest.length > 0 && rest.buf[0] != '/' && out->nparams < ROUTER_MAX_PARAMS) {
+        size_t length = 1;
+        while (length < rest.length && rest.buf[length] != '/') {
+            length++;
+        }
+        const struct RouterNode *param = &router->nodes[node->param_child];
+        push_param(router, param, strview_take(rest, length), out);
+        if (match_node(router, param, method, strview_drop(rest, length), out)) {
+            return true;
+        }
+        out->nparams--;
+    }
+
+    if (node->wildcard_child && out->nparams < ROUTER_MAX_PARAMS) {
+        const struct RouterNode *wildcard = &router->nodes[node->wildcard_child];
+        push_param(router, wildcard, rest, out);
+        if (wildcard->methods != 0 && match_methods(router, wildcard, method, out)) {
+            return true;
+        }
+        out->nparams--;
+    }
+    return false;
+}
+
+bool router_match(
+    const struct Router *router, const enum HTTPMethod method, const strview_t path, struct RouteMatch *out_match)
+{
+    out_match->value = NULL;
+    out_match->allowed_methods = 0;
+    out_match->nparams = 0;
+    if (!router->nodes || (unsigned)method >= HTTP_METHOD_COUNT) {
+        return false;
+    }
+    return match_node(router, &router->nodes[0], method, path, out_match);
+}
+
+strview_t route_match_param(const struct RouteMatch *match, const strview_t name)
+{
+    for (size_t i = 0; i < match->nparams; i++) {
+        if (strview_equals(match->params[i].name, name)) {
+            return match->params[i].value;
+        }
+    }
+    return STRVIEW_EMPTY;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "error.h"
+#include "message.h"
+
+#include "types/strview.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ROUTER_MAX_PARAMS (8)
+
+/**
+ * Node of a compiled router. The static children of a node are contiguous, and sorted by the first byte of their
+ * label.
+ */
+struct RouterNode {
+    uint32_t label_offset;   ///< offset of the static label in the labels of the router
+    uint32_t label_length;   ///< length of the static label, 0 for parameters and wildcards
+    uint32_t first_child;    ///< index of the first static child
+    uint32_t nchildren;      ///< number of static children
+    uint32_t param_child;    ///< index of the ":param" child, or 0
+    uint32_t wildcard_child; ///< index of the "*wildcard" child, or 0
+    uint32_t name_offset;    ///< offset of the parameter name in the labels of the router
+    uint32_t name_length;    ///< length of the parameter name
+    uint32_t methods;        ///< (1 << method) bits of the routes ending at the node
+    uint32_t values_offset;  ///< offset of the values of the routes ending at the node, one per bit of methods
+};
+
+struct RouterBuildNode;
+
+/**
+ * Router matching request paths against routes registered per method. Route patterns are made of segments, each
+ * either:
+ *
+ * - static, e.g. "/users/all", matched exactly
+ * - a parameter, e.g. "/users/:id", matching a single non-empty segment
+ * - a wildcard, e.g. "*path" or "*" after "/css/", matching the rest of the path, also when empty, as a prefix route
+ *
+ * A wildcard must be the last segment. Static segments take precedence over parameters, which take precedence over
+ * wildcards.
+ *
+ * Routes are added to a tree, which router_compile() flattens into a radix trie of contiguous nodes. Matching is then
+ * linear in the path length, and allocates nothing.
+ */
+struct Router {
+    struct RouterBuildNode *root; ///< tree routes are added to, freed by router_compile()
+    size_t nbuild_nodes;          ///< number of nodes of the tree
+    struct RouterNode *nodes;     ///< nodes of the compiled trie, the root first
+    size_t nnodes;                ///< number of nodes of the compiled trie
+    char *labels;                 ///< static labels and parameter names of the nodes
+    size_t labels_length;         ///< length of the labels
+    void **values;                ///< values of the routes
+    size_t nvalues;               ///< number of values
+};
+
+/**
+ * Parameter captured by a match.
+ */
+struct RouteParam {
+    strview_t name;  ///< name of the parameter, without the ':' or '*', viewing the router
+    strview_t value; ///< matched part of the path, viewing the path
+};
+
+/**
+ * Result of a match.
+ */
+struct RouteMatch {
+    void *value;                                 ///< value of the matched route, or NULL
+    uint32_t allowed_methods;                    ///< (1 << method) bits of routes matching the path but not the method
+    size_t nparams;                              ///< number of parameters captured
+    struct RouteParam params[ROUTER_MAX_PARAMS]; ///< parameters captured, in the order of the pattern
+};
+
+/**
+ * Initiate an empty router.
+ */
+Error_t router_init_(const ErrorInfo_t ei, struct Router *router);
+
+/**
+ * Free the router.
+ */
+void router_destroy(struct Router *router);
+
+/**
+ * Add a route with a value returned by matches. HTTP_METHOD_UNKNOWN adds the route for any method without a route of
+ * its own. The pattern must start with '/', and is copied. Fails if the route was already added, or a parameter at the
+ * same place has another name.
+ */
+Error_t router_add_(
+    const ErrorInfo_t ei, struct Router *router, const enum HTTPMethod method, const strview_t pattern, void *value);
+
+/**
+ * Compile the routes added into the trie used for matching. No routes can be added afterwards.
+ */
+Error_t router_compile_(const ErrorInfo_t ei, struct Router *router);
+
+/**
+ * Match a path against the compiled routes. HEAD requests fall back on GET routes. If no route matches, the methods of
+ * the routes matching the path are in the allowed methods of the match, for a 405 (Method Not Allowed) response.
+ */
+bool router_match(
+    const struct Router *router, const enum HTTPMethod method, const strview_t path, struct RouteMatch *out_match);
+
+/**
+ * Get the value of a parameter captured by a match, or empty if there is none with that name.
+ */
+strview_t route_match_param(const struct RouteMatch *match, const strview_t name);
+
+#define router_init(...)    router_init_(ERROR_INFO("router_init"), __VA_ARGS__)
+#define router_add(...)     router_add_(ERROR_INFO("router_add"), __VA_ARGS__)
+#define router_compile(...) router_compile_(ERROR_INFO("router_compile"), __VA_ARGS__)
@@ -0,0 +1,101 @@
+#include "arena.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT (alignof(max_align_t))
+
+static size_t align_up(const size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+}
+
+void arena_init(struct Arena *arena, const size_t block_size)
+{
+    *arena = (struct Arena){.block_size = align_up(block_size > 0 ? block_size : ARENA_DEFAULT_BLOCK_SIZE)};
+}
+
+void arena_destroy(struct Arena *arena)
+{
+    struct ArenaBlock *block = arena->first;
+    while (block) {
+        struct ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = arena->current = NULL;
+    arena->offset = 0;
+}
+
+void arena_reset(struct Arena *arena)
+{
+    arena->current = NULL;
+    arena->offset = 0;
+}
+
+void *arena_alloc(struct Arena *arena, const size_t size)
+{
+    if (size > SIZE_MAX - ARENA_ALIGNMENT - sizeof(struct ArenaBlock)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    const size_t nbytes = align_up(size > 0 ? size : 1);
+    if (arena->current && arena->current->size - arena->offset >= nbytes) {
+        void *ptr = &arena->current->data[arena->offset];
+        arena->offset += nbytes;
+        return ptr;
+    }
+
+    // move on to the next block kept from before the last reset. blocks too small for this allocation are skipped
+    // until the next reset:
+    struct ArenaBlock *prev = arena->current;
+    struct ArenaBlock *next = prev ? prev->next : arena->first;
+    while (next && next->size < nbytes) {
+        prev = next;
+        next = next->next;
+    }
+    if (!next) {
+        const size_t block_size = nbytes > arena->block_size ? nbytes : arena->block_size;
+        next = malloc(sizeof(struct ArenaBlock) + block_size);
+        if (!next) {
+            return NULL;
+        }
+        next->size = block_size;
+        next->next = NULL;
+        if (prev) {
+            prev->next = next;
+        }
+        else {
+            arena->first = next;
+        }
+    }
+    arena->current = next;
+    arena->offset = nbytes;
+    return next->data;
+}
+
+void *arena_realloc(struct Arena *arena, void *ptr, const size_t old_size, const size_t new_size)
+{
+    if (!ptr) {
+        return arena_alloc(arena, new_size);
+    }
+    // the last allocation ends where the free memory of the current block begins:
+    const size_t old_nbytes = align_up(old_size > 0 ? old_size : 1);
+    struct ArenaBlock *block = arena->current;
+    if (block && (char *)ptr + old_nbytes == &block->data[arena->offset] && new_size <= SIZE_MAX - ARENA_ALIGNMENT) {
+        const size_t new_nbytes = align_up(new_size > 0 ? new_size : 1);
+        const size_t begin = arena->offset - old_nbytes;
+        if (block->size - begin >= new_nbytes) {
+            arena->offset = begin + new_nbytes;
+            return ptr;
+        }
+    }
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stddef.h>
+
+#define ARENA_DEFAULT_BLOCK_SIZE (4096)
+
+/**
+ * Block of memory of an arena.
+ */
+struct ArenaBlock {
+    struct ArenaBlock *next;          ///< next block, allocated from once this block is full
+    size_t size;                      ///< size of the data of the block
+    alignas(max_align_t) char data[]; ///< memory handed out
+};
+
+/**
+ * Bump allocator for memory with the same lifetime, e.g. of a request or connection. Memory is handed out from blocks,
+ * which are kept when the arena is reset, so an arena used the same way over and over stops allocating after its first
+ * use. Nothing is allocated until the first allocation.
+ */
+struct Arena {
+    struct ArenaBlock *first;   ///< first block, or NULL
+    struct ArenaBlock *current; ///< block allocated from, or NULL before the first allocation since the last reset
+    size_t offset;              ///< offset of the free memory of the current block
+    size_t block_size;          ///< size of the blocks allocated, unless an allocation needs more
+};
+
+/**
+ * Initiate an empty arena, allocating blocks of block_size bytes as needed.
+ */
+void arena_init(struct Arena *arena, const size_t block_size);
+
+/**
+ * Free the blocks of the arena, and all memory allocated from it.
+ */
+void arena_destroy(struct Arena *arena);
+
+/**
+ * Release all memory allocated from the arena at once, keeping its blocks for the next allocations. O(1).
+ */
+void arena_reset(struct Arena *arena);
+
+/**
+ * Allocate memory aligned for any type, or NULL if out of memory (with errno set).
+ */
+void *arena_alloc(struct Arena *arena, const size_t size);
+
+/**
+ * Resize memory allocated from the arena. The last allocation is resized in place if its block has room, otherwise the
+ * memory is copied to a new allocation. Returns NULL if out of memory (with errno set), leaving the memory as is.
+ */
+void *arena_realloc(struct Arena *arena, void *ptr, const size_t old_size, const size_t new_size);
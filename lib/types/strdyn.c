@@ -2,6 +2,7 @@
 // https://github.com/antirez/sds
 
 #include "strdyn.h"
+#include "arena.h"
 
 #include "../error.h"
 
@@ -16,6 +17,7 @@
 typedef struct strdyn_impl {
     size_t length;
     size_t capacity;
+    struct Arena *arena; // the string was allocated from, or NULL if allocated with malloc()
     char buf[];
 } strdyn_impl_t;
 
@@ -34,7 +36,7 @@ static inline const strdyn_impl_t *container_of_strdyn_const(const strdyn_t s)
 
 void strdyn_free(strdyn_t s)
 {
-    if (s != NULL) free(s - BUFFER_OFFSET);
+    if (s != NULL && container_of_strdyn(s)->arena == NULL) free(s - BUFFER_OFFSET);
 }
 
 size_t strdyn_length(const strdyn_t s)
@@ -84,7 +86,9 @@ Error_t strdyn_reserve_(const ErrorInfo_t ei, strdyn_t *out, const size_t len)
         }
         const size_t prev_len = prev->length;
 
-        strdyn_impl_t *next = realloc(prev, BUFFER_OFFSET + (len + 1) * sizeof(char));
+        const size_t size = BUFFER_OFFSET + (len + 1) * sizeof(char);
+        strdyn_impl_t *next = prev->arena ? arena_realloc(prev->arena, prev, BUFFER_OFFSET + prev->capacity, size)
+                                          : realloc(prev, size);
         if (!next) {
             return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
         }
@@ -104,6 +108,23 @@ Error_t strdyn_empty_(const ErrorInfo_t ei, strdyn_t *out)
     return strdyn_reserve_(ei, out, INITIAL_SIZE);
 }
 
+Error_t strdyn_empty_in_(const ErrorInfo_t ei, struct Arena *arena, strdyn_t *out)
+{
+    RETURN_IF_NULL(ei, arena);
+    RETURN_IF_NULL(ei, out);
+
+    strdyn_impl_t *s = arena_alloc(arena, BUFFER_OFFSET + INITIAL_SIZE * sizeof(char));
+    if (!s) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    s->length = 0;
+    s->capacity = INITIAL_SIZE;
+    s->arena = arena;
+    s->buf[0] = '\0';
+    *out = (char *)s + BUFFER_OFFSET;
+    return NO_ERRORS;
+}
+
 static Error_t strdyn_ensure_capacity(const ErrorInfo_t ei, strdyn_t *out, const size_t min_capacity)
 {
     strdyn_impl_t *c = container_of_strdyn(*out);
@@ -125,12 +146,13 @@ Error_t strdyn_append_len_(const ErrorInfo_t ei, strdyn_t *out, const char *suff
     RETURN_IF_NULL(ei, *out);
 
     strdyn_impl_t *c = container_of_strdyn(*out);
-    if (c->length > SIZE_MAX - suffix_len) {
+    if (c->length > (SIZE_MAX - suffix_len) - 1) {
         return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "sum of sizes overflows"});
     }
     const size_t new_len = c->length + suffix_len;
 
-    const Error_t error = strdyn_ensure_capacity(ei, out, new_len);
+    // the capacity includes the NUL terminator:
+    const Error_t error = strdyn_ensure_capacity(ei, out, new_len + 1);
     if (error.tag != ERROR_NONE) {
         return error;
     }
@@ -206,7 +228,7 @@ Error_t strdyn_append_fmt_len_(const ErrorInfo_t ei, strdyn_t *out, const size_t
         return error_format_location(ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "sum of sizes overflows"});
     }
 
-    const Error_t error = strdyn_ensure_capacity(ei, out, c->length + max_len);
+    const Error_t error = strdyn_ensure_capacity(ei, out, c->length + max_len + 1);
     if (error.tag != ERROR_NONE) {
         return error;
     }
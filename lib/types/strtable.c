@@ -1,11 +1,226 @@
+// inspiration:
+// abseil.io/about/design/swisstables
+// github.com/wangyi-fudan/wyhash
+
 #include "strtable.h"
 
-#include <data-structures-c/fhashtable/fnvhash.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// a key is looked for in groups of slots, starting at the group picked by the high bits of its hash. the low 7 bits
+// of the hash are its tag, which is compared with the control bytes of a whole group at once. the first group with an
+// empty slot ends the search, which is where the key is inserted too, as keys are never removed one at a time.
+// at most 7/8 of the slots are used, so there is always an empty slot to end the search.
+
+#define STRTABLE_NOT_FOUND (UINT32_MAX)
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+static const uint64_t WYHASH_SECRET[4] = {
+    0x2d358dccaa6c78a5ull,
+    0x8bb84b93962eacc9ull,
+    0x4b33a62ed433d4a3ull,
+    0x4d5a2da51de1aa47ull,
+};
+
+static inline uint64_t wymix(const uint64_t a, const uint64_t b)
+{
+    const uint128_t r = (uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t strtable_hash(const struct strview key)
+{
+    const uint8_t *p = key.buf;
+    size_t n = key.length;
+    uint64_t seed = wymix(WYHASH_SECRET[0], WYHASH_SECRET[1]);
+    uint64_t a;
+    uint64_t b;
+
+    if (n <= 16) {
+        if (n >= 4) {
+            const size_t offset = (n >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + offset);
+            b = (read32(p + n - 4) << 32) | read32(p + n - 4 - offset);
+        }
+        else if (n > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        if (n > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = wymix(read64(p) ^ WYHASH_SECRET[1], read64(p + 8) ^ seed);
+                seed1 = wymix(read64(p + 16) ^ WYHASH_SECRET[2], read64(p + 24) ^ seed1);
+                seed2 = wymix(read64(p + 32) ^ WYHASH_SECRET[3], read64(p + 40) ^ seed2);
+                p += 48;
+                n -= 48;
+            } while (n > 48);
+            seed ^= seed1 ^ seed2;
+        }
+        while (n > 16) {
+            seed = wymix(read64(p) ^ WYHASH_SECRET[1], read64(p + 8) ^ seed);
+            p += 16;
+            n -= 16;
+        }
+        a = read64(p + n - 16);
+        b = read64(p + n - 8);
+    }
+
+    const uint128_t r = (uint128_t)(a ^ WYHASH_SECRET[1]) * (b ^ seed);
+    return wymix((uint64_t)r ^ WYHASH_SECRET[0] ^ key.length, (uint64_t)(r >> 64) ^ WYHASH_SECRET[1]);
+}
+
+static inline uint8_t hash_tag(const uint64_t hash)
+{
+    return (uint8_t)(hash & 0x7f);
+}
+
+// bit k of the mask is set if the control byte of slot k of the group equals byte:
+static inline uint32_t group_match(const uint8_t *group, const uint8_t byte)
+{
+#ifdef __SSE2__
+    const __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    uint32_t mask = 0;
+    for (uint32_t k = 0; k < STRTABLE_GROUP_SIZE; k++) {
+        mask |= (uint32_t)(group[k] == byte) << k;
+    }
+    return mask;
+#endif
+}
+
+// index of the slot of the key, or STRTABLE_NOT_FOUND with out_empty set to the slot to insert it at:
+static uint32_t find_slot(const strtable_t *self, const struct strview key, const uint64_t hash, uint32_t *out_empty)
+{
+    const uint8_t tag = hash_tag(hash);
+    const uint32_t group_mask = self->capacity / STRTABLE_GROUP_SIZE - 1;
+    uint32_t group = (uint32_t)(hash >> 7) & group_mask;
+
+    // triangular probing visits every group once when the number of groups is a power of two:
+    for (uint32_t step = 1; step <= group_mask + 1; step++) {
+        const uint32_t base = group * STRTABLE_GROUP_SIZE;
+        uint32_t matches = group_match(&self->ctrl[base], tag);
+        while (matches != 0) {
+            const uint32_t idx = base + (uint32_t)__builtin_ctz(matches);
+            const struct strtable_slot *slot = &self->slots[idx];
+            if (slot->hash == hash && strview_equals(slot->key, key)) {
+                return idx;
+            }
+            matches &= matches - 1;
+        }
+        const uint32_t empty = group_match(&self->ctrl[base], STRTABLE_CTRL_EMPTY);
+        if (empty != 0) {
+            if (out_empty) {
+                *out_empty = base + (uint32_t)__builtin_ctz(empty);
+            }
+            return STRTABLE_NOT_FOUND;
+        }
+        group = (group + step) & group_mask;
+    }
+    if (out_empty) {
+        *out_empty = STRTABLE_NOT_FOUND;
+    }
+    return STRTABLE_NOT_FOUND;
+}
+
+strtable_t *strtable_create(const uint32_t min_capacity)
+{
+    const uint64_t min_slots = (uint64_t)min_capacity * 8 / 7 + 1;
+    uint64_t capacity = STRTABLE_GROUP_SIZE;
+    while (capacity < min_slots) {
+        capacity <<= 1;
+    }
+    if (capacity > UINT32_MAX / 2) {
+        return NULL;
+    }
+
+    strtable_t *self = malloc(sizeof(*self) + capacity * (sizeof(struct strtable_slot) + 1));
+    if (!self) {
+        return NULL;
+    }
+    self->count = 0;
+    self->max_count = min_capacity;
+    self->capacity = (uint32_t)capacity;
+    self->slots = (struct strtable_slot *)(self + 1);
+    self->ctrl = (uint8_t *)(self->slots + capacity);
+    memset(self->ctrl, STRTABLE_CTRL_EMPTY, capacity);
+    return self;
+}
+
+void strtable_destroy(strtable_t *self)
+{
+    free(self);
+}
+
+bool strtable_is_full(const strtable_t *self)
+{
+    return self->count >= self->max_count;
+}
+
+bool strtable_contains_key(const strtable_t *self, const struct strview key)
+{
+    return find_slot(self, key, strtable_hash(key), NULL) != STRTABLE_NOT_FOUND;
+}
+
+struct strview strtable_get_value(const strtable_t *self, const struct strview key, const struct strview default_value)
+{
+    const uint32_t idx = find_slot(self, key, strtable_hash(key), NULL);
+    return idx != STRTABLE_NOT_FOUND ? self->slots[idx].value : default_value;
+}
+
+struct strview *strtable_get_value_mut(strtable_t *self, const struct strview key)
+{
+    const uint32_t idx = find_slot(self, key, strtable_hash(key), NULL);
+    return idx != STRTABLE_NOT_FOUND ? &self->slots[idx].value : NULL;
+}
+
+void strtable_update(strtable_t *self, const struct strview key, const struct strview value)
+{
+    const uint64_t hash = strtable_hash(key);
+    uint32_t empty;
+    const uint32_t idx = find_slot(self, key, hash, &empty);
+    if (idx != STRTABLE_NOT_FOUND) {
+        self->slots[idx].value = value;
+        return;
+    }
+    assert(!strtable_is_full(self));
+    if (empty == STRTABLE_NOT_FOUND) {
+        return;
+    }
+
+    self->ctrl[empty] = hash_tag(hash);
+    self->slots[empty] = (struct strtable_slot){.key = key, .value = value, .hash = hash};
+    self->count++;
+}
 
-#define NAME               strtable
-#define KEY_TYPE           struct strview
-#define VALUE_TYPE         struct strview
-#define KEY_IS_EQUAL(a, b) (strview_equals((a), (b)))
-#define HASH_FUNCTION(key) (fnvhash_32((uint8_t *)(key).buf, (size_t)(key).length))
-#define FUNCTION_DEFINITIONS
-#include <data-structures-c/fhashtable/fhashtable_template.h>
+void strtable_clear(strtable_t *self)
+{
+    memset(self->ctrl, STRTABLE_CTRL_EMPTY, self->capacity);
+    self->count = 0;
+}
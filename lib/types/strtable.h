@@ -2,10 +2,85 @@
 
 #include "strview.h"
 
-#define NAME       strtable
-#define KEY_TYPE   struct strview
-#define VALUE_TYPE struct strview
-#define TYPE_DEFINITIONS
-#include <data-structures-c/fhashtable/fhashtable_template.h>
+#include <stdbool.h>
+#include <stdint.h>
 
-typedef struct strtable strtable_t;
+#define STRTABLE_GROUP_SIZE (16)
+#define STRTABLE_CTRL_EMPTY (0x80)
+
+/**
+ * Slot of a strtable, with the hash of its key so keys are only compared when their hashes are equal.
+ */
+struct strtable_slot {
+    struct strview key;   ///< key, not copied
+    struct strview value; ///< value, not copied
+    uint64_t hash;        ///< strtable_hash() of the key
+};
+
+/**
+ * Open-addressing table from strviews to strviews, probed a group of STRTABLE_GROUP_SIZE slots at a time (a "Swiss
+ * table"). Every slot has a control byte, which is STRTABLE_CTRL_EMPTY or the low 7 bits of the hash of its key, and
+ * the control bytes of a group are compared with the hash looked for at once, with SSE2 where available. The table has
+ * a fixed capacity, and the keys and values are views of memory owned by the caller.
+ */
+typedef struct strtable {
+    uint32_t count;              ///< number of keys
+    uint32_t max_count;          ///< number of keys the table was created for
+    uint32_t capacity;           ///< number of slots, a power of two and a multiple of STRTABLE_GROUP_SIZE
+    uint8_t *ctrl;               ///< control byte of each slot
+    struct strtable_slot *slots; ///< slots, valid where the control byte is not STRTABLE_CTRL_EMPTY
+} strtable_t;
+
+/**
+ * Iterate over the keys and values of a table, in no particular order.
+ */
+#define STRTABLE_FOR_EACH(self, index, key_, value_)                                                                   \
+    for ((index) = 0; (index) < (self)->capacity; (index)++)                                                           \
+        if ((self)->ctrl[(index)] != STRTABLE_CTRL_EMPTY &&                                                            \
+            (((key_) = (self)->slots[(index)].key), ((value_) = (self)->slots[(index)].value), true))
+
+/**
+ * Hash a string, 8 bytes at a time (wyhash).
+ */
+uint64_t strtable_hash(const struct strview key);
+
+/**
+ * Create a table with room for at least min_capacity keys, or NULL if out of memory.
+ */
+strtable_t *strtable_create(const uint32_t min_capacity);
+
+/**
+ * Destroy a table.
+ */
+void strtable_destroy(strtable_t *self);
+
+/**
+ * Check if the table has as many keys as it was created for.
+ */
+bool strtable_is_full(const strtable_t *self);
+
+/**
+ * Check if the table contains a key.
+ */
+bool strtable_contains_key(const strtable_t *self, const struct strview key);
+
+/**
+ * Get the value of a key, or default_value if the table does not contain the key.
+ */
+struct strview strtable_get_value(const strtable_t *self, const struct strview key, const struct strview default_value);
+
+/**
+ * Get a pointer to the value of a key, or NULL if the table does not contain the key.
+ */
+struct strview *strtable_get_value_mut(strtable_t *self, const struct strview key);
+
+/**
+ * Set the value of a key, inserting the key if the table does not contain it. The table must not be full when
+ * inserting.
+ */
+void strtable_update(strtable_t *self, const struct strview key, const struct strview value);
+
+/**
+ * Remove all keys of the table.
+ */
+void strtable_clear(strtable_t *self);
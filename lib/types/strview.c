@@ -6,18 +6,35 @@
 #include <assert.h>
 #include <ctype.h>
 
-bool strview_find_firstc(const strview_t s, const uint8_t c, strview_t *out)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+bool strview_equals_ignore_case(const strview_t lhs, const strview_t rhs)
 {
-    if (!out) {
+    if (lhs.length != rhs.length) {
         return false;
     }
-    for (size_t i = 0; i < s.length; i++) {
-        if (s.buf[i] == c) {
-            *out = strview_drop(s, i);
-            return true;
+    for (size_t i = 0; i < lhs.length; i++) {
+        if (tolower(lhs.buf[i]) != tolower(rhs.buf[i])) {
+            return false;
         }
     }
-    return false;
+    return true;
+}
+
+bool strview_find_firstc(const strview_t s, const uint8_t c, strview_t *out)
+{
+    if (!out || s.length == 0) {
+        return false;
+    }
+    // memchr() is vectorized in any libc worth its salt.
+    const uint8_t *p = memchr(s.buf, c, s.length);
+    if (p == NULL) {
+        return false;
+    }
+    *out = strview_drop(s, (size_t)(p - s.buf));
+    return true;
 }
 
 bool strview_find_first(const strview_t s, const strview_t occurrence, strview_t *out)
@@ -31,14 +48,19 @@ bool strview_find_first(const strview_t s, const strview_t occurrence, strview_t
         return true;
     case 1:
         return strview_find_firstc(s, occurrence.buf[0], out);
-    default:
-        for (size_t i = 0; i <= s.length - occurrence.length; i++) {
-            if (memcmp(&s.buf[i], occurrence.buf, occurrence.length) == 0) {
-                *out = strview_drop(s, i);
+    default: {
+        // skip to candidates with memchr(), then compare the rest.
+        strview_t rest = strview_take(s, s.length - occurrence.length + 1);
+        strview_t candidate = STRVIEW_EMPTY;
+        while (strview_find_firstc(rest, occurrence.buf[0], &candidate)) {
+            if (memcmp(candidate.buf + 1, occurrence.buf + 1, occurrence.length - 1) == 0) {
+                *out = strview_drop(s, (size_t)(candidate.buf - s.buf));
                 return true;
             }
+            rest = strview_drop(candidate, 1);
         }
         return false;
+    }
     };
 }
 
@@ -79,6 +101,60 @@ bool strview_find_last(const strview_t s, const strview_t occurrence, strview_t
     }
 }
 
+bool strview_find_crlf(const strview_t s, strview_t *out)
+{
+    if (!out || s.length < 2) {
+        return false;
+    }
+    // search for LF rather than CR. a CR not followed by LF is rare, so candidates rarely fail.
+    strview_t rest = strview_drop(s, 1);
+    strview_t lf = STRVIEW_EMPTY;
+    while (strview_find_firstc(rest, '\n', &lf)) {
+        if (lf.buf[-1] == '\r') {
+            *out = strview_drop(s, (size_t)(lf.buf - 1 - s.buf));
+            return true;
+        }
+        rest = strview_drop(lf, 1);
+    }
+    return false;
+}
+
+bool strview_find_header_end(const strview_t s, strview_t *out)
+{
+    if (!out || s.length < 4) {
+        return false;
+    }
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // compare 16 positions at once: bit k of the mask is set if "\r\n\r\n" starts at i + k.
+    const __m128i CR = _mm_set1_epi8('\r');
+    const __m128i LF = _mm_set1_epi8('\n');
+    for (; i + 16 + 3 <= s.length; i += 16) {
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)&s.buf[i]);
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)&s.buf[i + 1]);
+        const __m128i b2 = _mm_loadu_si128((const __m128i *)&s.buf[i + 2]);
+        const __m128i b3 = _mm_loadu_si128((const __m128i *)&s.buf[i + 3]);
+        const __m128i m = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(b0, CR), _mm_cmpeq_epi8(b1, LF)),
+            _mm_and_si128(_mm_cmpeq_epi8(b2, CR), _mm_cmpeq_epi8(b3, LF)));
+        const unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask != 0) {
+            *out = strview_drop(s, i + (size_t)__builtin_ctz(mask));
+            return true;
+        }
+    }
+#endif
+
+    for (; i + 4 <= s.length; i++) {
+        if (memcmp(&s.buf[i], "\r\n\r\n", 4) == 0) {
+            *out = strview_drop(s, i);
+            return true;
+        }
+    }
+    return false;
+}
+
 strview_t strview_trim_left(const strview_t s)
 {
     size_t i = 0;
@@ -45,6 +45,8 @@ static inline bool strview_equals(const strview_t lhs, const strview_t rhs)
     return memcmp(lhs.buf, rhs.buf, lhs.length) == 0;
 }
 
+bool strview_equals_ignore_case(const strview_t lhs, const strview_t rhs);
+
 static inline strview_t strview_drop(const strview_t s, const size_t n)
 {
     if (s.length <= n) {
@@ -65,6 +67,9 @@ bool strview_find_first(const strview_t s, const strview_t occurrence, strview_t
 bool strview_find_lastc(const strview_t s, const uint8_t c, strview_t *out);
 bool strview_find_last(const strview_t s, const strview_t occurrence, strview_t *out);
 
+bool strview_find_crlf(const strview_t s, strview_t *out);
+bool strview_find_header_end(const strview_t s, strview_t *out);
+
 strview_t strview_trim_left(const strview_t s);
 strview_t strview_trim_right(const strview_t s);
 strview_t strview_trim(const strview_t s);
@@ -0,0 +1,44 @@
+#include "strview.h"
+
+#include <assert.h>
+#include <stdio.h>
+
+int main()
+{
+    strview_t s;
+    strview_t out;
+
+    s = STRVIEW_FROM("GET / HTTP/1.1\r\nHost: localhost\r\n\r\nbody");
+    assert(strview_find_firstc(s, ' ', &out));
+    assert(out.buf == s.buf + 3);
+    assert(!strview_find_firstc(s, '#', &out));
+
+    assert(strview_find_first(s, STRVIEW_FROM("Host"), &out));
+    assert(out.buf == s.buf + 16);
+    assert(!strview_find_first(s, STRVIEW_FROM("bodyy"), &out));
+    assert(strview_find_first(s, STRVIEW_FROM("body"), &out));
+    assert(out.length == 4);
+
+    assert(strview_find_crlf(s, &out));
+    assert(out.buf == s.buf + 14);
+    assert(!strview_find_crlf(STRVIEW_FROM("\r \n\r"), &out));
+    assert(strview_find_crlf(STRVIEW_FROM("\n\r\r\n"), &out));
+
+    assert(strview_find_header_end(s, &out));
+    assert(out.buf == s.buf + 31);
+    assert(!strview_find_header_end(STRVIEW_FROM("\r\n\r"), &out));
+
+    // header ends at every position relative to the 16-byte blocks:
+    char buf[64];
+    for (size_t i = 0; i + 4 <= sizeof(buf); i++) {
+        memset(buf, 'a', sizeof(buf));
+        memcpy(&buf[i], "\r\n\r\n", 4);
+        assert(strview_find_header_end(strview_from_sized((uint8_t *)buf, sizeof(buf)), &out));
+        assert(out.buf == (uint8_t *)&buf[i]);
+    }
+
+    assert(strview_equals_ignore_case(STRVIEW_FROM("Content-Length"), STRVIEW_FROM("content-LENGTH")));
+    assert(!strview_equals_ignore_case(STRVIEW_FROM("Content-Length"), STRVIEW_FROM("Content-Lengtx")));
+
+    printf("ok\n");
+}
@@ -0,0 +1,293 @@
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+// based on:
+// https://man7.org/linux/man-pages/man7/io_uring.7.html
+// https://kernel.dk/io_uring.pdf
+//
+// the rings are shared with the kernel. the side producing entries writes the tail, the side consuming them writes
+// the head, so each index has a single writer. entries are published with a release store of the tail, and taken
+// back with a release store of the head.
+
+static int sys_io_uring_setup(const uint32_t nentries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, nentries, params);
+}
+
+static int sys_io_uring_enter(
+    const int ring_fd,
+    const uint32_t to_submit,
+    const uint32_t min_complete,
+    const uint32_t flags,
+    const void *arg,
+    const size_t arg_size)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_size);
+}
+
+static int sys_io_uring_register(const int ring_fd, const uint32_t opcode, const void *arg, const uint32_t nargs)
+{
+    return (int)syscall(__NR_io_uring_register, ring_fd, opcode, arg, nargs);
+}
+
+static void *ring_ptr(void *base, const uint32_t offset)
+{
+    return (char *)base + offset;
+}
+
+/**
+ * Set up an io_uring instance, asking for the flags that suit a single thread owning the ring first.
+ */
+static int setup_ring(const uint32_t nentries, struct io_uring_params *out_params)
+{
+    // completions of multishot operations outnumber submissions.
+    const struct io_uring_params base = {.flags = IORING_SETUP_CQSIZE, .cq_entries = nentries * 4};
+
+    *out_params = base;
+    out_params->flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    int ring_fd = sys_io_uring_setup(nentries, out_params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        // kernels before 6.1.
+        *out_params = base;
+        ring_fd = sys_io_uring_setup(nentries, out_params);
+    }
+    return ring_fd;
+}
+
+Error_t uring_init_(const ErrorInfo_t ei, struct URing *ring, const uint32_t nentries)
+{
+    RETURN_IF_NULL(ei, ring);
+
+    *ring = (struct URing){.ring_fd = -1, .sq_ring = MAP_FAILED, .cq_ring = MAP_FAILED};
+
+    struct io_uring_params params;
+    ring->ring_fd = setup_ring(nentries, &params);
+    if (ring->ring_fd < 0) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    ring->features = params.features;
+
+    // waiting with a timeout needs EXT_ARG (5.11), and completions must not be dropped when the queue is full.
+    const uint32_t needed_features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((ring->features & needed_features) != needed_features) {
+        uring_destroy(ring);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = EINVAL});
+    }
+
+    // with IORING_FEAT_SINGLE_MMAP, both rings share one mapping.
+    const size_t sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    const size_t cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_ring_size = ring->cq_ring_size = sq_ring_size > cq_ring_size ? sq_ring_size : cq_ring_size;
+    ring->sq_ring = mmap(
+        NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        const int errno_num = errno;
+        uring_destroy(ring);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    ring->cq_ring = ring->sq_ring;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    struct io_uring_sqe *sqes = mmap(
+        NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        const int errno_num = errno;
+        uring_destroy(ring);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+
+    ring->sq = (struct URingSubmissionQueue){
+        .head = ring_ptr(ring->sq_ring, params.sq_off.head),
+        .tail = ring_ptr(ring->sq_ring, params.sq_off.tail),
+        .mask = *(uint32_t *)ring_ptr(ring->sq_ring, params.sq_off.ring_mask),
+        .nentries = params.sq_entries,
+        .array = ring_ptr(ring->sq_ring, params.sq_off.array),
+        .sqes = sqes,
+        .sqe_tail = 0,
+    };
+    ring->cq = (struct URingCompletionQueue){
+        .head = ring_ptr(ring->cq_ring, params.cq_off.head),
+        .tail = ring_ptr(ring->cq_ring, params.cq_off.tail),
+        .mask = *(uint32_t *)ring_ptr(ring->cq_ring, params.cq_off.ring_mask),
+        .nentries = params.cq_entries,
+        .cqes = ring_ptr(ring->cq_ring, params.cq_off.cqes),
+    };
+    // the entries are used in order, so the indirection array maps each index to itself once.
+    for (uint32_t i = 0; i < ring->sq.nentries; i++) {
+        ring->sq.array[i] = i;
+    }
+    return NO_ERRORS;
+}
+
+void uring_destroy(struct URing *ring)
+{
+    if (ring->sq.sqes) {
+        munmap(ring->sq.sqes, ring->sqes_size);
+        ring->sq.sqes = NULL;
+    }
+    if (ring->sq_ring != MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        ring->sq_ring = ring->cq_ring = MAP_FAILED;
+    }
+    if (ring->ring_fd >= 0) {
+        close(ring->ring_fd);
+        ring->ring_fd = -1;
+    }
+}
+
+struct io_uring_sqe *uring_get_sqe(struct URing *ring)
+{
+    if (uring_sq_space_left(ring) == 0) {
+        return NULL;
+    }
+    struct io_uring_sqe *sqe = &ring->sq.sqes[ring->sq.sqe_tail & ring->sq.mask];
+    ring->sq.sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+uint32_t uring_sq_space_left(const struct URing *ring)
+{
+    return ring->sq.nentries - (ring->sq.sqe_tail - __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE));
+}
+
+Error_t uring_submit_and_wait_(const ErrorInfo_t ei, struct URing *ring, const uint32_t wait_nr, const int timeout_ms)
+{
+    RETURN_IF_NULL(ei, ring);
+
+    // entries published before, but not consumed by the kernel because a call failed, are submitted again.
+    __atomic_store_n(ring->sq.tail, ring->sq.sqe_tail, __ATOMIC_RELEASE);
+    const uint32_t to_submit = ring->sq.sqe_tail - __atomic_load_n(ring->sq.head, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000LL,
+    };
+    const struct io_uring_getevents_arg arg = {
+        .sigmask = 0,
+        .sigmask_sz = _NSIG / 8,
+        .ts = timeout_ms < 0 ? 0 : (uint64_t)(uintptr_t)&ts,
+    };
+    const uint32_t flags = IORING_ENTER_EXT_ARG | (wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (sys_io_uring_enter(ring->ring_fd, to_submit, wait_nr, flags, &arg, sizeof(arg)) < 0) {
+        // timing out, being interrupted, or the completion queue being full is not an error: the completions are
+        // handled, and the call is made again.
+        if (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) {
+            return NO_ERRORS;
+        }
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    return NO_ERRORS;
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct URing *ring)
+{
+    const uint32_t head = *ring->cq.head;
+    if (head == __atomic_load_n(ring->cq.tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cq.cqes[head & ring->cq.mask];
+}
+
+void uring_cqe_seen(struct URing *ring)
+{
+    __atomic_store_n(ring->cq.head, *ring->cq.head + 1, __ATOMIC_RELEASE);
+}
+
+Error_t uring_buffer_ring_init_(
+    const ErrorInfo_t ei,
+    struct URing *ring,
+    struct URingBufferRing *buffer_ring,
+    const uint16_t group_id,
+    const uint16_t nbuffers,
+    const uint32_t buffer_size)
+{
+    RETURN_IF_NULL(ei, ring);
+    RETURN_IF_NULL(ei, buffer_ring);
+
+    if (nbuffers == 0 || (nbuffers & (nbuffers - 1)) != 0) {
+        return error_format_location(
+            ei, (Error_t){.tag = ERROR_CUSTOM, .custom_msg = "number of buffers is not a power of two"});
+    }
+
+    *buffer_ring = (struct URingBufferRing){
+        .ring = NULL,
+        .group_id = group_id,
+        .nbuffers = nbuffers,
+        .buffer_size = buffer_size,
+        .buffers = NULL,
+        .ring_size = nbuffers * sizeof(struct io_uring_buf),
+    };
+
+    // the ring must be page aligned.
+    void *ring_mem = mmap(NULL, buffer_ring->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring_mem == MAP_FAILED) {
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    buffer_ring->ring = ring_mem;
+
+    buffer_ring->buffers = malloc((size_t)nbuffers * buffer_size);
+    if (!buffer_ring->buffers) {
+        munmap(ring_mem, buffer_ring->ring_size);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = ENOMEM});
+    }
+
+    const struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)ring_mem,
+        .ring_entries = nbuffers,
+        .bgid = group_id,
+    };
+    if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        const int errno_num = errno;
+        free(buffer_ring->buffers);
+        munmap(ring_mem, buffer_ring->ring_size);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+
+    for (uint16_t i = 0; i < nbuffers; i++) {
+        uring_buffer_recycle(buffer_ring, i);
+    }
+    return NO_ERRORS;
+}
+
+void uring_buffer_ring_destroy(struct URing *ring, struct URingBufferRing *buffer_ring)
+{
+    if (!buffer_ring->ring) {
+        return;
+    }
+    const struct io_uring_buf_reg reg = {.bgid = buffer_ring->group_id};
+    (void)sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(buffer_ring->ring, buffer_ring->ring_size);
+    free(buffer_ring->buffers);
+    buffer_ring->ring = NULL;
+    buffer_ring->buffers = NULL;
+}
+
+char *uring_buffer_get(const struct URingBufferRing *buffer_ring, const uint16_t buffer_id)
+{
+    return &buffer_ring->buffers[(size_t)buffer_id * buffer_ring->buffer_size];
+}
+
+void uring_buffer_recycle(struct URingBufferRing *buffer_ring, const uint16_t buffer_id)
+{
+    // only this thread writes the tail. the tail shares its place with the reserved field of the first buffer, so the
+    // fields are set one by one.
+    const uint16_t tail = buffer_ring->ring->tail;
+    struct io_uring_buf *buf = &buffer_ring->ring->bufs[tail & (buffer_ring->nbuffers - 1)];
+    buf->addr = (uint64_t)(uintptr_t)uring_buffer_get(buffer_ring, buffer_id);
+    buf->len = buffer_ring->buffer_size;
+    buf->bid = buffer_id;
+    __atomic_store_n(&buffer_ring->ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif
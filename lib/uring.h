@@ -0,0 +1,135 @@
+#pragma once
+
+#include "error.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// only available when the kernel headers of the build have io_uring with provided buffer rings, which defines
+// HAVE_IO_URING.
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+
+/**
+ * Submission queue of an io_uring instance, as mapped from the kernel.
+ */
+struct URingSubmissionQueue {
+    uint32_t *head;            ///< first entry not consumed by the kernel yet (written by the kernel)
+    uint32_t *tail;            ///< end of the entries published to the kernel (written by us)
+    uint32_t mask;             ///< ring index mask
+    uint32_t nentries;         ///< number of entries
+    uint32_t *array;           ///< indirection array mapping ring indices to entries
+    struct io_uring_sqe *sqes; ///< the entries
+    uint32_t sqe_tail;         ///< end of the entries handed out, published on the next uring_submit_and_wait()
+};
+
+/**
+ * Completion queue of an io_uring instance, as mapped from the kernel.
+ */
+struct URingCompletionQueue {
+    uint32_t *head;            ///< first completion not consumed yet (written by us)
+    uint32_t *tail;            ///< end of the completions posted so far (written by the kernel)
+    uint32_t mask;             ///< ring index mask
+    uint32_t nentries;         ///< number of entries
+    struct io_uring_cqe *cqes; ///< the completions
+};
+
+/**
+ * io_uring instance, driven with raw system calls.
+ */
+struct URing {
+    int ring_fd;                    ///< io_uring file handle
+    uint32_t features;              ///< IORING_FEAT_* supported by the kernel
+    struct URingSubmissionQueue sq; ///< submission queue
+    struct URingCompletionQueue cq; ///< completion queue
+    void *sq_ring;                  ///< mapping of the submission ring
+    size_t sq_ring_size;            ///< size of the mapping of the submission ring
+    void *cq_ring;                  ///< mapping of the completion ring, shared with the submission ring
+    size_t cq_ring_size;            ///< size of the mapping of the completion ring
+    size_t sqes_size;               ///< size of the mapping of the submission entries
+};
+
+/**
+ * Ring of buffers provided to the kernel, from which recieves pick a buffer as data arrives, so idle connections
+ * hold no buffer.
+ */
+struct URingBufferRing {
+    struct io_uring_buf_ring *ring; ///< ring shared with the kernel
+    uint16_t group_id;              ///< buffer group id, passed to recieves
+    uint16_t nbuffers;              ///< number of buffers, a power of two
+    uint32_t buffer_size;           ///< size of each buffer
+    char *buffers;                  ///< memory of the buffers
+    size_t ring_size;               ///< size of the mapping of the ring
+};
+
+/**
+ * Initiate an io_uring instance with room for nentries submissions (rounded up to a power of two by the kernel).
+ * Fails with ENOSYS / EPERM / EINVAL if io_uring is not available, or lacks features needed.
+ */
+Error_t uring_init_(const ErrorInfo_t ei, struct URing *ring, const uint32_t nentries);
+
+/**
+ * Unmap and close an io_uring instance. Operations still in flight are canceled.
+ */
+void uring_destroy(struct URing *ring);
+
+/**
+ * Get a cleared submission entry, or NULL if the submission queue is full. The entry is submitted with the next
+ * uring_submit_and_wait().
+ */
+struct io_uring_sqe *uring_get_sqe(struct URing *ring);
+
+/**
+ * Get the number of submission entries left before the submission queue is full.
+ */
+uint32_t uring_sq_space_left(const struct URing *ring);
+
+/**
+ * Submit the entries got since the last submit, and wait until there are at least wait_nr completions or timeout_ms
+ * passed (timeout_ms < 0 waits without a timeout). Submission and waiting is done in a single system call.
+ */
+Error_t uring_submit_and_wait_(const ErrorInfo_t ei, struct URing *ring, const uint32_t wait_nr, const int timeout_ms);
+
+/**
+ * Get the next completion, or NULL if there are none. Mark it consumed with uring_cqe_seen().
+ */
+struct io_uring_cqe *uring_peek_cqe(struct URing *ring);
+
+/**
+ * Mark the completion got from uring_peek_cqe() consumed.
+ */
+void uring_cqe_seen(struct URing *ring);
+
+/**
+ * Register a ring of nbuffers buffers of buffer_size bytes each under group_id. nbuffers must be a power of two.
+ */
+Error_t uring_buffer_ring_init_(
+    const ErrorInfo_t ei,
+    struct URing *ring,
+    struct URingBufferRing *buffer_ring,
+    const uint16_t group_id,
+    const uint16_t nbuffers,
+    const uint32_t buffer_size);
+
+/**
+ * Unregister and free a ring of buffers.
+ */
+void uring_buffer_ring_destroy(struct URing *ring, struct URingBufferRing *buffer_ring);
+
+/**
+ * Get a buffer of the ring by its id.
+ */
+char *uring_buffer_get(const struct URingBufferRing *buffer_ring, const uint16_t buffer_id);
+
+/**
+ * Give a buffer picked by a recieve back to the kernel.
+ */
+void uring_buffer_recycle(struct URingBufferRing *buffer_ring, const uint16_t buffer_id);
+
+#define uring_init(...)             uring_init_(ERROR_INFO("uring_init"), __VA_ARGS__)
+#define uring_submit_and_wait(...)  uring_submit_and_wait_(ERROR_INFO("uring_submit_and_wait"), __VA_ARGS__)
+#define uring_buffer_ring_init(...) uring_buffer_ring_init_(ERROR_INFO("uring_buffer_ring_init"), __VA_ARGS__)
+
+#endif
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE // cpu affinity
+
+#include "worker_pool.h"
+#include "connection.h"
+#include "connection_tcp.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// based on:
+// https://lwn.net/Articles/542629/
+//
+// every worker opens its own SO_REUSEPORT server socket, so the kernel distributes incoming connections between the
+// workers, and the workers share nothing but the port.
+//
+// besides the port, the workers share an eventfd watched by each of their loops. it is written to when a worker fails
+// or fails to start, stopping the rest, so the pool does not keep serving with fewer workers than asked for. the index
+// of the worker failing first is recorded too, as its error is the one returned, and not those of the workers stopped
+// after it.
+
+struct Worker {
+    const struct WorkerPoolConfig *config; ///< configuration of the pool
+    size_t idx;                            ///< index of the worker
+    int cpu;                               ///< cpu to pin the worker to, or -1
+    int stop_fd;                           ///< eventfd shared by the workers, written to stop all of them
+    size_t *first_failed;                  ///< index of the worker failing first, shared by the workers, or SIZE_MAX
+    pthread_t thread;                      ///< thread running the worker
+    Error_t error;                         ///< error the worker stopped with
+};
+
+static size_t get_available_cpus(const size_t max_ncpus, int *out_cpus)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+        return 0;
+    }
+    size_t ncpus = 0;
+    for (size_t cpu = 0; cpu < CPU_SETSIZE && ncpus < max_ncpus; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            out_cpus[ncpus++] = (int)cpu;
+        }
+    }
+    return ncpus;
+}
+
+size_t worker_pool_default_size(void)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == -1) {
+        return 1;
+    }
+    const int ncpus = CPU_COUNT(&set);
+    return ncpus > 0 ? (size_t)ncpus : 1;
+}
+
+static void stop_workers(const int stop_fd, size_t *first_failed, const size_t idx)
+{
+    size_t none = SIZE_MAX;
+    __atomic_compare_exchange_n(first_failed, &none, idx, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+
+    // the eventfd is never read, so it stays readable for the loops yet to watch it:
+    eventfd_write(stop_fd, 1);
+}
+
+static void on_stop_readable(void *arg)
+{
+    event_loop_stop(arg);
+}
+
+static Error_t worker_serve(struct Worker *worker)
+{
+    const struct WorkerPoolConfig *config = worker->config;
+
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t)worker->cpu, &set);
+        const int retval = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (retval != 0) {
+            return error_format_location(
+                ERROR_INFO("pthread_setaffinity_np"), (Error_t){.tag = ERROR_ERRNO, .errno_num = retval});
+        }
+    }
+
+    int server_fd = -1;
+    Error_t error = open_tcp_server_reuseport(config->backlog_size, config->port, &server_fd);
+    if (error.tag != ERROR_NONE) {
+        return error;
+    }
+
+    struct EventLoopHandler handler = {0};
+    error = config->init_handler(config->handler_arg, worker->idx, &handler);
+    if (error.tag == ERROR_NONE) {
+        struct EventLoop loop;
+        error = event_loop_init(&loop, server_fd, config->loop_config, handler);
+        if (error.tag == ERROR_NONE) {
+            error = event_loop_watch_fd(&loop, worker->stop_fd, on_stop_readable, &loop);
+            if (error.tag == ERROR_NONE) {
+                error = event_loop_run(&loop);
+            }
+            event_loop_destroy(&loop);
+        }
+        if (config->destroy_handler) {
+            config->destroy_handler(config->handler_arg, worker->idx, &handler);
+        }
+    }
+
+    close_socket(server_fd);
+    return error;
+}
+
+static void *worker_run(void *arg)
+{
+    struct Worker *worker = arg;
+    worker->error = worker_serve(worker);
+    if (worker->error.tag != ERROR_NONE) {
+        stop_workers(worker->stop_fd, worker->first_failed, worker->idx);
+    }
+    return NULL;
+}
+
+Error_t worker_pool_run_(const ErrorInfo_t ei, const struct WorkerPoolConfig *config)
+{
+    RETURN_IF_NULL(ei, config);
+    RETURN_IF_NULL(ei, config->init_handler);
+
+    const size_t nworkers = config->nworkers == 0 ? worker_pool_default_size() : config->nworkers;
+
+    struct Worker *workers = calloc(nworkers, sizeof(*workers));
+    int *cpus = calloc(CPU_SETSIZE, sizeof(*cpus));
+    if (!workers || !cpus) {
+        free(workers);
+        free(cpus);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno});
+    }
+    const int stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (stop_fd == -1) {
+        const int errno_num = errno;
+        free(workers);
+        free(cpus);
+        return error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = errno_num});
+    }
+    const size_t ncpus = config->pin_to_cpus ? get_available_cpus(CPU_SETSIZE, cpus) : 0;
+
+    Error_t start_error = NO_ERRORS;
+    size_t first_failed = SIZE_MAX;
+    size_t nstarted = 0;
+    for (; nstarted < nworkers; nstarted++) {
+        struct Worker *worker = &workers[nstarted];
+        worker->config = config;
+        worker->idx = nstarted;
+        worker->cpu = ncpus > 0 ? cpus[nstarted % ncpus] : -1;
+        worker->stop_fd = stop_fd;
+        worker->first_failed = &first_failed;
+        worker->error = NO_ERRORS;
+
+        const int retval = pthread_create(&worker->thread, NULL, worker_run, worker);
+        if (retval != 0) {
+            // stop the workers already started, as they would otherwise never be joined:
+            start_error = error_format_location(ei, (Error_t){.tag = ERROR_ERRNO, .errno_num = retval});
+            stop_workers(stop_fd, &first_failed, nstarted);
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < nstarted; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    // the workers are joined, so first_failed is read without the atomics:
+    Error_t error = NO_ERRORS;
+    if (first_failed == nstarted) {
+        error = start_error;
+    }
+    else if (first_failed < nstarted) {
+        error = workers[first_failed].error;
+    }
+
+    close(stop_fd);
+    free(workers);
+    free(cpus);
+    return error;
+}
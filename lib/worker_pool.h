@@ -0,0 +1,43 @@
+#pragma once
+
+#include "error.h"
+#include "event_loop.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Configuration of a pool of workers, each running an event loop on its own server socket bound to a shared port.
+ */
+struct WorkerPoolConfig {
+    const char *port;                   ///< port shared by the server sockets of the workers
+    int backlog_size;                   ///< max incoming connections requests of each server socket
+    size_t nworkers;                    ///< number of workers, or 0 for one worker per available cpu
+    bool pin_to_cpus;                   ///< pin worker i to the i-th available cpu (modulo the number of cpus)
+    struct EventLoopConfig loop_config; ///< limits on the connections of each worker
+    void *handler_arg;                  ///< argument passed to init_handler and destroy_handler
+
+    /**
+     * Initiate the event loop handler of a worker. Called from the thread of the worker, so workers can keep state
+     * of their own without locking.
+     */
+    Error_t (*init_handler)(void *arg, const size_t worker_idx, struct EventLoopHandler *out_handler);
+
+    /**
+     * Destroy the event loop handler of a worker. Nullable.
+     */
+    void (*destroy_handler)(void *arg, const size_t worker_idx, struct EventLoopHandler *handler);
+};
+
+/**
+ * Get the number of cpus available to the process.
+ */
+size_t worker_pool_default_size(void);
+
+/**
+ * Start the workers and wait for them to stop. Once any worker fails, or a worker fails to start, the rest are stopped
+ * and the first error is returned.
+ */
+Error_t worker_pool_run_(const ErrorInfo_t ei, const struct WorkerPoolConfig *config);
+
+#define worker_pool_run(...) worker_pool_run_(ERROR_INFO("worker_pool_run"), __VA_ARGS__)